@@ -13,7 +13,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <poll.h>
 
 #include <xcb/xcb.h>
@@ -29,6 +31,8 @@ static uint8_t done;
 
 static uint16_t width;
 static uint16_t height;
+static uint16_t win_w;
+static uint16_t win_h;
 
 static uint32_t bg = 0x202020;
 static uint32_t fg = 0xa0a0a0;
@@ -42,6 +46,9 @@ static const char *cmd;
 static char str[200];
 static char prev_str[200];
 
+static int timer_fd = -1;
+static time_t timer_unit; /* smallest unit shown by timefmt, in seconds */
+
 static void clear(int16_t x, int16_t y, uint16_t w, uint16_t h)
 {
 	xcb_rectangle_t rect = { x, y, w, h, };
@@ -49,10 +56,31 @@ static void clear(int16_t x, int16_t y, uint16_t w, uint16_t h)
 	xcb_poly_fill_rectangle(dpy, win, gc, 1, &rect);
 }
 
+/* index of first glyph that differs from what is on screen */
+static uint16_t first_changed(void)
+{
+	uint16_t i, n;
+
+	for (i = 0; str[i] && str[i] == prev_str[i]; i++)
+		;
+
+	while (i && (str[i] & 0xc0) == 0x80)
+		i--; /* back to utf8 lead byte */
+
+	for (n = 0; i; i--) {
+		if ((str[i - 1] & 0xc0) != 0x80)
+			n++;
+	}
+
+	return n;
+}
+
 static void print_time(uint8_t force)
 {
 	time_t t;
 	struct tm *tmp;
+	uint16_t idx;
+	int16_t x;
 
 	t = time(NULL);
 
@@ -65,9 +93,61 @@ static void print_time(uint8_t force)
 	if (strncmp(prev_str, str, sizeof(str)) == 0 && !force)
 		return;
 
-	memcpy(prev_str, str, sizeof(prev_str));
 	set_text_str(text, str, strlen(str));
-	draw_text_xcb(&xcb, text);
+
+	/* glyphs before first change are already on screen */
+	idx = force ? 0 : first_changed();
+	x = get_text_glyph_x(text, idx);
+
+	if (x < win_w)
+		clear(x, 0, win_w - x, win_h);
+
+	memcpy(prev_str, str, sizeof(prev_str));
+	draw_text_xcb_from(&xcb, text, idx);
+}
+
+/* fire at each boundary of smallest unit in timefmt so process only wakes
+ * up when clock text can change */
+static int arm_timer(void)
+{
+	struct itimerspec its = {0};
+	struct timespec now;
+
+	if (timer_fd < 0) {
+		timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK |
+					  TFD_CLOEXEC);
+
+		if (timer_fd < 0) {
+			ee("timerfd_create() failed, %s\n", strerror(errno));
+			return -1;
+		}
+
+		timer_unit = strftime_has(timefmt, STRFTIME_SECONDS) ? 1 : 60;
+		ii("update every %lu second(s)\n", (unsigned long) timer_unit);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	its.it_value.tv_sec = (now.tv_sec / timer_unit + 1) * timer_unit;
+	its.it_interval.tv_sec = timer_unit;
+
+	/* wall clock jumps cancel timer so it can be re-aligned */
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME |
+			    TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+		ee("timerfd_settime() failed, %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void handle_timer(void)
+{
+	uint64_t ticks;
+
+	if (read(timer_fd, &ticks, sizeof(ticks)) < 0 && errno == ECANCELED)
+		arm_timer();
+
+	print_time(0);
 }
 
 static void wait(void)
@@ -91,6 +171,9 @@ static void wait(void)
 
 static void handle_configure_notify(xcb_configure_notify_event_t *e)
 {
+	win_w = e->width;
+	win_h = e->height;
+
 	if (e->height > height) {
 		set_text_pos(text, 0, (e->height - height) / 2);
 	}
@@ -186,7 +269,7 @@ static xcb_atom_t getatom(xcb_connection_t *dpy, const char *str, uint8_t len)
 int main(int argc, char *argv[])
 {
 	fontid_t font_id;
-	struct pollfd pfd;
+	struct pollfd pfd[2];
 	uint32_t mask;
 	xcb_screen_t *scr;
 	uint32_t val[2];
@@ -279,8 +362,7 @@ int main(int argc, char *argv[])
 	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
 	val[0] = bg;
 	val[1] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_VISIBILITY_CHANGE |
-		 XCB_EVENT_MASK_KEY_PRESS  | XCB_EVENT_MASK_BUTTON_PRESS |
-		 XCB_EVENT_MASK_POINTER_MOTION;
+		 XCB_EVENT_MASK_KEY_PRESS  | XCB_EVENT_MASK_BUTTON_PRESS;
 	val[1] |= XCB_EVENT_MASK_STRUCTURE_NOTIFY;
 	xcb_create_window(dpy, XCB_COPY_FROM_PARENT, win, scr->root,
 			  0, 0, width, height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
@@ -304,37 +386,48 @@ int main(int argc, char *argv[])
 				    atom, XCB_ATOM_CARDINAL, 32, 1, &pid);
 	}
 
+	win_w = width;
+	win_h = height;
 	xcb_map_window(dpy, win);
 	clear(0, 0, width, height);
 	xcb_flush(dpy);
 
-	pfd.fd = xcb_get_file_descriptor(dpy);
-	pfd.events = POLLIN;
-	pfd.revents = 0;
+	if (arm_timer() < 0)
+		return 1;
+
+	pfd[0].fd = xcb_get_file_descriptor(dpy);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = timer_fd;
+	pfd[1].events = POLLIN;
 
 	xcb.dpy = dpy;
 	xcb.win = win;
 	xcb.gc = gc;
 
 	while (!done) {
-		int rc = poll(&pfd, 1, 5000);
-		if (rc == 0) { /* timeout */
-			print_time(0);
-		} else if (rc < 0) {
+		int rc;
+
+		while (events()) {} /* read all events */
+		xcb_flush(dpy);
+
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+
+		if ((rc = poll(pfd, 2, -1)) < 0) {
 			if (errno == EINTR)
 				continue;
 			sleep(1);
 			continue;
 		}
 
-		if (pfd.revents & POLLHUP)
+		if (pfd[0].revents & (POLLHUP | POLLERR))
 			break;
-		else if (pfd.revents & POLLIN)
-			while (events()) {} /* read all events */
-
-		pfd.revents = 0;
+		else if (pfd[1].revents & POLLIN)
+			handle_timer();
 	}
 
+	close(timer_fd);
+
 	destroy_text(&text);
 	xcb_destroy_window(dpy, win);
 	xcb_disconnect(dpy);
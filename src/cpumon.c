@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 #include <xcb/xcb.h>
 
@@ -27,10 +28,6 @@
 
 #define eopt(opt) ee("malformed "opt" parameter\n");
 
-#ifndef LINESIZE
-#define LINESIZE 128
-#endif
-
 #ifndef STATFILE
 #define STATFILE "/proc/stat"
 #endif
@@ -42,29 +39,39 @@ struct cpustat {
 	float lastload;
 	float accload;
 	uint8_t count;
-	uint8_t filter;
 };
 
-struct data {
-	xcb_point_t *ref;
-	xcb_point_t *cur;
+struct graph {
+	xcb_window_t win;
+	uint16_t *hist; /* ring of bar tops, oldest at head */
+	uint16_t head;
+	struct cpustat stat;
+	uint8_t on:1; /* cpu is listed in stat file */
+	uint8_t fresh:1; /* sampled on this tick */
+	uint8_t expose:1;
+	uint8_t hidden:1;
 };
 
 struct ctx {
 	xcb_connection_t *dpy;
-	xcb_drawable_t win;
 	xcb_gcontext_t gc;
-	xcb_point_t *bars;
+	xcb_rectangle_t *rects; /* scratch for full repaint */
+	struct graph *graphs; /* indexed by cpu number in all mode */
+	uint16_t count;
+	uint16_t hidden;
+	uint32_t bench;
 	uint16_t w;
 	uint16_t h;
 	uint16_t ms;
 	uint32_t fg;
 	uint32_t bg;
 	const char *class;
-	FILE *file;
-	char *line;
-	struct cpustat stat;
+	int fd;
+	char *buf; /* sized once so each tick is one pread and no allocs */
+	size_t size;
 	int16_t cpu;
+	uint8_t all;
+	uint8_t filter;
 	uint8_t bw;
 };
 
@@ -75,16 +82,18 @@ static void usage(struct ctx *ctx, const char *name)
 		"  -h, --help                  print this message\n"
 		"  -s, --size          <WxH>   set window size\n"
 		"  -c, --cpu           <n>     CPU to monitor\n"
+		"  -a, --all                   monitor each CPU in own window\n"
 		"  -n, --name          <name>  set class name\n"
 		"  -i, --interval      <n>     refresh interval (ms)\n"
 		"  -f, --filter        <n>     filter size (max 255)\n"
 		"  -fg, --fgcolor      <n>     foreground color\n"
 		"  -bg, --bgcolor      <n>     background color\n"
 		"  -bw, --border-width <n>     border width (px)\n"
+		"  -b, --bench         <n>     run n ticks and print cpu time\n"
 		"Defaults:\n"
 		"  aggregated load from all CPUs\n"
 		"  class %s, size %dx%d, interval %d ms, filter %u, fg %d, bg %d\n",
-		name, ctx->class, ctx->w, ctx->h, ctx->ms, ctx->stat.filter, ctx->fg,
+		name, ctx->class, ctx->w, ctx->h, ctx->ms, ctx->filter, ctx->fg,
 		ctx->bg);
 }
 
@@ -144,12 +153,14 @@ static int opts(struct ctx *ctx, int argc, char *argv[])
 			if (!param("filter", argv[i + 1]))
 				return -1;
 
-			ctx->stat.filter = atoi(argv[i + 1]);
+			ctx->filter = atoi(argv[i + 1]);
 		} else if (opt("-c", "--cpu", argv[i])) {
 			if (!param("cpu", argv[i + 1]))
 				return -1;
 
 			ctx->cpu = atoi(argv[i + 1]);
+		} else if (opt("-a", "--all", argv[i])) {
+			ctx->all = 1;
 		} else if (opt("-n", "--name", argv[i])) {
 			if (!param("name", argv[i + 1]))
 				return -1;
@@ -170,139 +181,392 @@ static int opts(struct ctx *ctx, int argc, char *argv[])
 				return -1;
 
 			ctx->bw = atoi(argv[i + 1]);
+		} else if (opt("-b", "--bench", argv[i])) {
+			if (!param("bench", argv[i + 1]))
+				return -1;
+
+			ctx->bench = atoi(argv[i + 1]);
 		}
 	}
 
 	return 0;
 }
 
-static void wait(struct ctx *ctx)
+static struct graph *graph(struct ctx *ctx, xcb_window_t win)
 {
-	int state;
-	xcb_generic_event_t *e;
-
-	while (1) {
-		if (!(e = xcb_wait_for_event(ctx->dpy)))
-			continue;
+	struct graph *g;
 
-		state = ((xcb_visibility_notify_event_t *) e)->state;
-		free(e);
-
-		if (state == XCB_VISIBILITY_UNOBSCURED)
-			break;
-		else if (state == XCB_VISIBILITY_PARTIALLY_OBSCURED)
-			break;
+	for (g = ctx->graphs; g < ctx->graphs + ctx->count; g++) {
+		if (g->on && g->win == win)
+			return g;
 	}
+
+	return NULL;
 }
 
-static void events(struct ctx *ctx)
+static void event(struct ctx *ctx, xcb_generic_event_t *e)
 {
-	xcb_generic_event_t *e = xcb_poll_for_event(ctx->dpy);
-
-	if (!e)
-		return;
+	xcb_visibility_notify_event_t *vis;
+	struct graph *g;
 
 	switch (e->response_type & ~0x80) {
+	case XCB_EXPOSE:
+		if ((g = graph(ctx, ((xcb_expose_event_t *) e)->window)))
+			g->expose = 1;
+		break;
 	case XCB_VISIBILITY_NOTIFY:
-		switch (((xcb_visibility_notify_event_t *) e)->state) {
-		case XCB_VISIBILITY_FULLY_OBSCURED:
-			wait(ctx);
-			break;
-		case XCB_VISIBILITY_PARTIALLY_OBSCURED: /* fall through */
-		case XCB_VISIBILITY_UNOBSCURED:
+		vis = (xcb_visibility_notify_event_t *) e;
+
+		if (!(g = graph(ctx, vis->window)))
 			break;
+
+		if (vis->state == XCB_VISIBILITY_FULLY_OBSCURED) {
+			ctx->hidden += !g->hidden;
+			g->hidden = 1;
+		} else if (g->hidden) {
+			ctx->hidden--;
+			g->hidden = 0;
+			g->expose = 1;
 		}
 		break;
 	}
+}
+
+static void events(struct ctx *ctx)
+{
+	xcb_generic_event_t *e;
+
+	while ((e = xcb_poll_for_event(ctx->dpy))) {
+		event(ctx, e);
+		free(e);
+	}
 
-	free(e);
+	/* nothing to show, block until some window is visible again */
+	while (ctx->hidden == ctx->count) {
+		if (!(e = xcb_wait_for_event(ctx->dpy)))
+			return;
+
+		event(ctx, e);
+		free(e);
+	}
 }
 
-static inline void getstat(struct ctx *ctx)
+#define cpustr(str) (str[0] == 'c' && str[1] == 'p' && str[2] == 'u')
+
+static inline const char *getnum(const char *str, unsigned long long *n)
 {
-	int tmp;
-	unsigned long user, nice, system, idle, iowait, irq, softirq;
-	unsigned long used, total;
+	while (*str == ' ')
+		str++;
 
-	tmp = sscanf(ctx->line, "%*s %lu %lu %lu %lu %lu %lu %lu",
-		     &user, &nice, &system, &idle, &iowait, &irq, &softirq);
+	for (*n = 0; *str >= '0' && *str <= '9'; str++)
+		*n = *n * 10 + (*str - '0');
 
-	if (tmp < 7)
-		iowait = irq = softirq = 0;
+	return str;
+}
+
+static inline void getstat(struct cpustat *stat, const char *str)
+{
+	unsigned long long val[7]; /* user nice system idle iowait irq softirq */
+	unsigned long long used, total;
+	uint8_t i;
+	int tmp;
 
-	used = user + nice + system + irq + softirq;
-	total = used + idle + iowait;
-	tmp = total - ctx->stat.prev_total;
+	for (i = 0; i < ARRAY_SIZE(val); i++)
+		str = getnum(str, &val[i]); /* missing fields come out as 0 */
+
+	used = val[0] + val[1] + val[2] + val[5] + val[6];
+	total = used + val[3] + val[4];
+	tmp = total - stat->prev_total;
 
 	if (tmp != 0)
-		ctx->stat.load = (float) (used - ctx->stat.prev_used) / tmp;
+		stat->load = (float) (used - stat->prev_used) / tmp;
 	else
-		ctx->stat.load = 0.f;
+		stat->load = 0.f;
 
-	ctx->stat.prev_used = used;
-	ctx->stat.prev_total = total;
+	stat->prev_used = used;
+	stat->prev_total = total;
 }
 
-#define cpustr(str) (str[0] == 'c' && str[1] == 'p' && str[2] == 'u')
+/* one read of stat file per tick feeds all graphs */
+static int sample(struct ctx *ctx)
+{
+	const char *str = ctx->buf, *end, *nl;
+	struct graph *g;
+	ssize_t len;
+	int cpu;
+
+	if ((len = pread(ctx->fd, ctx->buf, ctx->size, 0)) <= 0) {
+		ee("pread("STATFILE") failed, %s\n", strerror(errno));
+		return -1;
+	}
+
+	ctx->buf[len] = '\0';
+	end = ctx->buf + len;
+
+	while ((nl = memchr(str, '\n', end - str)) && cpustr(str)) {
+		str += 3;
+
+		if (*str == ' ') {
+			cpu = -1;
+		} else {
+			for (cpu = 0; *str >= '0' && *str <= '9'; str++)
+				cpu = cpu * 10 + (*str - '0');
+		}
+
+		if (ctx->all)
+			g = cpu >= 0 && cpu < ctx->count ? &ctx->graphs[cpu] : NULL;
+		else
+			g = cpu == ctx->cpu ? ctx->graphs : NULL;
+
+		if (g && g->on) {
+			getstat(&g->stat, str);
+			g->fresh = 1;
+
+			if (!ctx->all)
+				break;
+		}
+
+		str = nl + 1;
+	}
+
+	return 0;
+}
+
+/* window contents are lost on expose so repaint all history in one batch */
+static void redraw(struct ctx *ctx, struct graph *g)
+{
+	uint16_t i, n, y;
+	xcb_rectangle_t *rect = ctx->rects;
+
+	for (i = 0, n = 0; i < ctx->w; i++) {
+		y = g->hist[(g->head + i) % ctx->w];
+
+		if (y >= ctx->h)
+			continue; /* idle column */
+
+		rect->x = i;
+		rect->y = y;
+		rect->width = 1;
+		rect->height = ctx->h - y;
+		rect++;
+		n++;
+	}
+
+	xcb_clear_area(ctx->dpy, False, g->win, 0, 0, 0, 0);
+
+	if (n)
+		xcb_poly_fill_rectangle(ctx->dpy, g->win, ctx->gc, n, ctx->rects);
+}
+
+/* shift graph one column left on server side and draw newest column only */
+static void scroll(struct ctx *ctx, struct graph *g, uint16_t y)
+{
+	xcb_rectangle_t rect;
+
+	if (ctx->w > 1)
+		xcb_copy_area(ctx->dpy, g->win, g->win, ctx->gc, 1, 0, 0, 0,
+			      ctx->w - 1, ctx->h);
+
+	xcb_clear_area(ctx->dpy, False, g->win, ctx->w - 1, 0, 1, ctx->h);
+
+	if (y >= ctx->h)
+		return;
+
+	rect.x = ctx->w - 1;
+	rect.y = y;
+	rect.width = 1;
+	rect.height = ctx->h - y;
+	xcb_poly_fill_rectangle(ctx->dpy, g->win, ctx->gc, 1, &rect);
+}
 
 static inline void plot(struct ctx *ctx)
 {
-	uint16_t i;
+	struct cpustat *stat;
+	struct graph *g;
 	float load;
-	xcb_point_t *bar = ctx->bars + 1; /* skip bottom left */
+	int16_t y;
 
-	fseek(ctx->file, 0, SEEK_SET);
+	if (sample(ctx) < 0)
+		return;
 
-	while (fgets(ctx->line, LINESIZE, ctx->file)) {
-		if (!cpustr(ctx->line))
-			continue;
-		if (ctx->cpu < 0 && ctx->line[3] != ' ')
+	for (g = ctx->graphs; g < ctx->graphs + ctx->count; g++) {
+		if (!g->fresh)
 			continue;
-		if (ctx->cpu >= 0 && (atoi(&ctx->line[3]) != ctx->cpu))
+
+		g->fresh = 0;
+		stat = &g->stat;
+
+		if (stat->count++ < ctx->filter) {
+			load = stat->lastload;
+			stat->accload += stat->load;
+		} else {
+			load = (stat->accload / ctx->filter) * ctx->h;
+			stat->count = 0;
+			stat->accload = 0.f;
+			stat->lastload = load;
+		}
+
+		y = ctx->h - (int) floorf(load);
+		y = y < 0 ? 0 : y;
+
+		dd("STAT %f ACC %f LOAD %f BAR %d", stat->load, stat->accload,
+		   load, y);
+
+		g->hist[g->head] = y;
+		g->head = (g->head + 1) % ctx->w;
+
+		if (g->hidden) {
 			continue;
+		} else if (g->expose) {
+			redraw(ctx, g);
+			g->expose = 0;
+		} else {
+			scroll(ctx, g, y);
+		}
+	}
 
-		getstat(ctx);
+	xcb_flush(ctx->dpy);
+}
 
-		/* top left */
-		bar->y = (bar + 1)->y;
+static void bench(struct ctx *ctx, struct timespec *start)
+{
+	struct timespec end;
+	double us;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+	us = (end.tv_sec - start->tv_sec) * 1000000.;
+	us += (end.tv_nsec - start->tv_nsec) / 1000.;
+	ii("%u ticks, %u graphs, size %ux%u, interval %u ms: %.2f us cpu per "
+	   "tick\n", ctx->bench, ctx->count - ctx->hidden, ctx->w, ctx->h,
+	   ctx->ms, us / ctx->bench);
+}
 
-		/* load history */
-		for (i = 1; i < ctx->w - 1; i++) {
-			bar++;
-			bar->y = (bar + 1)->y;
+/* read whole file once to size sample buffer after cpu lines */
+static int init_buf(struct ctx *ctx)
+{
+	const char *str, *end, *nl;
+	size_t size = 4096;
+	ssize_t len;
+	char *buf;
+
+	while (1) {
+		if (!(buf = realloc(ctx->buf, size + 1))) {
+			ee("realloc(%zu) failed\n", size + 1);
+			return -1;
 		}
 
-		/* current load */
-		bar++;
-		bar->x = ctx->w;
+		ctx->buf = buf;
 
-		if (ctx->stat.count++ < ctx->stat.filter) {
-			load = ctx->stat.lastload;
-			ctx->stat.accload += ctx->stat.load;
-		} else {
-			load = (ctx->stat.accload / ctx->stat.filter) * ctx->h;
-			ctx->stat.count = 0;
-			ctx->stat.accload = 0.f;
-			ctx->stat.lastload = load;
+		if ((len = pread(ctx->fd, buf, size, 0)) < 0) {
+			ee("pread("STATFILE") failed, %s\n", strerror(errno));
+			return -1;
+		} else if (len < size) {
+			break;
+		}
+
+		size *= 2;
+	}
+
+	str = buf;
+	end = buf + len;
+
+	while ((nl = memchr(str, '\n', end - str)) && cpustr(str))
+		str = nl + 1;
+
+	if (str == buf) {
+		ee("no CPUs found in "STATFILE"\n");
+		return -1;
+	}
+
+	/* leave room for counters to grow in digits */
+	size = (str - buf) * 2;
+
+	if (!(buf = realloc(ctx->buf, size + 1))) {
+		ee("realloc(%zu) failed\n", size + 1);
+		return -1;
+	}
+
+	ctx->buf = buf;
+	ctx->size = size;
+	return 0;
+}
+
+/* find out which cpus are there before windows are created */
+static int init_graphs(struct ctx *ctx)
+{
+	const char *str, *end, *nl;
+	struct graph *g;
+	ssize_t len;
+	size_t size;
+	int cpu, max = -1;
+	uint16_t i;
+
+	if ((len = pread(ctx->fd, ctx->buf, ctx->size, 0)) < 0) {
+		ee("pread("STATFILE") failed, %s\n", strerror(errno));
+		return -1;
+	}
+
+	ctx->buf[len] = '\0';
+	str = ctx->buf;
+	end = ctx->buf + len;
+
+	for (; (nl = memchr(str, '\n', end - str)) && cpustr(str); str = nl + 1) {
+		if (str[3] != ' ' && (cpu = atoi(&str[3])) > max)
+			max = cpu;
+	}
+
+	ii("%d CPUs detected\n", max + 1);
+	ctx->count = ctx->all ? max + 1 : 1;
+
+	if (!ctx->count) {
+		ee("no per-CPU lines in "STATFILE"\n");
+		return -1;
+	}
+
+	size = ctx->count * sizeof(*ctx->graphs);
+
+	if (!(ctx->graphs = calloc(1, size))) {
+		ee("calloc(%zu) failed\n", size);
+		return -1;
+	}
+
+	if (!ctx->all) {
+		ctx->graphs->on = 1;
+	} else {
+		for (str = ctx->buf; (nl = memchr(str, '\n', end - str)) &&
+		     cpustr(str); str = nl + 1) {
+			if (str[3] != ' ')
+				ctx->graphs[atoi(&str[3])].on = 1;
 		}
+	}
 
-		bar->y = ctx->h - (int) floorf(load);
+	for (g = ctx->graphs; g < ctx->graphs + ctx->count; g++) {
+		if (!g->on)
+			continue;
+
+		size = ctx->w * sizeof(*g->hist);
 
-		dd("STAT %f ACC %f LOAD %f BAR %u,%u", ctx->stat.load,
-		   ctx->stat.accload, load, bar->x, bar->y);
+		if (!(g->hist = malloc(size))) {
+			ee("malloc(%zu) failed\n", size);
+			return -1;
+		}
 
-		xcb_fill_poly(ctx->dpy, ctx->win, ctx->gc,
-			      XCB_POLY_SHAPE_COMPLEX, XCB_COORD_MODE_ORIGIN,
-			      ctx->w + 3, ctx->bars);
-		xcb_flush(ctx->dpy);
+		for (i = 0; i < ctx->w; i++)
+			g->hist[i] = ctx->h; /* idle */
 	}
 
-	xcb_clear_area(ctx->dpy, False, ctx->win, 0, 0, 0, 0);
+	size = ctx->w * sizeof(*ctx->rects);
+
+	if (!(ctx->rects = malloc(size))) {
+		ee("malloc(%zu) failed\n", size);
+		return -1;
+	}
+
+	return 0;
 }
 
 static int init(struct ctx *ctx)
 {
-	int cpucnt;
 	char *env = getenv("FWM_SCALE");
 	float scale;
 
@@ -315,33 +579,14 @@ static int init(struct ctx *ctx)
 	ctx->fg = 0x8fb2d8;
 	ctx->class = "cpumon";
 	ctx->cpu = -1;
-	ctx->stat.filter = 60;
-
-	ctx->file = fopen(STATFILE, "r");
-
-	if (!ctx->file) {
-		ee("open("STATFILE") failed\n");
-		return -1;
-	}
-
-	ctx->line = calloc(1, LINESIZE + 1);
+	ctx->filter = 60;
 
-	if (!ctx->line) {
-		ee("calloc(%d) failed\n", LINESIZE + 1);
+	if ((ctx->fd = open(STATFILE, O_RDONLY | O_CLOEXEC)) < 0) {
+		ee("open("STATFILE") failed, %s\n", strerror(errno));
 		return -1;
 	}
 
-	cpucnt = 0;
-
-	while (fgets(ctx->line, LINESIZE, ctx->file)) {
-		if (cpustr(ctx->line))
-			cpucnt++;
-		else if (cpucnt > 0)
-			break; /* assume that CPU stats are grouped */
-	}
-
-	ii("%d CPUs detected\n", cpucnt - 1);
-	return 0;
+	return init_buf(ctx);
 }
 
 static xcb_atom_t getatom(xcb_connection_t *dpy, const char *str, uint8_t len)
@@ -363,16 +608,53 @@ static xcb_atom_t getatom(xcb_connection_t *dpy, const char *str, uint8_t len)
 	return a;
 }
 
+static void create_window(struct ctx *ctx, xcb_screen_t *scr, struct graph *g,
+			  xcb_atom_t atom)
+{
+	uint32_t val[2], mask;
+
+	g->win = xcb_generate_id(ctx->dpy);
+
+	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
+	val[0] = ctx->bg;
+	val[1] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_VISIBILITY_CHANGE;
+
+	xcb_create_window(ctx->dpy, XCB_COPY_FROM_PARENT, g->win, scr->root,
+			  0, 0, ctx->w, ctx->h, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+			  scr->root_visual, mask, val);
+
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE, g->win,
+			    XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+			    strlen(ctx->class), ctx->class);
+
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE, g->win,
+			    XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8,
+			    strlen(ctx->class), ctx->class);
+
+	if (atom != XCB_ATOM_NONE) {
+		pid_t pid = getpid();
+		xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE, g->win,
+				    atom, XCB_ATOM_CARDINAL, 32, 1, &pid);
+	}
+
+	if (ctx->bw) {
+		val[0] = ctx->bw;
+		mask = XCB_CONFIG_WINDOW_BORDER_WIDTH;
+		xcb_configure_window_checked(ctx->dpy, g->win, mask, val);
+	}
+
+	xcb_map_window(ctx->dpy, g->win);
+}
+
 int main(int argc, char *argv[])
 {
-	struct timespec ts;
+	struct timespec ts, start;
 	struct ctx ctx = {0};
 	uint32_t val[2], mask;
 	xcb_screen_t *scr;
 	int ret = 1;
-	uint16_t i;
-	xcb_point_t *bar;
-	size_t size;
+	uint32_t ticks = 0;
+	struct graph *g;
 	xcb_atom_t atom;
 
 	if (init(&ctx) < 0)
@@ -381,48 +663,15 @@ int main(int argc, char *argv[])
 	if (opts(&ctx, argc, argv) < 0)
 		goto out;
 
-	if (ctx.cpu < 0)
+	if (ctx.all)
+		ii("monitor each cpu\n");
+	else if (ctx.cpu < 0)
 		ii("monitor aggregated load\n");
 	else
 		ii("monitor cpu%d\n", ctx.cpu);
 
-	size = (ctx.w + 3) * sizeof(*ctx.bars) * 2;
-
-	if (!(ctx.bars = calloc(1, size))) {
-		ee("calloc(%zu) failed\n", size);
+	if (init_graphs(&ctx) < 0)
 		goto out;
-	}
-
-	/* pre-compute poly rectangle so later we only need to modify
-	 * y coordinate of its top side
-	 */
-
-	/* bottom left */
-	bar = ctx.bars;
-	bar->x = 0;
-	bar->y = ctx.h;
-
-	/* top left */
-	bar++;
-	bar->x = 0;
-	bar->y = 0;
-
-	/* top horizontal poly line */
-	for (i = 1; i < ctx.w; i++) {
-		bar++;
-		bar->x = i;
-		bar->y = 0;
-	}
-
-	/* bottom right */
-	bar++;
-	bar->x = ctx.w;
-	bar->y = ctx.h;
-
-	/* close poly */
-	bar++;
-	bar->x = 0;
-	bar->y = ctx.h;
 
 	ctx.dpy = xcb_connect(NULL, NULL);
 
@@ -440,55 +689,48 @@ int main(int argc, char *argv[])
 	val[1] = 0;
 
 	xcb_create_gc(ctx.dpy, ctx.gc, scr->root, mask, val);
-	ctx.win = xcb_generate_id(ctx.dpy);
-
-	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
-	val[0] = ctx.bg;
-	val[1] = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_VISIBILITY_CHANGE;
-
-	xcb_create_window(ctx.dpy, XCB_COPY_FROM_PARENT, ctx.win, scr->root,
-			  0, 0, ctx.w, ctx.h, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
-			  scr->root_visual, mask, val);
-
-        xcb_change_property(ctx.dpy, XCB_PROP_MODE_REPLACE, ctx.win,
-			    XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
-                            strlen(ctx.class), ctx.class);
-
-        xcb_change_property(ctx.dpy, XCB_PROP_MODE_REPLACE, ctx.win,
-			    XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8,
-                            strlen(ctx.class), ctx.class);
-
 	atom = getatom(ctx.dpy, "_NET_WM_PID", sizeof("_NET_WM_PID") - 1);
 
-	if (atom != XCB_ATOM_NONE) {
-		pid_t pid = getpid();
-		xcb_change_property(ctx.dpy, XCB_PROP_MODE_REPLACE, ctx.win,
-				    atom, XCB_ATOM_CARDINAL, 32, 1, &pid);
+	for (g = ctx.graphs; g < ctx.graphs + ctx.count; g++) {
+		if (g->on)
+			create_window(&ctx, scr, g, atom);
+		else
+			ctx.hidden++; /* offline cpu, never shown */
 	}
 
-	if (ctx.bw) {
-		val[0] = ctx.bw;
-		mask = XCB_CONFIG_WINDOW_BORDER_WIDTH;
-		xcb_configure_window_checked(ctx.dpy, ctx.win, mask, val);
-	}
-
-	xcb_map_window(ctx.dpy, ctx.win);
 	xcb_flush(ctx.dpy);
 	ts.tv_sec = 0;
 	ts.tv_nsec = ctx.ms * 1000 * 1000;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
 
 	while (1) {
 		events(&ctx);
 		plot(&ctx);
+
+		if (ctx.bench && ++ticks == ctx.bench) {
+			bench(&ctx, &start);
+			break;
+		}
+
 		nanosleep(&ts, NULL);
 	}
 
-	xcb_destroy_window(ctx.dpy, ctx.win);
+	for (g = ctx.graphs; g < ctx.graphs + ctx.count; g++) {
+		if (g->win)
+			xcb_destroy_window(ctx.dpy, g->win);
+	}
+
 	ret = 0;
 out:
-	fclose(ctx.file);
-	free(ctx.line);
-	free(ctx.bars);
+	if (ctx.fd >= 0)
+		close(ctx.fd);
+
+	for (g = ctx.graphs; g && g < ctx.graphs + ctx.count; g++)
+		free(g->hist);
+
+	free(ctx.graphs);
+	free(ctx.rects);
+	free(ctx.buf);
 
 	if (ctx.dpy)
 		xcb_disconnect(ctx.dpy);
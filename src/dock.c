@@ -7,13 +7,22 @@
 
 #include "misc.h"
 #include "text.h"
+#include "dock.h"
 
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <poll.h>
 
 #include <xcb/xcb.h>
@@ -22,70 +31,155 @@
 #define DEFAULT_FONT_SIZE 10.5
 #define DEFAULT_DPI 96
 #define TEXT_MAXLEN 16
+#define TEXT_BUFLEN DOCK_TEXT_LEN
+#define PROGRESS_H 2
+#define MAX_DOCKS 8
+#define MAX_PATH 255
+
+#define ICON_BAT_FULL "\xef\x89\x80" /* U+F240 */
+#define ICON_BAT_HIGH "\xef\x89\x81" /* U+F241 */
+#define ICON_BAT_NORMAL "\xef\x89\x82" /* U+F242 */
+#define ICON_BAT_LOW "\xef\x89\x84" /* U+F244 */
+#define ICON_AC "\xef\x87\xa6" /* U+F1E6 */
+#define ICON_LAN "\xef\x83\xa8" /* U+F0E8 */
+
+#define SUPPLY_PATH "/sys/class/power_supply"
+#define STAT_PATH "/proc/stat"
+#define ROUTE_PATH "/proc/net/route"
+#define NET_PATH "/sys/class/net"
 
 struct text_info {
 	fontid_t font_id;
 	struct text *txt;
-	char *str;
+	char *str; /* points to buf when set */
+	char buf[TEXT_BUFLEN];
 	uint8_t len;
 	uint8_t x;
 };
 
-struct ctx {
-	xcb_connection_t *dpy;
-	xcb_screen_t *scr;
-	pid_t pid;
+struct dock;
+
+/* built-in applet run by host mode instead of shell polling loop */
+struct applet {
+	const char *id;
+	const char *name; /* window class, same as shell dock */
+	const char *cmd;
+	const char *icon;
+	const char *text; /* widest expected text, sizes window */
+	int (*init)(struct dock *);
+	uint8_t (*update)(struct dock *); /* true if dock has to be redrawn */
+};
+
+struct dock {
 	const char *name;
 	const char *cmd;
+	const struct applet *applet;
 	xcb_drawable_t win;
 	xcb_gcontext_t gc;
 	uint16_t w;
 	uint16_t h;
 	uint32_t fg;
+	uint8_t text_y;
+	uint8_t text_h;
+	struct text_info text;
+	struct text_info icon;
+	int fd; /* timerfd or netlink socket applet waits on */
+	int src; /* file applet reads on update */
+	time_t period; /* timer period in seconds, 0 if fd is a socket */
+	long state[2];
+	int8_t progress; /* negative if not shown */
+	struct dock_ring *ring;
+	uint32_t ring_seq; /* last consumed slot */
+	char ring_path[MAX_PATH];
+};
+
+struct ctx {
+	xcb_connection_t *dpy;
+	xcb_screen_t *scr;
+	pid_t pid;
+	uint32_t fg;
 	uint32_t bg;
+	uint32_t dimfg;
 	uint8_t done;
 	float font_size;
 	uint16_t hdpi;
 	uint16_t vdpi;
 	const char *text_font;
 	const char *icon_font;
-	uint8_t text_y;
-	uint8_t text_h;
+	fontid_t text_font_id;
+	fontid_t icon_font_id;
+	const char *clock_fmt;
+	struct dock docks[MAX_DOCKS];
+	uint8_t docks_num;
 };
 
 static struct ctx ctx_;
-static struct text_info text_;
-static struct text_info icon_;
 
-static uint8_t update_text(struct text_info *text)
+static void set_str(struct text_info *text, const char *str)
+{
+	if (!str) {
+		text->str = NULL;
+		text->len = 0;
+		return;
+	}
+
+	text->len = snprintf(text->buf, sizeof(text->buf), "%s", str);
+
+	if (text->len >= sizeof(text->buf))
+		text->len = sizeof(text->buf) - 1;
+
+	text->str = text->buf;
+}
+
+static uint8_t update_text(struct dock *dock, struct text_info *text)
 {
 	if (!text->str)
 		return 0;
 
-	set_text_color(text->txt, ctx_.fg, ctx_.bg);
-	set_text_pos(text->txt, text->x, ctx_.text_y);
+	set_text_color(text->txt, dock->fg, ctx_.bg);
+	set_text_pos(text->txt, text->x, dock->text_y);
 	set_text_str(text->txt, text->str, text->len);
 	return 1;
 }
 
-static inline void clear(void)
+static inline void clear(struct dock *dock)
 {
-	xcb_rectangle_t rect = { 0, 0, ctx_.w, ctx_.h, };
-	xcb_change_gc(ctx_.dpy, ctx_.gc, XCB_GC_FOREGROUND, &ctx_.bg);
-	xcb_poly_fill_rectangle(ctx_.dpy, ctx_.win, ctx_.gc, 1, &rect);
+	xcb_rectangle_t rect = { 0, 0, dock->w, dock->h, };
+	xcb_change_gc(ctx_.dpy, dock->gc, XCB_GC_FOREGROUND, &ctx_.bg);
+	xcb_poly_fill_rectangle(ctx_.dpy, dock->win, dock->gc, 1, &rect);
 }
 
-static void show(void)
+static void show(struct dock *dock)
 {
-	struct xcb xcb = { ctx_.dpy, ctx_.win, ctx_.gc };
+	struct xcb xcb = { ctx_.dpy, dock->win, dock->gc };
+	xcb_rectangle_t rect;
+
+	clear(dock);
+
+	if (dock->progress >= 0) {
+		rect.x = 0;
+		rect.y = dock->h - PROGRESS_H;
+		rect.width = dock->w * dock->progress / 100;
+		rect.height = PROGRESS_H;
+		xcb_change_gc(ctx_.dpy, dock->gc, XCB_GC_FOREGROUND, &dock->fg);
+		xcb_poly_fill_rectangle(ctx_.dpy, dock->win, dock->gc, 1, &rect);
+	}
 
-	clear();
+	if (dock->icon.str && update_text(dock, &dock->icon))
+		draw_text_xcb(&xcb, dock->icon.txt);
 
-	if (icon_.str && update_text(&icon_))
-		draw_text_xcb(&xcb, icon_.txt);
+	if (dock->text.str && update_text(dock, &dock->text))
+		draw_text_xcb(&xcb, dock->text.txt);
+}
 
-	if (text_.str && update_text(&text_))
-		draw_text_xcb(&xcb, text_.txt);
+static struct dock *win2dock(xcb_window_t win)
+{
+	for (uint8_t i = 0; i < ctx_.docks_num; i++) {
+		if (ctx_.docks[i].win == win)
+			return &ctx_.docks[i];
+	}
+
+	return NULL;
 }
 
 static void *task(void *arg)
@@ -134,21 +228,77 @@ static xcb_atom_t getatom(const char *str, uint8_t len)
 	return a;
 }
 
-static int create_window(void)
+static void open_ring(struct dock *dock)
+{
+	const char *home = getenv("FWM_HOME");
+	int fd;
+
+	if (!home)
+		return; /* client messages only */
+
+	snprintf(dock->ring_path, sizeof(dock->ring_path), DOCK_RING_PATH, home,
+	 getpid(), dock->win);
+
+	fd = open(dock->ring_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if (fd < 0) {
+		ww("open(%s) failed, %s\n", dock->ring_path, strerror(errno));
+		dock->ring_path[0] = '\0';
+		return;
+	}
+
+	if (ftruncate(fd, sizeof(*dock->ring)) < 0) {
+		ww("ftruncate(%s) failed, %s\n", dock->ring_path, strerror(errno));
+	} else {
+		dock->ring = mmap(NULL, sizeof(*dock->ring), PROT_READ | PROT_WRITE,
+		 MAP_SHARED, fd, 0);
+
+		if (dock->ring == MAP_FAILED) {
+			ww("mmap(%s) failed, %s\n", dock->ring_path, strerror(errno));
+			dock->ring = NULL;
+		} else {
+			dock->ring->win = dock->win;
+			dock->ring->magic = DOCK_RING_MAGIC;
+		}
+	}
+
+	close(fd);
+
+	if (!dock->ring) {
+		unlink(dock->ring_path);
+		dock->ring_path[0] = '\0';
+	}
+}
+
+static void close_ring(struct dock *dock)
+{
+	if (dock->ring)
+		munmap(dock->ring, sizeof(*dock->ring));
+
+	if (dock->ring_path[0])
+		unlink(dock->ring_path);
+
+	dock->ring = NULL;
+	dock->ring_path[0] = '\0';
+	dock->ring_seq = 0;
+}
+
+static int create_window(struct dock *dock)
 {
 	uint32_t mask;
 	uint32_t val[2];
 	uint8_t name_len;
 	xcb_atom_t atom;
 
-	ctx_.win = xcb_generate_id(ctx_.dpy);
-	ctx_.gc = xcb_generate_id(ctx_.dpy);
+	dock->win = xcb_generate_id(ctx_.dpy);
+	dock->gc = xcb_generate_id(ctx_.dpy);
+	open_ring(dock); /* before fwm sees window */
 
 	mask = XCB_GC_FOREGROUND;
-	val[0] = ctx_.fg;
+	val[0] = dock->fg;
 	mask |= XCB_GC_GRAPHICS_EXPOSURES;
 	val[1] = 0;
-	xcb_create_gc(ctx_.dpy, ctx_.gc, ctx_.scr->root, mask, val);
+	xcb_create_gc(ctx_.dpy, dock->gc, ctx_.scr->root, mask, val);
 
 	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
 	val[0] = ctx_.bg;
@@ -158,55 +308,116 @@ static int create_window(void)
 	val[1] |= XCB_EVENT_MASK_BUTTON_PRESS;
 	val[1] |= XCB_EVENT_MASK_RESIZE_REDIRECT;
 
-	xcb_create_window(ctx_.dpy, XCB_COPY_FROM_PARENT, ctx_.win,
-	 ctx_.scr->root, 0, 0, ctx_.w, ctx_.h, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
-	 ctx_.scr->root_visual, mask, val);
+	xcb_create_window(ctx_.dpy, XCB_COPY_FROM_PARENT, dock->win,
+	 ctx_.scr->root, 0, 0, dock->w, dock->h, 0,
+	 XCB_WINDOW_CLASS_INPUT_OUTPUT, ctx_.scr->root_visual, mask, val);
 
-	name_len = strlen(ctx_.name);
+	name_len = strlen(dock->name);
 
-	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
-	 XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, name_len, ctx_.name);
+	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, dock->win,
+	 XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, name_len, dock->name);
 
-	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
-	 XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8, name_len, ctx_.name);
+	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, dock->win,
+	 XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8, name_len, dock->name);
 
 	atom = getatom("_NET_WM_PID", sizeof("_NET_WM_PID") - 1);
 
 	if (atom != XCB_ATOM_NONE) {
 		ctx_.pid = getpid();
-		xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
+		xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, dock->win,
 		 atom, XCB_ATOM_CARDINAL, 32, 1, &ctx_.pid);
-		dd("pid %u win 0x%x\n", ctx_.pid, ctx_.win);
+		dd("pid %u win 0x%x\n", ctx_.pid, dock->win);
 	}
 
-	xcb_map_window(ctx_.dpy, ctx_.win);
+	xcb_map_window(ctx_.dpy, dock->win);
 	xcb_flush(ctx_.dpy);
 
-	if (ctx_.text_h < ctx_.h)
-		ctx_.text_y = (ctx_.h - ctx_.text_h) / 2;
+	if (dock->text_h < dock->h)
+		dock->text_y = (dock->h - dock->text_h) / 2;
 
-	dd("win %#x wh (%u %u)\n", ctx_.win, ctx_.w, ctx_.h);
+	dd("win %#x wh (%u %u)\n", dock->win, dock->w, dock->h);
 	return 0;
 }
 
 static void resize(xcb_resize_request_event_t *e)
 {
-	dd("win %#x wh (%u %u) --> (%u %u)\n", e->window, ctx_.w, ctx_.h,
+	struct dock *dock = win2dock(e->window);
+
+	if (!dock)
+		return;
+
+	dd("win %#x wh (%u %u) --> (%u %u)\n", e->window, dock->w, dock->h,
 	 e->width, e->height);
 
-	if (e->height > ctx_.h) { /* have to re-create window to resize gc */
-		ctx_.h = e->height;
-		xcb_free_gc(ctx_.dpy, ctx_.gc);
-		xcb_destroy_window(ctx_.dpy, ctx_.win);
+	if (e->height > dock->h) { /* have to re-create window to resize gc */
+		dock->h = e->height;
+		close_ring(dock); /* new window gets new ring */
+		xcb_free_gc(ctx_.dpy, dock->gc);
+		xcb_destroy_window(ctx_.dpy, dock->win);
 		xcb_flush(ctx_.dpy);
 
-		if (create_window() < 0) {
+		if (create_window(dock) < 0) {
 			ee("failed to create new window %ux%u\n", e->width, e->height);
 			exit(1); /* consider it fatal */
 		}
 	}
 }
 
+static void apply_slot(struct dock *dock, struct dock_slot *slot)
+{
+	slot->icon[sizeof(slot->icon) - 1] = '\0';
+	slot->text[sizeof(slot->text) - 1] = '\0';
+
+	if ((slot->fields & DOCK_ICON) && dock->icon.str)
+		set_str(&dock->icon, slot->icon);
+
+	if (slot->fields & DOCK_FG)
+		dock->fg = slot->fg;
+
+	if ((slot->fields & DOCK_TEXT) && dock->text.str)
+		set_str(&dock->text, slot->text);
+
+	if (slot->fields & DOCK_PROGRESS)
+		dock->progress = slot->progress;
+}
+
+/* apply all updates published since last doorbell and redraw once */
+static void read_ring(struct dock *dock)
+{
+	struct dock_slot *cur;
+	struct dock_slot slot;
+	uint32_t head;
+	uint32_t seq;
+
+	if (!dock->ring)
+		return;
+
+	head = __atomic_load_n(&dock->ring->head, __ATOMIC_ACQUIRE);
+	seq = dock->ring_seq;
+
+	if (head - seq > DOCK_RING_SLOTS)
+		seq = head - DOCK_RING_SLOTS; /* older slots are overwritten */
+
+	while (seq != head) {
+		cur = &dock->ring->slots[++seq % DOCK_RING_SLOTS];
+
+		if (__atomic_load_n(&cur->seq, __ATOMIC_ACQUIRE) != seq)
+			continue;
+
+		memcpy(&slot, cur, sizeof(slot));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&cur->seq, __ATOMIC_RELAXED) != seq)
+			continue; /* overwritten while copying */
+
+		apply_slot(dock, &slot);
+	}
+
+	dd("win %#x seq %u --> %u\n", dock->win, dock->ring_seq, head);
+	dock->ring_seq = head;
+	show(dock);
+}
+
 static void handle_message(xcb_client_message_event_t *e)
 {
 	char *dat = (char *) e->data.data8;
@@ -214,6 +425,14 @@ static void handle_message(xcb_client_message_event_t *e)
 	char *ptr = dat;
 	char *msg[3] = {0};
 	uint8_t i = 0;
+	struct dock *dock = win2dock(e->window);
+
+	if (!dock) {
+		return;
+	} else if (e->format == 32 && e->data.data32[0] == DOCK_RING_MAGIC) {
+		read_ring(dock);
+		return;
+	}
 
 	dd("dat '%s' len %zu\n", (char *) e->data.data8, sizeof(e->data.data8));
 
@@ -228,32 +447,29 @@ static void handle_message(xcb_client_message_event_t *e)
 		ptr++;
 	}
 
-	if (msg[0] && icon_.str) {
-		free(icon_.str);
-		icon_.str = strdup(msg[0]);
-		icon_.len = strlen(icon_.str);
-		dd("ico '%s' len %u\n", icon_.str, icon_.len);
+	if (msg[0] && dock->icon.str) {
+		set_str(&dock->icon, msg[0]);
+		dd("ico '%s' len %u\n", dock->icon.str, dock->icon.len);
 	}
 
 	if (msg[1]) {
-		ctx_.fg = strtol(msg[1], NULL, 16);
+		dock->fg = strtol(msg[1], NULL, 16);
 		dd("rgb '%s' len %zu\n", msg[1], strlen(msg[1]));
 	}
 
-	if (msg[2] && text_.str) {
-		free(text_.str);
-		text_.str = strdup(msg[2]);
-		text_.len = strlen(text_.str);
-		dd("txt '%s' len %u\n", text_.str, text_.len);
+	if (msg[2] && dock->text.str) {
+		set_str(&dock->text, msg[2]);
+		dd("txt '%s' len %u\n", dock->text.str, dock->text.len);
 	}
 
-	show();
+	show(dock);
 }
 
 static int events(void)
 {
 	uint8_t type;
-	xcb_generic_event_t *e = xcb_wait_for_event(ctx_.dpy);
+	struct dock *dock;
+	xcb_generic_event_t *e = xcb_poll_for_event(ctx_.dpy);
 
 	if (!e)
 		return 0;
@@ -266,21 +482,25 @@ static int events(void)
 		case XCB_VISIBILITY_PARTIALLY_OBSCURED: /* fall through */
 		case XCB_VISIBILITY_UNOBSCURED:
 			dd("XCB_VISIBILITY_UNOBSCURED\n");
-			show();
+			dock = win2dock(((xcb_visibility_notify_event_t *) e)->window);
+			if (dock)
+				show(dock);
 			break;
 		}
 		break;
 	case XCB_EXPOSE:
 		dd("XCB_EXPOSE\n");
-		show();
+		if ((dock = win2dock(((xcb_expose_event_t *) e)->window)))
+			show(dock);
 		break;
 	case XCB_KEY_PRESS:
 		if (((xcb_key_press_event_t *)e)->detail == 9)
 			ctx_.done = 1;
 		break;
 	case XCB_BUTTON_PRESS:
-		if (ctx_.cmd)
-			spawn(ctx_.cmd);
+		dock = win2dock(((xcb_button_press_event_t *) e)->event);
+		if (dock && dock->cmd)
+			spawn(dock->cmd);
 		break;
 	case XCB_RESIZE_REQUEST:
 		dd("XCB_RESIZE_REQUEST\n");
@@ -314,7 +534,7 @@ static uint16_t get_space_width(fontid_t font_id)
 	return w;
 }
 
-static uint8_t init_text(struct text_info *text)
+static uint8_t init_text(struct dock *dock, struct text_info *text)
 {
 	uint16_t w;
 
@@ -323,13 +543,543 @@ static uint8_t init_text(struct text_info *text)
 
 	set_text_font(text->txt, text->font_id, ctx_.font_size);
 	set_text_pos(text->txt, text->x, 0);
-	set_text_color(text->txt, ctx_.fg, ctx_.bg);
+	set_text_color(text->txt, dock->fg, ctx_.bg);
 	set_text_str(text->txt, text->str, text->len);
-	get_text_size(text->txt, &w, &ctx_.h);
-	ctx_.w += w;
+	get_text_size(text->txt, &w, &dock->h);
+	dock->w += w;
 	return 1;
 }
 
+/* fonts are opened once and shared by all docks of the process */
+static int init_dock(struct dock *dock)
+{
+	if (dock->icon.str) {
+		if (invalid_font_id(ctx_.icon_font_id))
+			ctx_.icon_font_id = open_font(ctx_.icon_font, ctx_.hdpi,
+			 ctx_.vdpi);
+
+		if (invalid_font_id(ctx_.icon_font_id))
+			return -1;
+
+		dock->icon.font_id = ctx_.icon_font_id;
+
+		if (!init_text(dock, &dock->icon))
+			return -1;
+
+		dock->text.x = dock->w;
+	}
+
+	if (dock->text.str) {
+		if (invalid_font_id(ctx_.text_font_id))
+			ctx_.text_font_id = open_font(ctx_.text_font, ctx_.hdpi,
+			 ctx_.vdpi);
+
+		if (invalid_font_id(ctx_.text_font_id))
+			return -1;
+
+		dock->text.font_id = ctx_.text_font_id;
+
+		if (!init_text(dock, &dock->text)) {
+			return -1;
+		} else if (dock->icon.str) {
+			uint8_t space = get_space_width(dock->text.font_id);
+			dock->text.x += space;
+			dock->w += space;
+		}
+	}
+
+	dock->text_h = dock->h;
+	return 0;
+}
+
+static void free_dock(struct dock *dock)
+{
+	destroy_text(&dock->icon.txt);
+	destroy_text(&dock->text.txt);
+	close_ring(dock);
+
+	if (dock->win)
+		xcb_destroy_window(ctx_.dpy, dock->win);
+	if (dock->fd >= 0)
+		close(dock->fd);
+	if (dock->src >= 0)
+		close(dock->src);
+}
+
+static int arm_timer(struct dock *dock)
+{
+	struct itimerspec its = {0};
+	struct timespec now;
+
+	/* wake up on period boundaries of wall clock, jumps cancel timer so
+	 * it gets re-aligned */
+	clock_gettime(CLOCK_REALTIME, &now);
+	its.it_value.tv_sec = (now.tv_sec / dock->period + 1) * dock->period;
+	its.it_interval.tv_sec = dock->period;
+
+	if (timerfd_settime(dock->fd, TFD_TIMER_ABSTIME |
+	 TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+		ee("timerfd_settime() failed, %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int open_timer(struct dock *dock, time_t period)
+{
+	dock->fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (dock->fd < 0) {
+		ee("timerfd_create() failed, %s\n", strerror(errno));
+		return -1;
+	}
+
+	dock->period = period;
+	return arm_timer(dock);
+}
+
+static int open_netlink(struct dock *dock, int proto, uint32_t groups)
+{
+	struct sockaddr_nl sa = {0};
+
+	dock->fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+	 proto);
+
+	if (dock->fd < 0) {
+		ee("socket(%d) failed, %s\n", proto, strerror(errno));
+		return -1;
+	}
+
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+
+	if (bind(dock->fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		ee("bind(%d) failed, %s\n", proto, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int open_src(struct dock *dock, const char *path)
+{
+	if ((dock->src = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		ee("open(%s) failed, %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int read_src(struct dock *dock, char *buf, size_t size)
+{
+	ssize_t len = pread(dock->src, buf, size - 1, 0);
+
+	if (len <= 0)
+		return -1;
+
+	buf[len] = '\0';
+	return len;
+}
+
+/* consume whatever woke the applet up */
+static void drain(struct dock *dock)
+{
+	char buf[4096];
+	uint64_t ticks;
+
+	if (!dock->period) {
+		while (recv(dock->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+			;
+	} else if (read(dock->fd, &ticks, sizeof(ticks)) < 0 &&
+	 errno == ECANCELED) {
+		arm_timer(dock);
+	}
+}
+
+/* supplies are named AC, ACAD, ADP1, BAT0, BAT1, CMB0 and so on, so they
+ * are looked up by type
+ */
+
+static int open_supply(struct dock *dock, const char *type, const char *attr)
+{
+	char path[MAX_PATH];
+	char buf[16];
+	struct dirent *ent;
+	size_t len = strlen(type);
+	ssize_t n;
+	DIR *dir;
+	int fd;
+
+	if (!(dir = opendir(SUPPLY_PATH))) {
+		ee("opendir(%s) failed, %s\n", SUPPLY_PATH, strerror(errno));
+		return -1;
+	}
+
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), SUPPLY_PATH"/%s/type", ent->d_name);
+
+		if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+			continue;
+
+		n = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+
+		if (n <= 0 || strncmp(buf, type, len))
+			continue;
+
+		snprintf(path, sizeof(path), SUPPLY_PATH"/%s/%s", ent->d_name,
+		 attr);
+		closedir(dir);
+		return open_src(dock, path);
+	}
+
+	closedir(dir);
+	errno = 0;
+	ee("no %s power supply found\n", type);
+	return -1;
+}
+
+static int init_bat(struct dock *dock)
+{
+	dock->state[0] = -1; /* capacity */
+
+	if (open_supply(dock, "Battery", "capacity") < 0)
+		return -1;
+
+	return open_timer(dock, 60);
+}
+
+static uint8_t update_bat(struct dock *dock)
+{
+	char buf[16];
+	char cmd[MAX_PATH];
+	long capacity;
+	const char *home;
+
+	if (read_src(dock, buf, sizeof(buf)) < 0)
+		return 0;
+
+	if ((capacity = atol(buf)) == dock->state[0])
+		return 0;
+
+	dock->state[0] = capacity;
+
+	if (capacity >= 100) {
+		capacity = 100;
+		set_str(&dock->icon, ICON_BAT_FULL);
+	} else if (capacity >= 75) {
+		set_str(&dock->icon, ICON_BAT_HIGH);
+	} else if (capacity >= 25) {
+		set_str(&dock->icon, ICON_BAT_NORMAL);
+	} else {
+		set_str(&dock->icon, ICON_BAT_LOW);
+
+		if ((home = getenv("FWM_HOME"))) {
+			snprintf(cmd, sizeof(cmd), "%s/bin/bat-alert", home);
+			spawn(cmd);
+		}
+	}
+
+	snprintf(buf, sizeof(buf), "%ld%%", capacity);
+	set_str(&dock->text, buf);
+	return 1;
+}
+
+static int init_ac(struct dock *dock)
+{
+	dock->state[0] = -1; /* online */
+
+	if (open_supply(dock, "Mains", "online") < 0)
+		return -1;
+
+	return open_netlink(dock, NETLINK_KOBJECT_UEVENT, 1);
+}
+
+static uint8_t update_ac(struct dock *dock)
+{
+	char buf[16];
+	long online;
+
+	if (read_src(dock, buf, sizeof(buf)) < 0)
+		return 0;
+
+	if ((online = atol(buf)) == dock->state[0])
+		return 0;
+
+	dock->state[0] = online;
+	dock->fg = online ? ctx_.fg : ctx_.dimfg;
+	return 1;
+}
+
+static int init_cpu(struct dock *dock)
+{
+	dock->state[0] = 0; /* used */
+	dock->state[1] = 0; /* total */
+
+	if (open_src(dock, STAT_PATH) < 0)
+		return -1;
+
+	return open_timer(dock, 2);
+}
+
+static uint8_t update_cpu(struct dock *dock)
+{
+	char buf[256], *ptr;
+	unsigned long long val[7] = {0}, used, total;
+	long load;
+	uint8_t i;
+
+	if (read_src(dock, buf, sizeof(buf)) < 0)
+		return 0;
+
+	/* aggregated line goes first: cpu user nice system idle iowait irq
+	 * softirq */
+	for (i = 0, ptr = buf + sizeof("cpu"); i < ARRAY_SIZE(val); i++)
+		val[i] = strtoull(ptr, &ptr, 10);
+
+	used = val[0] + val[1] + val[2] + val[5] + val[6];
+	total = used + val[3] + val[4];
+
+	if (total == (unsigned long long) dock->state[1])
+		return 0;
+
+	load = 100 * (used - dock->state[0]) / (total - dock->state[1]);
+	dock->state[0] = used;
+	dock->state[1] = total;
+
+	snprintf(buf, sizeof(buf), "cpu %ld%%", load);
+
+	if (dock->text.str && !strcmp(buf, dock->text.str))
+		return 0;
+
+	set_str(&dock->text, buf);
+	return 1;
+}
+
+static uint8_t update_clock(struct dock *dock)
+{
+	char buf[TEXT_BUFLEN];
+	struct tm *tm;
+	time_t t = time(NULL);
+
+	if (!(tm = localtime(&t)) || !strftime(buf, sizeof(buf),
+	 ctx_.clock_fmt, tm))
+		return 0;
+
+	if (dock->text.str && !strcmp(buf, dock->text.str))
+		return 0;
+
+	set_str(&dock->text, buf);
+	return 1;
+}
+
+static int init_clock(struct dock *dock)
+{
+	update_clock(dock); /* current time sizes window */
+
+	if (strftime_has(ctx_.clock_fmt, STRFTIME_SECONDS))
+		return open_timer(dock, 1);
+
+	return open_timer(dock, 60);
+}
+
+static int init_lan(struct dock *dock)
+{
+	dock->state[0] = -1; /* wired default route is there */
+
+	if (open_src(dock, ROUTE_PATH) < 0)
+		return -1;
+
+	return open_netlink(dock, NETLINK_ROUTE, RTMGRP_LINK |
+	 RTMGRP_IPV4_ROUTE);
+}
+
+static uint8_t wired(const char *iface, uint8_t len)
+{
+	char path[sizeof(NET_PATH) + IFNAMSIZ + sizeof("/wireless")];
+	char buf[8];
+	int fd;
+	ssize_t n;
+
+	snprintf(path, sizeof(path), NET_PATH"/%.*s/wireless", len, iface);
+
+	if (access(path, F_OK) == 0)
+		return 0;
+
+	snprintf(path, sizeof(path), NET_PATH"/%.*s/type", len, iface);
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (n <= 0)
+		return 0;
+
+	buf[n] = '\0';
+	return atoi(buf) == 1; /* ARPHRD_ETHER */
+}
+
+static uint8_t update_lan(struct dock *dock)
+{
+	char buf[4096], *ptr, *end;
+	long online = 0;
+	int len;
+
+	if ((len = read_src(dock, buf, sizeof(buf))) < 0)
+		return 0;
+
+	end = buf + len;
+	ptr = memchr(buf, '\n', len); /* skip header */
+
+	/* Iface Destination Gateway ..., default route has zero destination */
+	while (ptr && ++ptr < end) {
+		char *tab = memchr(ptr, '\t', end - ptr);
+
+		if (tab && tab - ptr < IFNAMSIZ && end - tab > 9 &&
+		    !memcmp(tab + 1, "00000000\t", 9) &&
+		    wired(ptr, tab - ptr)) {
+			online = 1;
+			break;
+		}
+
+		ptr = memchr(ptr, '\n', end - ptr);
+	}
+
+	if (online == dock->state[0])
+		return 0;
+
+	dock->state[0] = online;
+	dock->fg = online ? ctx_.fg : ctx_.dimfg;
+	return 1;
+}
+
+static const struct applet applets_[] = {
+	{ "bat", "bat-dock", "bat-info", ICON_BAT_LOW, "100%",
+	  init_bat, update_bat },
+	{ "ac", "ac-dock", NULL, ICON_AC, NULL, init_ac, update_ac },
+	{ "cpu", "cpu-dock", NULL, NULL, "cpu 100%", init_cpu, update_cpu },
+	{ "clock", "clock-dock", "clock-menu", NULL, NULL, init_clock,
+	  update_clock },
+	{ "lan", "lan-dock", "lan-menu", ICON_LAN, NULL, init_lan,
+	  update_lan },
+};
+
+static int add_applet(const char *id, uint8_t len)
+{
+	const struct applet *applet;
+	struct dock *dock;
+
+	for (applet = applets_; applet < applets_ + ARRAY_SIZE(applets_);
+	 applet++) {
+		if (strlen(applet->id) == len && !strncmp(applet->id, id, len))
+			break;
+	}
+
+	if (applet == applets_ + ARRAY_SIZE(applets_)) {
+		ee("unknown applet '%.*s'\n", len, id);
+		return -1;
+	} else if (ctx_.docks_num == MAX_DOCKS) {
+		ee("only %u docks are supported\n", MAX_DOCKS);
+		return -1;
+	}
+
+	dock = &ctx_.docks[ctx_.docks_num++];
+	dock->applet = applet;
+	dock->name = applet->name;
+	dock->cmd = applet->cmd;
+	dock->fg = ctx_.fg;
+	set_str(&dock->icon, applet->icon);
+	set_str(&dock->text, applet->text);
+
+	if (applet->init(dock) < 0) { /* let other applets run */
+		ww("skip applet '%s'\n", applet->id);
+		free_dock(dock);
+		memset(dock, 0, sizeof(*dock));
+		dock->fd = -1;
+		dock->src = -1;
+		ctx_.docks_num--;
+	}
+
+	return 0;
+}
+
+static int add_applets(const char *list)
+{
+	const char *end;
+
+	for (; *list; list = *end ? end + 1 : end) {
+		if (!(end = strchr(list, ',')))
+			end = list + strlen(list);
+
+		if (end > list && add_applet(list, end - list) < 0)
+			return -1;
+	}
+
+	if (!ctx_.docks_num) {
+		errno = 0;
+		ee("no applet could be started\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void run(void)
+{
+	struct pollfd pfd[MAX_DOCKS + 1];
+	struct dock *polled[MAX_DOCKS + 1];
+	struct dock *dock;
+	uint8_t i, n;
+
+	pfd[0].fd = xcb_get_file_descriptor(ctx_.dpy);
+	pfd[0].events = POLLIN;
+
+	for (i = 0, n = 1; i < ctx_.docks_num; i++) {
+		if (ctx_.docks[i].fd < 0)
+			continue;
+
+		polled[n] = &ctx_.docks[i];
+		pfd[n].fd = ctx_.docks[i].fd;
+		pfd[n].events = POLLIN;
+		n++;
+	}
+
+	while (!ctx_.done) {
+		while (events()) {} /* read all events */
+
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ee("poll() failed, %s\n", strerror(errno));
+			break;
+		}
+
+		if (pfd[0].revents & (POLLHUP | POLLERR))
+			break;
+
+		for (i = 1; i < n; i++) {
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+
+			dock = polled[i];
+			drain(dock);
+
+			if (dock->applet->update(dock))
+				show(dock);
+		}
+
+		xcb_flush(ctx_.dpy);
+	}
+}
+
 static int opt(const char *arg, const char *args, const char *argl)
 {
 	return (strcmp(arg, args) == 0 || strcmp(arg, argl) == 0);
@@ -345,14 +1095,18 @@ static void help(const char *prog)
 	 "  -c, --cmd <str>           command to run on mouse click\n"
 	 "  -bg, --bgcolor <hex>      rgb color, default 0x%x\n"
 	 "  -fg, --fgcolor <hex>      rgb color, default 0x%x\n"
+	 "  -H, --host <list>         run comma separated built-in applets\n"
+	 "                            bat,ac,cpu,clock,lan in one process\n"
 	 "\nEnvironment:\n"
 	 "  FWM_ICONS=%s\n"
 	 "  FWM_FONT=%s\n"
 	 "  FWM_FONT_SIZE=%f\n"
 	 "  FWM_HDPI=%u\n"
-	 "  FWM_VDPI=%u\n\n",
-	 prog, ctx_.name, TEXT_MAXLEN, ctx_.bg, ctx_.fg, ctx_.icon_font,
-	 ctx_.text_font, ctx_.font_size, ctx_.hdpi, ctx_.vdpi);
+	 "  FWM_VDPI=%u\n"
+	 "  FWM_CLOCK_FMT=%s\n\n",
+	 prog, ctx_.docks[0].name, TEXT_MAXLEN, ctx_.bg, ctx_.fg,
+	 ctx_.icon_font, ctx_.text_font, ctx_.font_size, ctx_.hdpi, ctx_.vdpi,
+	 ctx_.clock_fmt);
 }
 
 int main(int argc, char *argv[])
@@ -361,12 +1115,24 @@ int main(int argc, char *argv[])
 	const char *vdpi_str;
 	const char *font_size_str;
 	const char *arg;
+	const char *host = NULL;
+	struct dock *dock = &ctx_.docks[0];
+	int ret = 1;
+	uint8_t i;
 
 	 /* init these defaults before checking args */
 
-	ctx_.name = "dock";
+	dock->name = "dock";
 	ctx_.fg = 0x808080;
 	ctx_.bg = 0x202020;
+	ctx_.text_font_id = INVALID_FONT_ID;
+	ctx_.icon_font_id = INVALID_FONT_ID;
+
+	for (i = 0; i < MAX_DOCKS; i++) {
+		ctx_.docks[i].fd = -1;
+		ctx_.docks[i].src = -1;
+		ctx_.docks[i].progress = -1;
+	}
 
 	if ((hdpi_str = getenv("FWM_HDPI")))
 		ctx_.hdpi = atoi(hdpi_str);
@@ -386,6 +1152,9 @@ int main(int argc, char *argv[])
 	ctx_.icon_font = getenv("FWM_ICONS");
 	ctx_.text_font = getenv("FWM_FONT");
 
+	if (!(ctx_.clock_fmt = getenv("FWM_CLOCK_FMT")))
+		ctx_.clock_fmt = "%Y-%m-%d/%W %a %H:%M";
+
 	if (argc < 2) {
 		help(argv[0]);
 		return 0;
@@ -394,73 +1163,69 @@ int main(int argc, char *argv[])
 	while (argc > 1) {
 		arg = argv[--argc];
 		if (opt(arg, "-i", "--icon")) {
-			icon_.str = strdup(argv[argc + 1]);
-			icon_.len = strlen(icon_.str);
+			set_str(&dock->icon, argv[argc + 1]);
 		} else if (opt(arg, "-t", "--text")) {
-			text_.str = strdup(argv[argc + 1]);
-			text_.len = strlen(text_.str);
+			set_str(&dock->text, argv[argc + 1]);
 		} else if (opt(arg, "-c", "--cmd")) {
-			ctx_.cmd = argv[argc + 1];
+			dock->cmd = argv[argc + 1];
 		} else if (opt(arg, "-bg", "--bgcolor")) {
 			ctx_.bg = strtol(argv[argc + 1], NULL, 16);
 		} else if (opt(arg, "-fg", "--fgcolor")) {
 			ctx_.fg = strtol(argv[argc + 1], NULL, 16);
 		} else if (opt(arg, "-n", "--name")) {
-			ctx_.name = argv[argc + 1];
+			dock->name = argv[argc + 1];
+		} else if (opt(arg, "-H", "--host")) {
+			host = argv[argc + 1];
 		}
 	}
 
-	if (!icon_.str && !text_.str) {
-		ww("missing text or icon\n");
-		text_.str = "error";
-		text_.len = strlen(text_.str);
-	}
+	ctx_.dimfg = ctx_.bg + 0x202020;
 
-	if (icon_.str) {
-		icon_.font_id = open_font(ctx_.icon_font, ctx_.hdpi, ctx_.vdpi);
-		if (invalid_font_id(icon_.font_id))
-			return 1;
-		else if (!init_text(&icon_))
-			return 1;
+	if (host) {
+		if (add_applets(host) < 0)
+			goto out;
+	} else {
+		dock->fg = ctx_.fg;
+		ctx_.docks_num = 1;
 
-		text_.x = ctx_.w;
+		if (!dock->icon.str && !dock->text.str) {
+			ww("missing text or icon\n");
+			set_str(&dock->text, "error");
+		}
 	}
 
-	if (text_.str) {
-		text_.font_id = open_font(ctx_.text_font, ctx_.hdpi, ctx_.vdpi);
-		if (invalid_font_id(text_.font_id))
-			return 1;
-		else if (!init_text(&text_))
-			return 1;
-		else if (icon_.str) {
-			uint8_t space = get_space_width(text_.font_id);
-			text_.x += space;
-			ctx_.w += space;
-		}
+	for (i = 0; i < ctx_.docks_num; i++) {
+		if (init_dock(&ctx_.docks[i]) < 0)
+			goto out;
 	}
-	ctx_.text_h = ctx_.h;
 
 	ctx_.dpy = xcb_connect(NULL, NULL);
 	if (!ctx_.dpy) {
 		ee("xcb_connect() failed\n");
-		return 1;
+		goto out;
 	}
 
 	ctx_.scr = xcb_setup_roots_iterator(xcb_get_setup(ctx_.dpy)).data;
 
-	if (create_window() < 0)
-		return 1;
+	for (i = 0; i < ctx_.docks_num; i++) {
+		dock = &ctx_.docks[i];
 
-	while (1)
-		events();
+		if (create_window(dock) < 0)
+			goto out;
+		else if (dock->applet)
+			dock->applet->update(dock);
+	}
 
-	free(icon_.str);
-	free(text_.str);
-	destroy_text(&icon_.txt);
-	destroy_text(&text_.txt);
-	xcb_destroy_window(ctx_.dpy, ctx_.win);
-	xcb_disconnect(ctx_.dpy);
-	close_font(icon_.font_id);
-	close_font(text_.font_id);
-	return 0;
+	run();
+	ret = 0;
+out:
+	for (i = 0; i < ctx_.docks_num; i++)
+		free_dock(&ctx_.docks[i]);
+
+	if (ctx_.dpy)
+		xcb_disconnect(ctx_.dpy);
+
+	close_font(ctx_.icon_font_id);
+	close_font(ctx_.text_font_id);
+	return ret;
 }
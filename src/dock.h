@@ -0,0 +1,52 @@
+/* dock.h: dock update ring shared between fwm and docks
+ *
+ * Copyright (c) 2017, Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * Released under the GNU General Public License, version 2
+ */
+
+#ifndef DOCK_H
+#define DOCK_H
+
+#include <stdint.h>
+
+/* Each dock window maps its own DOCK_RING_PATH once created and stores
+ * window id in the ring, so fwm can tell a stale file left by a dead dock
+ * from a live one; fwm is the only writer. Each update
+ * takes next slot, slot sequence number is zeroed while slot is being
+ * filled and set to new head once done. Then head is advanced and dock
+ * is woken up by client message with format 32, data32[0] DOCK_RING_MAGIC
+ * and data32[1] new head. Readers drop slots whose sequence number changed
+ * while being copied.
+ */
+
+#define DOCK_RING_PATH "%s/tmp/dock.%u.%x" /* FWM_HOME, dock pid, window */
+#define DOCK_RING_MAGIC 0x6b636f64U
+#define DOCK_RING_SLOTS 16U
+#define DOCK_ICON_LEN 16
+#define DOCK_TEXT_LEN 64
+
+enum dock_field {
+	DOCK_ICON = 1 << 0,
+	DOCK_FG = 1 << 1,
+	DOCK_TEXT = 1 << 2,
+	DOCK_PROGRESS = 1 << 3,
+};
+
+struct dock_slot {
+	uint32_t seq;
+	uint32_t fields; /* enum dock_field */
+	uint32_t fg;
+	int8_t progress; /* 0..100 */
+	char icon[DOCK_ICON_LEN];
+	char text[DOCK_TEXT_LEN];
+};
+
+struct dock_ring {
+	uint32_t magic;
+	uint32_t win; /* dock window ring belongs to */
+	uint32_t head; /* sequence number of last published slot */
+	struct dock_slot slots[DOCK_RING_SLOTS];
+};
+
+#endif /* DOCK_H */
@@ -5,12 +5,15 @@
  * Released under the GNU General Public License, version 2
  */
 
+#define _GNU_SOURCE /* memfd_create and file seals */
 #define USE_CRC32 /* use crc32 function from misc header */
 
 #include "misc.h"
 #include "fwm.h"
 #include "list.h"
 #include "text.h"
+#include "dock.h"
+#include "trace.h"
 
 #include <math.h>
 #include <stdlib.h>
@@ -24,11 +27,15 @@
 #include <time.h>
 #include <poll.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <sys/types.h>
 #include <dirent.h>
 
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/randr.h>
 #include <xcb/xproto.h>
 #include <xcb/xcb_keysyms.h>
@@ -89,6 +96,7 @@ typedef uint8_t bool;
 typedef uint8_t strlen_t;
 
 #define PANEL_SCREEN_GAP 0
+#define TITLE_FRAME_US 40000 /* at most 25 title repaints per second */
 #define ITEM_V_MARGIN 2
 #define ITEM_H_MARGIN 2
 #define TOOLBAR_ITEM_XPAD 2
@@ -171,6 +179,7 @@ enum panel_area { /* in order of appearance */
 struct panel_item {
 	int16_t x;
 	uint16_t w;
+	uint32_t hash; /* of what is drawn there now, 0 to force repaint */
 	void (*action)(void *);
 	void *arg;
 };
@@ -179,6 +188,16 @@ struct panel {
 	int16_t y;
 	xcb_gcontext_t gc;
 	xcb_drawable_t win;
+	xcb_pixmap_t buf; /* back buffer, see publish_panel() */
+	xcb_rectangle_t damage; /* what buf has and win has not yet */
+	uint8_t stale; /* buf content is undefined, clear whole panel */
+	xcb_window_t title_win; /* newest title to fetch, see flush_titles() */
+	xcb_window_t title_req_win; /* title being fetched */
+	xcb_get_property_cookie_t title_req[2];
+	xcb_get_property_reply_t *title_reply[2];
+	uint64_t title_ts;
+	uint8_t title_dirty;
+	uint8_t title_wait; /* bit per reply not yet received */
 	struct text *text;
 	struct text *tag_text;
 	uint8_t visibility_state;
@@ -329,6 +348,8 @@ struct screen *defscr;
 struct screen *dockscr;
 static xcb_screen_t *rootscr; /* root window details */
 static bool fresh_start;
+static bool park_; /* park windows of hidden tags instead of unmapping */
+static struct client *mru_cycle_; /* client picked by ongoing mod+tab cycle */
 static uint16_t root_w;
 static uint16_t root_h;
 static struct toolbar toolbar; /* window toolbar */
@@ -349,7 +370,8 @@ struct wininfo {
 
 struct tag {
 	struct list_head head;
-	struct list_head clients;
+	struct list_head clients; /* in stacking order, front one is last */
+	struct list_head mru; /* clients, most recently focused first */
 	struct client *prev; /* prev focused client */
 	uint8_t id;
 	int16_t x;
@@ -357,9 +379,13 @@ struct tag {
 	char *name; /* visible name */
 	strlen_t nlen; /* name length */
 	struct rect space;
-	uint8_t grid2v; /* toggle vertical/horizontal split of 2-cells grid */
+	uint8_t grid2v; /* toggle vertical/horizontal split of 2-cells grid and
+			 * master area
+			 */
+	uint8_t layout; /* enum layout_id */
 	struct client *anchor;
 	uint8_t flags;
+	uint32_t hash; /* of tag cell drawn in panel */
 };
 
 #define list2tag(item) list_entry(item, struct tag, head)
@@ -399,10 +425,15 @@ struct client {
 	uint32_t crc; /* based on class name */
 	uint8_t busy;
 	uint8_t pos; /* enum winpos */
-	uint64_t ts; /* raise timestamp */
+	struct list_head mru; /* entry in tag focus history */
+	uint8_t mapped; /* as seen in map and unmap notifications */
+	uint8_t parked; /* moved off-screen instead of being unmapped */
+	xcb_window_t above; /* stacking sibling seen in last notification */
+	struct dock_ring *ring; /* dock update ring, mapped on first update */
 };
 
 #define list2cli(item) list_entry(item, struct client, head)
+#define mru2cli(item) list_entry(item, struct client, mru)
 #define glob2client(item) list_entry(item, struct client, list)
 
 struct list_head clients; /* keep track of all clients */
@@ -453,7 +484,8 @@ static void prev_window(struct arg *);
 static void raise_client(struct arg *);
 static void place_window(struct arg *);
 static void grow_window(struct arg *);
-static void make_grid(struct arg *);
+static void tile_windows(struct arg *);
+static void next_layout(struct arg *);
 static void show_toolbar(struct arg *);
 static void flag_window(struct arg *);
 static void top_window(struct arg *);
@@ -511,7 +543,9 @@ static struct keymap kmap_def[] = {
 	{ MOD, XK_F10, 0, "mod_f10", "top window",
 	  top_window, },
 	{ MOD, XK_F3, 0, "mod_f3", "make grid",
-	  make_grid, },
+	  tile_windows, },
+	{ MOD, XK_F11, 0, "mod_f11", "next layout",
+	  next_layout, },
 	{ MOD, XK_F4, 0, "mod_f4", "show toolbar",
 	  show_toolbar, },
 	{ MOD, XK_F2, 0, "mod_f2", "flag window",
@@ -601,7 +635,7 @@ enum winstatus {
 
 static xcb_connection_t *dpy;
 static uint8_t disp;
-static bool shutdown;
+static bool shutdown_;
 
 static xcb_atom_t a_state;
 static xcb_atom_t a_client_list;
@@ -633,6 +667,101 @@ static uint8_t randrbase;
 
 static void scan_clients(bool rescan);
 
+/* event loop statistics, reported by 'stats' request */
+
+#define STATS_BUCKETS 24 /* bucket n counts times below 2^n us */
+#define STATS_CONTROL 128 /* control requests go after event types */
+
+struct event_stats {
+	uint32_t count;
+	uint32_t replies; /* blocking round-trips made while handling */
+	uint32_t hist[STATS_BUCKETS];
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+static struct event_stats stats_[STATS_CONTROL + 1];
+static uint64_t stats_since_;
+static uint32_t replies_;
+
+static unsigned int replied_seq_; /* replies up to this one are read */
+
+/* replies come in request order, so waiting for one brings in all requested
+ * before it and only the first of pipelined replies is a round-trip
+ */
+static inline void count_reply(unsigned int seq)
+{
+	if ((int) (seq - replied_seq_) > 0) {
+		replies_++;
+		replied_seq_ = seq;
+	}
+}
+
+/* count each call which waits for X server, redefined after xcb headers
+ * so that call sites stay untouched
+ */
+#define xcb_request_check(d, c)\
+	(count_reply((c).sequence), xcb_request_check(d, c))
+#define xcb_get_property_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_get_property_reply(d, c, e))
+#define xcb_get_window_attributes_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_get_window_attributes_reply(d, c, e))
+#define xcb_get_geometry_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_get_geometry_reply(d, c, e))
+#define xcb_query_pointer_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_query_pointer_reply(d, c, e))
+#define xcb_query_tree_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_query_tree_reply(d, c, e))
+#define xcb_intern_atom_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_intern_atom_reply(d, c, e))
+#define xcb_get_atom_name_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_get_atom_name_reply(d, c, e))
+#define xcb_get_selection_owner_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_get_selection_owner_reply(d, c, e))
+#define xcb_grab_keyboard_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_grab_keyboard_reply(d, c, e))
+#define xcb_randr_get_crtc_gamma_size_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_randr_get_crtc_gamma_size_reply(d, c, e))
+#define xcb_randr_get_crtc_gamma_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_randr_get_crtc_gamma_reply(d, c, e))
+#define xcb_randr_get_output_primary_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_randr_get_output_primary_reply(d, c, e))
+#define xcb_randr_get_crtc_info_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_randr_get_crtc_info_reply(d, c, e))
+#define xcb_randr_get_output_info_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_randr_get_output_info_reply(d, c, e))
+#define xcb_randr_get_screen_resources_current_reply(d, c, e)\
+	(count_reply((c).sequence), xcb_randr_get_screen_resources_current_reply(d, c, e))
+
+static uint64_t time_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void account_event(uint8_t slot, uint64_t start)
+{
+	struct event_stats *stats = &stats_[slot];
+	uint64_t ns = time_ns() - start;
+	uint32_t us = ns / 1000;
+	uint8_t bucket = us ? 32 - __builtin_clz(us) : 0;
+
+	if (bucket >= STATS_BUCKETS)
+		bucket = STATS_BUCKETS - 1;
+
+	stats->count++;
+	stats->replies += replies_;
+	stats->hist[bucket]++;
+	stats->total_ns += ns;
+
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+
+	replies_ = 0;
+}
+
 /* ... and the mess begins */
 
 static void get_sprop(struct sprop *ret, xcb_window_t win,
@@ -994,23 +1123,32 @@ static pid_t win2pid(xcb_window_t win)
 	return pid;
 }
 
-static struct client *pid2dock(pid_t pid)
+/* id is dock window or pid of dock process; host dock runs several
+ * windows, so pid picks first one of them */
+
+static struct client *id2dock(uint32_t id)
 {
 	struct list_head *cur_scr;
 	struct list_head *cur_cli;
+	struct client *ret = NULL;
 
 	list_walk(cur_scr, &screens) {
 		struct screen *scr = list2screen(cur_scr);
 
 		list_walk(cur_cli, &scr->dock) {
 			struct client *cli = list2cli(cur_cli);
-			if (cli->pid == pid)
+
+			if (cli->win == id)
 				return cli;
+			else if (cli->pid == id && !ret)
+				ret = cli;
 		}
 	}
 
-	ww("client with pid %u not found\n", pid);
-	return NULL;
+	if (!ret)
+		ww("dock with id %#x not found\n", id);
+
+	return ret;
 }
 
 static struct client *win2cli(xcb_window_t win)
@@ -1100,6 +1238,100 @@ static void clear_area(xcb_window_t win, xcb_gcontext_t gc, struct area *area)
 	xcb_poly_fill_rectangle_checked(dpy, win, gc, 1, &area->rect);
 }
 
+static struct {
+	uint32_t repainted;
+	uint32_t skipped;
+} panel_stats_;
+
+struct region_key {
+	int16_t x;
+	uint16_t w;
+	uint32_t fg;
+	uint32_t bg;
+};
+
+static uint32_t region_hash(const char *str, uint16_t len, int16_t x,
+			    uint16_t w, uint32_t fg, uint32_t bg)
+{
+	struct region_key key = { x, w, fg, bg, };
+	uint32_t hash = crc32((char *) &key, sizeof(key));
+
+	if (str && len)
+		hash ^= crc32((char *) str, len);
+
+	return hash ? hash : 1; /* 0 is reserved to force repaint */
+}
+
+/* skip repaint when region would be drawn with the same content */
+
+static uint8_t region_changed(uint32_t *hash, uint32_t val)
+{
+	if (*hash == val) {
+		panel_stats_.skipped++;
+		return 0;
+	}
+
+	*hash = val;
+	panel_stats_.repainted++;
+	return 1;
+}
+
+static inline xcb_drawable_t panel_target(struct panel *panel)
+{
+	return panel->buf != XCB_NONE ? panel->buf : panel->win;
+}
+
+static void damage_panel(struct panel *panel, xcb_rectangle_t *rect)
+{
+	xcb_rectangle_t *d = &panel->damage;
+	int16_t x1, y1, x2, y2;
+
+	if (panel->buf == XCB_NONE) {
+		return;
+	} else if (!d->width || !d->height) {
+		*d = *rect;
+		return;
+	}
+
+	x1 = d->x < rect->x ? d->x : rect->x;
+	y1 = d->y < rect->y ? d->y : rect->y;
+	x2 = d->x + d->width;
+	y2 = d->y + d->height;
+
+	if (rect->x + rect->width > x2)
+		x2 = rect->x + rect->width;
+
+	if (rect->y + rect->height > y2)
+		y2 = rect->y + rect->height;
+
+	d->x = x1;
+	d->y = y1;
+	d->width = x2 - x1;
+	d->height = y2 - y1;
+}
+
+/* panel text is always drawn over area cleared with this function,
+ * so cleared areas are the only damage back buffer needs to track */
+
+static void clear_panel(struct panel *panel, struct area *area)
+{
+	clear_area(panel_target(panel), panel->gc, area);
+	damage_panel(panel, &area->rect);
+}
+
+static uint8_t publish_panel(struct panel *panel)
+{
+	xcb_rectangle_t *d = &panel->damage;
+
+	if (panel->buf == XCB_NONE || !d->width || !d->height)
+		return 0;
+
+	xcb_copy_area(dpy, panel->buf, panel->win, panel->gc, d->x, d->y,
+		      d->x, d->y, d->width, d->height);
+	memset(d, 0, sizeof(*d));
+	return 1;
+}
+
 static void draw_panel_text(struct panel *panel, struct text *text)
 {
 	struct xcb xcb;
@@ -1108,12 +1340,136 @@ static void draw_panel_text(struct panel *panel, struct text *text)
 		return;
 
 	xcb.dpy = dpy;
-	xcb.win = panel->win;
+	xcb.win = panel_target(panel);
 	xcb.gc = panel->gc;
 
 	draw_text_xcb(&xcb, text);
 }
 
+/* label cache: small set of (text, state) pairs drawn over and over in
+ * panel, toolbar and toolbox is rasterized once and then only copied */
+
+#define LABEL_CACHE_SIZE 128 /* tags in every state on a few screens */
+
+struct label_key {
+	struct text *text; /* font */
+	const char *str;
+	uint8_t len;
+	int16_t tx, ty; /* text position within label */
+	uint16_t w, h;
+	uint32_t fg, bg;
+};
+
+struct label {
+	struct label_key key;
+	xcb_pixmap_t pix;
+};
+
+static struct label label_cache_[LABEL_CACHE_SIZE];
+static uint8_t label_next_;
+
+static void flush_labels(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < LABEL_CACHE_SIZE; i++) {
+		if (label_cache_[i].pix != XCB_NONE)
+			xcb_free_pixmap(dpy, label_cache_[i].pix);
+	}
+
+	memset(label_cache_, 0, sizeof(label_cache_));
+	label_next_ = 0;
+}
+
+static struct label *render_label(xcb_drawable_t d, xcb_gcontext_t gc,
+				  struct label_key *key)
+{
+	struct label *label = &label_cache_[label_next_];
+	struct area area = { { 0, 0, key->w, key->h, }, key->bg, };
+	struct xcb xcb;
+
+	label_next_ = (label_next_ + 1) % LABEL_CACHE_SIZE;
+
+	if (label->pix != XCB_NONE)
+		xcb_free_pixmap(dpy, label->pix);
+
+	label->key = *key;
+	label->pix = xcb_generate_id(dpy);
+	xcb_create_pixmap(dpy, rootscr->root_depth, label->pix, d,
+			  key->w, key->h);
+	clear_area(label->pix, gc, &area);
+
+	set_text_str(key->text, key->str, key->len);
+	set_text_color(key->text, key->fg, key->bg);
+	set_text_pos(key->text, key->tx, key->ty);
+
+	xcb.dpy = dpy;
+	xcb.win = label->pix;
+	xcb.gc = gc;
+	draw_text_xcb(&xcb, key->text);
+	return label;
+}
+
+/* area is label geometry in d and its background, tx and ty are text
+ * offsets inside of area */
+
+static struct label *get_label(xcb_drawable_t d, xcb_gcontext_t gc,
+			       struct text *text, const char *str, uint8_t len,
+			       struct area *area, uint32_t fg, int16_t tx,
+			       int16_t ty)
+{
+	struct label_key key;
+	uint8_t i;
+
+	if (!text || d == XCB_NONE || gc == XCB_NONE)
+		return NULL;
+
+	memset(&key, 0, sizeof(key)); /* padding takes part in memcmp */
+	key.text = text;
+	key.str = str;
+	key.len = len;
+	key.tx = tx;
+	key.ty = ty;
+	key.w = area->rect.width;
+	key.h = area->rect.height;
+	key.fg = fg;
+	key.bg = area->color;
+
+	for (i = 0; i < LABEL_CACHE_SIZE; i++) {
+		if (label_cache_[i].pix == XCB_NONE)
+			continue;
+		else if (memcmp(&label_cache_[i].key, &key, sizeof(key)) == 0)
+			return &label_cache_[i];
+	}
+
+	return render_label(d, gc, &key);
+}
+
+static void draw_label(xcb_drawable_t d, xcb_gcontext_t gc, struct text *text,
+		       const char *str, uint8_t len, struct area *area,
+		       uint32_t fg, int16_t tx, int16_t ty)
+{
+	struct label *label;
+
+	if (!(label = get_label(d, gc, text, str, len, area, fg, tx, ty)))
+		return;
+
+	xcb_copy_area(dpy, label->pix, d, gc, 0, 0, area->rect.x,
+		      area->rect.y, label->key.w, label->key.h);
+}
+
+static void draw_panel_label(struct panel *panel, struct text *text,
+			     const char *str, uint8_t len, struct area *area,
+			     uint32_t fg, int16_t tx, int16_t ty)
+{
+	if (panel->win == XCB_WINDOW_NONE)
+		return;
+
+	draw_label(panel_target(panel), panel->gc, text, str, len, area, fg,
+		   tx, ty);
+	damage_panel(panel, &area->rect);
+}
+
 static inline void free_window_title(struct sprop *title)
 {
 	free(title->ptr);
@@ -1121,69 +1477,239 @@ static inline void free_window_title(struct sprop *title)
 	title->len = 0;
 }
 
-static uint8_t get_window_title(xcb_window_t win, struct sprop *title)
+#define TITLE_WORDS ((UCHAR_MAX + 1) / 4) /* longest title strlen_t holds */
+
+/* _NET_WM_NAME goes first, WM_NAME is fallback */
+
+static void request_title(xcb_window_t win, xcb_get_property_cookie_t *c)
 {
-	get_sprop(title, win, a_net_wm_name, UINT8_MAX);
-	if (!title->ptr || !title->len) {
-		get_sprop(title, win, XCB_ATOM_WM_NAME, UCHAR_MAX);
-		if (!title->ptr || !title->len)
-			return 0;
+	c[0] = xcb_get_property(dpy, 0, win, a_net_wm_name,
+				XCB_GET_PROPERTY_TYPE_ANY, 0, TITLE_WORDS);
+	c[1] = xcb_get_property(dpy, 0, win, XCB_ATOM_WM_NAME,
+				XCB_GET_PROPERTY_TYPE_ANY, 0, TITLE_WORDS);
+}
+
+/* title takes ownership of reply if it has one */
+
+static uint8_t reply_title(struct sprop *title, xcb_get_property_reply_t *r)
+{
+	int len = r ? xcb_get_property_value_length(r) : 0;
+
+	if (len <= 0) {
+		free(r);
+		return 0;
 	}
 
+	title->ptr = r;
+	title->str = xcb_get_property_value(r);
+	title->len = len > UCHAR_MAX ? UCHAR_MAX : len;
 	return 1;
 }
 
-static void print_title(struct screen *scr, xcb_window_t win)
+static uint8_t get_window_title(xcb_window_t win, struct sprop *title)
 {
-	struct sprop title;
-	int16_t x;
+	xcb_get_property_cookie_t c[2];
+
+	title->ptr = NULL;
+	title->str = NULL;
+	title->len = 0;
+	request_title(win, c);
+
+	if (reply_title(title, xcb_get_property_reply(dpy, c[0], NULL))) {
+		xcb_discard_reply(dpy, c[1].sequence);
+		return 1;
+	}
+
+	return reply_title(title, xcb_get_property_reply(dpy, c[1], NULL));
+}
+
+static void fit_title(struct screen *scr, struct sprop *title)
+{
+	uint16_t max = scr->items[PANEL_AREA_TITLE].w;
+	uint16_t lo = 0;
+	uint16_t hi = title->len - 1;
+	uint16_t mid;
 	uint16_t w, h;
-	struct area area;
 
-	if (fresh_start)
+	set_text_str(scr->panel.text, title->str, title->len);
+	get_text_size(scr->panel.text, &w, &h);
+
+	if (w <= max) {
+		set_text_fade(scr->panel.text, 0);
 		return;
-	else if (scr->panel.win == XCB_WINDOW_NONE || scr->panel.gc == XCB_NONE)
-		return; /* nothing to do here */
+	}
+
+	while (lo < hi) { /* longest prefix that fits */
+		mid = (lo + hi + 1) / 2;
+		set_text_str(scr->panel.text, title->str, mid);
+		get_text_size(scr->panel.text, &w, &h);
+
+		if (w <= max)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	set_text_str(scr->panel.text, title->str, lo);
+	set_text_fade(scr->panel.text, lo ? (lo - 1) / 3 : 0);
+}
+
+static void draw_title(struct screen *scr, struct sprop *title)
+{
+	struct panel_item *item = &scr->items[PANEL_AREA_TITLE];
+	struct area area;
+	int16_t x;
 
 	area.color = get_color(NORMAL_BG);
-	area.rect.x = scr->items[PANEL_AREA_TITLE].x;
+
+	if (!region_changed(&item->hash, region_hash(title->str, title->len,
+	    item->x, item->w, get_color(TITLE_FG), area.color)))
+		return;
+
+	area.rect.x = item->x;
 	area.rect.y = 0;
 	area.rect.width = scr->items[PANEL_AREA_DOCK].x;
 	area.rect.height = panel_height;
-	clear_area(scr->panel.win, scr->panel.gc, &area);
+	clear_panel(&scr->panel, &area);
 
-	if (win == XCB_WINDOW_NONE)
+	if (!title->str || !title->len)
 		return;
 
-	get_sprop(&title, win, a_net_wm_name, UINT_MAX);
-	if (!title.ptr || !title.len) {
-		get_sprop(&title, win, XCB_ATOM_WM_NAME, UCHAR_MAX);
-		if (!title.ptr || !title.len)
-			goto out;
+	fit_title(scr, title);
+	x = item->x + panel_space;
+	set_text_pos(scr->panel.text, x, panel_text_y);
+	set_text_color(scr->panel.text, get_color(TITLE_FG), area.color);
+	draw_panel_text(&scr->panel, scr->panel.text);
+	set_text_str(scr->panel.text, NULL, 0);
+}
+
+static void drop_title_fetch(struct panel *panel)
+{
+	uint8_t i;
+
+	for (i = 0; i < 2; i++) {
+		if (panel->title_wait & (1 << i))
+			xcb_discard_reply(dpy, panel->title_req[i].sequence);
+
+		free(panel->title_reply[i]);
+		panel->title_reply[i] = NULL;
 	}
 
-	set_text_str(scr->panel.text, title.str, title.len);
-	get_text_size(scr->panel.text, &w, &h);
+	panel->title_wait = 0;
+}
 
-	if (w <= scr->items[PANEL_AREA_TITLE].w) {
-		set_text_fade(scr->panel.text, 0);
-	} else {
-		do {
-			set_text_str(scr->panel.text, title.str, title.len--);
-			get_text_size(scr->panel.text, &w, &h);
-		} while (w > scr->items[PANEL_AREA_TITLE].w);
+static void print_title(struct screen *scr, xcb_window_t win)
+{
+	struct sprop title = { NULL, 0, NULL, };
+
+	if (fresh_start)
+		return;
+	else if (scr->panel.win == XCB_WINDOW_NONE || scr->panel.gc == XCB_NONE)
+		return; /* nothing to do here */
+
+	scr->panel.title_dirty = 0; /* superseded */
+	drop_title_fetch(&scr->panel);
+
+	if (win != XCB_WINDOW_NONE)
+		get_window_title(win, &title);
+
+	draw_title(scr, &title);
+	free(title.ptr);
+}
+
+/* titles can change hundreds of times per second, so property notify
+ * only marks them dirty and this function repaints each screen title at
+ * most once per TITLE_FRAME_US; replies are collected on later loop runs
+ * without blocking; returns poll timeout for pending ones */
+
+static uint8_t collect_title(struct screen *scr)
+{
+	struct panel *panel = &scr->panel;
+	struct sprop title = { NULL, 0, NULL, };
+	struct client *cli;
+	uint8_t i;
+
+	for (i = 0; i < 2; i++) {
+		xcb_generic_error_t *err = NULL;
+		void *reply = NULL;
 
-		set_text_fade(scr->panel.text, title.len / 3);
+		if (!(panel->title_wait & (1 << i)))
+			continue;
+		else if (!xcb_poll_for_reply(dpy, panel->title_req[i].sequence,
+					     &reply, &err))
+			continue;
+
+		free(err);
+		panel->title_reply[i] = reply;
+		panel->title_wait &= ~(1 << i);
 	}
 
-	x = scr->items[PANEL_AREA_TITLE].x + panel_space;
-	set_text_pos(scr->panel.text, x, panel_text_y);
-	set_text_color(scr->panel.text, get_color(TITLE_FG), area.color);
-	draw_panel_text(&scr->panel, scr->panel.text);
+	if (panel->title_wait)
+		return 0;
+
+	for (i = 0; i < 2; i++) {
+		if (!title.len)
+			reply_title(&title, panel->title_reply[i]);
+		else
+			free(panel->title_reply[i]);
+
+		panel->title_reply[i] = NULL;
+	}
+
+	cli = win2cli(panel->title_req_win);
+
+	if (cli && cli->tag == scr->tag && !fresh_start)
+		draw_title(scr, &title);
 
-out:
-	set_text_str(scr->panel.text, NULL, 0);
 	free(title.ptr);
+	return 1;
+}
+
+static int flush_titles(void)
+{
+	struct list_head *cur;
+	uint64_t now = time_us();
+	int timeout = -1;
+	uint8_t fetch = 0;
+
+	list_walk(cur, &screens) {
+		struct screen *scr = list2screen(cur);
+		struct panel *panel = &scr->panel;
+		uint64_t elapsed = now - panel->title_ts;
+
+		if (panel->title_wait && !collect_title(scr)) {
+			/* reply may be read along with other one and then
+			 * socket stays quiet, so do not sleep for long */
+			int ms = TITLE_FRAME_US / 1000;
+
+			if (timeout < 0 || ms < timeout)
+				timeout = ms;
+			continue;
+		} else if (!panel->title_dirty) {
+			continue;
+		} else if (elapsed < TITLE_FRAME_US) {
+			int ms = (TITLE_FRAME_US - elapsed) / 1000 + 1;
+
+			if (timeout < 0 || ms < timeout)
+				timeout = ms;
+			continue;
+		}
+
+		request_title(panel->title_win, panel->title_req);
+		panel->title_req_win = panel->title_win;
+		panel->title_wait = 3;
+		panel->title_dirty = 0;
+		panel->title_ts = now;
+		fetch = 1;
+
+		if (timeout < 0 || TITLE_FRAME_US / 1000 < timeout)
+			timeout = TITLE_FRAME_US / 1000;
+	}
+
+	if (fetch)
+		xcb_flush(dpy);
+
+	return timeout;
 }
 
 static xcb_window_t window_leader(xcb_window_t win)
@@ -1204,18 +1730,235 @@ static xcb_window_t window_leader(xcb_window_t win)
 	return ret;
 }
 
+/* Window changes are collected between txn_begin() and txn_commit() and
+ * only final state of each window is sent on commit with single flush, so
+ * e.g. two moves make one configure request and unfocus followed by focus
+ * repaints border once. Changes made outside of transaction are sent right
+ * away and flushed by caller as usual.
+ */
+
+#define TXN_MAP (1 << 0)
+#define TXN_UNMAP (1 << 1)
+#define TXN_COLOR (1 << 2)
+#define TXN_STATE (1 << 3)
+
+#define TXN_CONFIG_VALS 7 /* x, y, w, h, border, sibling, stack mode */
+
+struct txn_win {
+	xcb_window_t win;
+	uint16_t mask; /* XCB_CONFIG_WINDOW */
+	uint8_t flags; /* TXN */
+	uint8_t state; /* WM_STATE */
+	uint32_t color;
+	uint32_t seq; /* of last stacking change */
+	uint32_t val[TXN_CONFIG_VALS]; /* indexed by mask bit */
+};
+
+static struct {
+	uint8_t depth;
+	uint8_t active_set;
+	uint8_t input_set;
+	uint8_t warp_set;
+	int16_t warp_x; /* relative to warp_win */
+	int16_t warp_y;
+	xcb_window_t warp_win;
+	uint16_t num;
+	uint16_t max;
+	uint32_t seq;
+	xcb_window_t active; /* _NET_ACTIVE_WINDOW */
+	xcb_window_t input;
+	struct txn_win *wins;
+} txn_;
+
+static struct txn_win *txn_win(xcb_window_t win)
+{
+	struct txn_win *tmp;
+	uint16_t i;
+
+	for (i = txn_.num; i > 0; i--) { /* recent ones are likely wanted */
+		if (txn_.wins[i - 1].win == win)
+			return &txn_.wins[i - 1];
+	}
+
+	if (txn_.num == txn_.max) {
+		uint16_t max = txn_.max ? txn_.max * 2 : 32;
+
+		if (!(tmp = realloc(txn_.wins, max * sizeof(*tmp)))) {
+			ee("realloc(%zu) failed\n", max * sizeof(*tmp));
+			return NULL;
+		}
+
+		txn_.wins = tmp;
+		txn_.max = max;
+	}
+
+	tmp = &txn_.wins[txn_.num++];
+	memset(tmp, 0, sizeof(*tmp));
+	tmp->win = win;
+	return tmp;
+}
+
+static int txn_cmp(const void *a, const void *b)
+{
+	uint32_t seq0 = ((const struct txn_win *) a)->seq;
+	uint32_t seq1 = ((const struct txn_win *) b)->seq;
+
+	return (seq0 > seq1) - (seq0 < seq1);
+}
+
+static void txn_send(void)
+{
+	struct txn_win *cur = txn_.wins;
+	struct txn_win *end = txn_.wins + txn_.num;
+	uint32_t val[TXN_CONFIG_VALS];
+	uint8_t i, n;
+
+	if (txn_.seq) /* windows are raised in the order they were asked */
+		qsort(txn_.wins, txn_.num, sizeof(*cur), txn_cmp);
+
+	for (; cur < end; cur++) {
+		if (cur->flags & TXN_COLOR)
+			xcb_change_window_attributes_checked(dpy, cur->win,
+							     XCB_CW_BORDER_PIXEL,
+							     &cur->color);
+
+		if (cur->mask) {
+			for (i = n = 0; i < TXN_CONFIG_VALS; i++) {
+				if (cur->mask & (1 << i))
+					val[n++] = cur->val[i];
+			}
+
+			xcb_configure_window_checked(dpy, cur->win, cur->mask,
+						     val);
+		}
+
+		if (cur->flags & TXN_STATE) {
+			uint32_t data[] = { cur->state, XCB_NONE };
+			xcb_change_property_checked(dpy, XCB_PROP_MODE_REPLACE,
+						    cur->win, a_state, a_state,
+						    32, 2, data);
+		}
+
+		if (cur->flags & TXN_MAP)
+			xcb_map_window_checked(dpy, cur->win);
+		else if (cur->flags & TXN_UNMAP)
+			xcb_unmap_window_checked(dpy, cur->win);
+	}
+
+	if (txn_.warp_set) /* after moves, so window is already in place */
+		xcb_warp_pointer_checked(dpy, XCB_NONE, txn_.warp_win, 0, 0, 0,
+					 0, txn_.warp_x, txn_.warp_y);
+
+	if (txn_.active_set)
+		xcb_change_property_checked(dpy, XCB_PROP_MODE_REPLACE,
+					    rootscr->root, a_active_win,
+					    XCB_ATOM_WINDOW, 32, 1,
+					    &txn_.active);
+
+	if (txn_.input_set)
+		xcb_set_input_focus_checked(dpy, XCB_NONE, txn_.input,
+					    XCB_CURRENT_TIME);
+
+	txn_.num = 0;
+	txn_.seq = 0;
+	txn_.active_set = 0;
+	txn_.input_set = 0;
+	txn_.warp_set = 0;
+}
+
+static inline void txn_begin(void)
+{
+	txn_.depth++;
+}
+
+static void txn_commit(void)
+{
+	if (txn_.depth && --txn_.depth) /* nested, outermost one sends */
+		return;
+
+	txn_send();
+	xcb_flush(dpy);
+}
+
+static inline void txn_done(void)
+{
+	if (!txn_.depth)
+		txn_send();
+}
+
+static void txn_configure(xcb_window_t win, uint16_t mask,
+			  const uint32_t *val)
+{
+	struct txn_win *cur;
+	uint8_t i;
+
+	if (!(cur = txn_win(win)))
+		return;
+
+	for (i = 0; i < TXN_CONFIG_VALS; i++) {
+		if (mask & (1 << i))
+			cur->val[i] = *val++;
+	}
+
+	if (mask & XCB_CONFIG_WINDOW_STACK_MODE)
+		cur->seq = ++txn_.seq;
+
+	cur->mask |= mask;
+	txn_done();
+}
+
+static void txn_map(xcb_window_t win, uint8_t map)
+{
+	struct txn_win *cur;
+
+	if (!(cur = txn_win(win)))
+		return;
+
+	cur->flags &= ~(TXN_MAP | TXN_UNMAP);
+	cur->flags |= map ? TXN_MAP : TXN_UNMAP;
+	txn_done();
+}
+
+static void txn_active(xcb_window_t win)
+{
+	txn_.active = win;
+	txn_.active_set = 1;
+	txn_done();
+}
+
+static void txn_input(xcb_window_t win)
+{
+	txn_.input = win;
+	txn_.input_set = 1;
+	txn_done();
+}
+
+static void txn_warp(xcb_window_t win, int16_t x, int16_t y)
+{
+	txn_.warp_win = win;
+	txn_.warp_x = x;
+	txn_.warp_y = y;
+	txn_.warp_set = 1;
+	txn_done();
+}
+
 static void border_color(xcb_window_t win, uint32_t color)
 {
-	uint32_t val[1] = { color, };
-	uint16_t mask = XCB_CW_BORDER_PIXEL;
-	xcb_change_window_attributes_checked(dpy, win, mask, val);
+	struct txn_win *cur;
+
+	if (!(cur = txn_win(win)))
+		return;
+
+	cur->color = color;
+	cur->flags |= TXN_COLOR;
+	txn_done();
 }
 
 static void border_width(xcb_window_t win, uint16_t width)
 {
 	uint32_t val[1] = { width, };
 	uint16_t mask = XCB_CONFIG_WINDOW_BORDER_WIDTH;
-	xcb_configure_window_checked(dpy, win, mask, val);
+	txn_configure(win, mask, val);
 }
 
 static void update_head(struct client *cli)
@@ -1224,6 +1967,44 @@ static void update_head(struct client *cli)
 	list_add(&cli->tag->clients, &cli->head);
 }
 
+static void update_mru(struct client *cli)
+{
+	list_del(&cli->mru);
+	list_top(&cli->tag->mru, &cli->mru);
+}
+
+/* put client on top of tag stacking and at the end of its focus history */
+
+static void attach_client(struct tag *tag, struct client *cli)
+{
+	list_add(&tag->clients, &cli->head);
+	list_add(&tag->mru, &cli->mru);
+}
+
+static void detach_client(struct client *cli)
+{
+	list_del(&cli->head);
+	list_del(&cli->mru);
+	list_init(&cli->mru); /* docks are never attached */
+}
+
+/* cycle is over once modifier is released, only then picked client goes to
+ * the head of focus history
+ */
+
+static void end_cycle(uint8_t commit)
+{
+	if (!mru_cycle_)
+		return;
+
+	if (commit)
+		update_mru(mru_cycle_);
+
+	mru_cycle_ = NULL;
+	xcb_ungrab_keyboard(dpy, XCB_CURRENT_TIME);
+	xcb_flush(dpy);
+}
+
 static void init_motion(xcb_window_t win)
 {
 	xcb_grab_pointer(dpy, 0, rootscr->root,
@@ -1236,7 +2017,7 @@ static void init_motion(xcb_window_t win)
 static void warp_pointer(xcb_window_t win, int16_t x, int16_t y)
 {
 	/* generates enter notify event */
-	xcb_warp_pointer_checked(dpy, XCB_NONE, win, 0, 0, 0, 0, x, y);
+	txn_warp(win, x, y);
 }
 
 static void center_pointer(struct client *cli)
@@ -1398,8 +2179,11 @@ static void release_client(struct client **cli)
 	if (*cli == toolbox.cli)
 		toolbox.cli = NULL;
 
+	if (*cli == mru_cycle_)
+		end_cycle(0);
+
 	store_client(*cli, 1);
-	list_del(&(*cli)->head);
+	detach_client(*cli);
 	list_del(&(*cli)->list);
 	free(*cli);
 	*cli = NULL;
@@ -1418,17 +2202,145 @@ static void free_client(struct client **ptr)
 		forget_client(tag, cli);
 	}
 
-	release_client(ptr);
+	release_client(ptr);
+}
+
+static struct dock_ring *map_dock_ring(struct client *cli)
+{
+	char path[MAX_PATH];
+	struct dock_ring *ring;
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), DOCK_RING_PATH, homedir, cli->pid,
+		 cli->win);
+
+	if ((fd = open(path, O_RDWR | O_CLOEXEC | O_NOFOLLOW)) < 0)
+		return NULL; /* old style dock */
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*ring) ||
+	    st.st_uid != getuid() || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	close(fd);
+
+	if (ring == MAP_FAILED) {
+		ee("mmap(%s) failed, %s\n", path, strerror(errno));
+		return NULL;
+	} else if (ring->magic != DOCK_RING_MAGIC || ring->win != cli->win) {
+		munmap(ring, sizeof(*ring)); /* left by dead dock */
+		return NULL;
+	}
+
+	dd("win %#x pid %u ring %s\n", cli->win, cli->pid, path);
+	return ring;
+}
+
+static struct dock_slot *begin_dock_update(struct client *cli)
+{
+	struct dock_slot *slot;
+	uint32_t seq;
+
+	if (!cli->ring && !(cli->ring = map_dock_ring(cli)))
+		return NULL;
+
+	seq = cli->ring->head + 1;
+	slot = &cli->ring->slots[seq % DOCK_RING_SLOTS];
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->fields = 0;
+	return slot;
+}
+
+static void end_dock_update(struct client *cli, struct dock_slot *slot)
+{
+	xcb_client_message_event_t e;
+	uint32_t seq = cli->ring->head + 1;
+
+	__atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&cli->ring->head, seq, __ATOMIC_RELEASE);
+
+	memset(&e, 0, sizeof(e));
+	e.response_type = XCB_CLIENT_MESSAGE;
+	e.window = cli->win;
+	e.type = a_protocols;
+	e.format = 32;
+	e.data.data32[0] = DOCK_RING_MAGIC;
+	e.data.data32[1] = seq;
+
+	xcb_send_event(dpy, 0, cli->win, XCB_EVENT_MASK_NO_EVENT,
+		       (const char *) &e);
+	xcb_flush(dpy);
+	tt("win %#x seq %u fields %#x\n", cli->win, seq, slot->fields);
+}
+
+/* msg: <icon> <color> [text], text may contain spaces */
+static uint8_t ring_dock(struct client *cli, char *msg)
+{
+	struct dock_slot *slot;
+	char *fg, *text = NULL;
+	size_t len;
+
+	if (!(slot = begin_dock_update(cli)))
+		return 0;
+
+	if ((fg = strchr(msg, ' '))) {
+		*fg++ = '\0';
+
+		if ((text = strchr(fg, ' ')))
+			*text++ = '\0';
+
+		slot->fg = strtol(fg, NULL, 16);
+		slot->fields |= DOCK_FG;
+	}
+
+	if ((len = strlen(msg)) < sizeof(slot->icon)) {
+		memcpy(slot->icon, msg, len + 1);
+		slot->fields |= DOCK_ICON;
+	}
+
+	if (text) {
+		len = strnlen(text, sizeof(slot->text) - 1);
+
+		if (len && text[len - 1] == '\n')
+			len--;
+
+		memcpy(slot->text, text, len);
+		slot->text[len] = '\0';
+		slot->fields |= DOCK_TEXT;
+	}
+
+	end_dock_update(cli, slot);
+	return 1;
+}
+
+static void progress_dock(uint32_t id, int8_t progress)
+{
+	struct client *cli = id2dock(id);
+	struct dock_slot *slot;
+
+	if (!cli || !(slot = begin_dock_update(cli)))
+		return;
+
+	slot->progress = progress < 0 ? 0 : progress > 100 ? 100 : progress;
+	slot->fields |= DOCK_PROGRESS;
+	end_dock_update(cli, slot);
 }
 
-static void update_dock(pid_t pid, char *msg)
+static void update_dock(uint32_t id, char *msg)
 {
 	size_t len;
 	xcb_client_message_event_t e;
-	struct client *cli = pid2dock(pid);
+	struct client *cli = id2dock(id);
 
 	if (!msg || !cli)
 		return;
+	else if (ring_dock(cli, msg))
+		return;
 
 	memset(&e, 0, sizeof(e));
 
@@ -1620,9 +2532,7 @@ static void unfocus_window(xcb_window_t win)
 	else
 		border_color(win, get_color(BORDER_FG));
 
-	xcb_window_t tmp = XCB_WINDOW_NONE;
-	xcb_change_property(dpy, XCB_PROP_MODE_REPLACE, rootscr->root,
-			    a_active_win, XCB_ATOM_WINDOW, 32, 1, &tmp);
+	txn_active(XCB_WINDOW_NONE);
 }
 
 static void focus_window(xcb_window_t win)
@@ -1637,10 +2547,8 @@ static void focus_window(xcb_window_t win)
 		border_color(win, get_color(FOCUS_FG));
 	}
 
-	xcb_change_property_checked(dpy, XCB_PROP_MODE_REPLACE,
-				    rootscr->root, a_active_win,
-				    XCB_ATOM_WINDOW, 32, 1, &win);
-	xcb_set_input_focus_checked(dpy, XCB_NONE, win, XCB_CURRENT_TIME);
+	txn_active(win);
+	txn_input(win);
 	print_title(curscr, win);
 }
 
@@ -1660,7 +2568,7 @@ static void raise_window(xcb_window_t win)
 	uint16_t mask = XCB_CONFIG_WINDOW_STACK_MODE;
 
 	if (!fresh_start)
-		xcb_configure_window_checked(dpy, win, mask, val);
+		txn_configure(win, mask, val);
 }
 
 static void top_window(struct arg *arg)
@@ -1678,51 +2586,105 @@ static void print_menu(struct screen *scr)
 {
 	uint16_t x = scr->items[PANEL_AREA_MENU].x + tag_text_margin;
 	uint16_t y = (panel_height - menu_h) / 2 - 1;
+	struct panel_item *item = &scr->items[PANEL_AREA_MENU];
+	struct area area;
+
+	if (!region_changed(&item->hash, region_hash(NULL, 0, x, item->w,
+	    get_color(NORMAL_FG), get_color(NORMAL_BG))))
+		return;
 
-	set_text_pos(menu_text, x, y);
-	draw_panel_text(&scr->panel, menu_text);
+	area.color = get_color(NORMAL_BG);
+	area.rect.x = item->x;
+	area.rect.y = 0;
+	area.rect.width = menu_w + tag_text_margin * 2;
+	area.rect.height = panel_height;
+	draw_panel_label(&scr->panel, menu_text, menu_icon, menu_icon_len,
+			 &area, get_color(NORMAL_FG), tag_text_margin, y);
 }
 
-static void print_tag(struct screen *scr, struct tag *tag, uint8_t flag)
+static void tag_area(struct tag *tag, uint8_t flag, struct area *area,
+		     uint32_t *fg)
 {
-	uint32_t fg;
-	struct area area;
-
 	if (flag == ITEM_FLG_ACTIVE) {
-		fg = get_color(ACTIVE_FG);
-		area.color = get_color(ACTIVE_BG);
-		tag->flags &= ~(ITEM_FLG_FOCUSED | ITEM_FLG_NORMAL);
+		*fg = get_color(ACTIVE_FG);
+		area->color = get_color(ACTIVE_BG);
 	} else if (flag == ITEM_FLG_FOCUSED) {
-		fg = get_color(NOTICE_FG);
-		area.color = get_color(NOTICE_BG);
-		tag->flags &= ~(ITEM_FLG_ACTIVE | ITEM_FLG_NORMAL);
+		*fg = get_color(NOTICE_FG);
+		area->color = get_color(NOTICE_BG);
 	} else {
-		fg = get_color(NORMAL_FG);
-		area.color = get_color(NORMAL_BG);
-		tag->flags &= ~(ITEM_FLG_FOCUSED | ITEM_FLG_ACTIVE);
+		*fg = get_color(NORMAL_FG);
+		area->color = get_color(NORMAL_BG);
 	}
 
+	area->rect.x = tag->x;
+	area->rect.y = tag_rect_y;
+	area->rect.width = tag->w;
+	area->rect.height = tag_rect_h;
+}
+
+static void print_tag(struct screen *scr, struct tag *tag, uint8_t flag)
+{
+	uint32_t fg;
+	struct area area;
+
+	tag_area(tag, flag, &area, &fg);
+	tag->flags &= ~(ITEM_FLG_ACTIVE | ITEM_FLG_FOCUSED | ITEM_FLG_NORMAL);
 	tag->flags |= flag;
 
-	area.rect.x = tag->x;
-	area.rect.y = tag_rect_y;
-	area.rect.width = tag->w;
-	area.rect.height = tag_rect_h;
-	clear_area(scr->panel.win, scr->panel.gc, &area);
+	if (!region_changed(&tag->hash, region_hash(tag->name, tag->nlen,
+	    tag->x, tag->w, fg, area.color)))
+		return;
+
+	draw_panel_label(&scr->panel, scr->panel.tag_text, tag->name,
+			 tag->nlen, &area, fg, tag_text_margin,
+			 panel_text_y - tag_rect_y);
+}
 
-	set_text_str(scr->panel.tag_text, tag->name, tag->nlen);
-	set_text_pos(scr->panel.tag_text, tag->x + tag_text_margin,
-	 panel_text_y);
-	set_text_color(scr->panel.tag_text, fg, area.color);
-	draw_panel_text(&scr->panel, scr->panel.tag_text);
+/* render every tag in each state, so hovering over tags never rasterizes */
+
+static void prerender_tags(struct screen *scr)
+{
+	static const uint8_t flags[] = {
+		ITEM_FLG_NORMAL, ITEM_FLG_FOCUSED, ITEM_FLG_ACTIVE,
+	};
+	struct list_head *cur;
+	struct area area;
+	uint32_t fg;
+	uint8_t i;
+
+	if (scr->panel.win == XCB_WINDOW_NONE)
+		return;
+
+	list_walk(cur, &scr->tags) {
+		struct tag *tag = list2tag(cur);
+
+		for (i = 0; i < ARRAY_SIZE(flags); i++) {
+			tag_area(tag, flags[i], &area, &fg);
+			get_label(panel_target(&scr->panel), scr->panel.gc,
+				  scr->panel.tag_text, tag->name, tag->nlen,
+				  &area, fg, tag_text_margin,
+				  panel_text_y - tag_rect_y);
+		}
+	}
 }
 
 static void print_div(struct screen *scr)
 {
 	uint16_t x = scr->items[PANEL_AREA_DIV].x + tag_text_margin;
+	struct panel_item *item = &scr->items[PANEL_AREA_DIV];
+	struct area area;
 
-	set_text_pos(div_text, x, tag_text_margin);
-	draw_panel_text(&scr->panel, div_text);
+	if (!region_changed(&item->hash, region_hash(NULL, 0, x, item->w,
+	    get_color(NORMAL_FG), get_color(NORMAL_BG))))
+		return;
+
+	area.color = get_color(NORMAL_BG);
+	area.rect.x = item->x;
+	area.rect.y = 0;
+	area.rect.width = div_w + tag_text_margin * 2;
+	area.rect.height = panel_height;
+	draw_panel_label(&scr->panel, div_text, div_icon, div_icon_len, &area,
+			 get_color(NORMAL_FG), tag_text_margin, tag_text_margin);
 }
 
 static void raise_panel(struct screen *scr)
@@ -1746,20 +2708,21 @@ static void raise_all_panels(void)
 	}
 }
 
+static inline void clear_panel_area(struct screen *scr);
+
+/* only regions whose content changed since last time are repainted */
+
 static void redraw_panel(struct screen *scr, struct client *cli, uint8_t raise)
 {
-	struct area area;
 	struct list_head *cur;
 
 	if (scr->panel.gc == XCB_NONE)
 		return;
 
-	area.color = get_color(NORMAL_BG);
-	area.rect.x = scr->x;
-	area.rect.y = 0;
-	area.rect.width = scr->w;
-	area.rect.height = panel_height;
-	clear_area(scr->panel.win, scr->panel.gc, &area);
+	if (scr->panel.stale) {
+		clear_panel_area(scr);
+		scr->panel.stale = 0;
+	}
 
 	print_menu(scr);
 
@@ -1769,9 +2732,10 @@ static void redraw_panel(struct screen *scr, struct client *cli, uint8_t raise)
 	}
 
 	print_div(scr);
+	print_title(scr, cli ? cli->win : XCB_WINDOW_NONE);
 
-	if (cli)
-		print_title(scr, cli->win);
+	dd("panel %u regions repainted %u skipped %u\n", scr->id,
+	   panel_stats_.repainted, panel_stats_.skipped);
 
 	if (raise)
 		raise_panel(scr);
@@ -1836,10 +2800,10 @@ static inline void recalc_client_pos(struct client *cli)
 
 	cli->output.y = cli->scr->y;
 
-	val[0] = cli->x;
+	val[0] = cli->parked ? root_w : cli->x; /* keep parked off-screen */
 	val[1] = cli->y;
 	mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
-	xcb_configure_window_checked(dpy, cli->win, mask, val);
+	txn_configure(cli->win, mask, val);
 }
 
 static void window_moveresize(xcb_window_t win, int16_t x, int16_t y,
@@ -1854,7 +2818,7 @@ static void window_moveresize(xcb_window_t win, int16_t x, int16_t y,
 	val[3] = h;
 	mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
 	mask |= XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
-	xcb_configure_window_checked(dpy, win, mask, val);
+	txn_configure(win, mask, val);
 }
 
 static void adjust_window_geom(xcb_window_t win, int16_t x, int16_t y,
@@ -1896,6 +2860,7 @@ static int toolbox_obscured(struct client *cli, int16_t x, int16_t y)
 {
 	struct list_head *cur;
 	uint16_t d = toolbox.size - 2 * BORDER_WIDTH;
+	uint8_t above = 0; /* clients after this one are stacked above it */
 
 	list_walk(cur, &curscr->tag->clients) {
 		struct client *it = list2cli(cur);
@@ -1904,8 +2869,10 @@ static int toolbox_obscured(struct client *cli, int16_t x, int16_t y)
 		uint16_t ww;
 		uint16_t hh;
 
-		if (it == cli)
+		if (it == cli) {
+			above = 1;
 			continue;
+		}
 
 		(it->x < 0) ? (xx = curscr->x) : (xx = it->x);
 		(it->y < 0) ? (yy = curscr->y) : (yy = it->y);
@@ -1913,7 +2880,7 @@ static int toolbox_obscured(struct client *cli, int16_t x, int16_t y)
 		ww = xx + it->w;
 		hh = yy + it->h;
 
-		if (((cli->ts < it->ts) | (it->win == top_win)) &&
+		if ((above | (it->win == top_win)) &&
 		    x >= xx && x + d <= ww && y >= yy && y + d <= hh) {
 			return 1;
 		}
@@ -1993,7 +2960,6 @@ static void move_toolbox(struct client *cli)
 
 static void draw_toolbox(const char *str, uint8_t len)
 {
-	struct xcb xcb;
 	struct area area;
 	uint16_t x;
 	uint16_t y;
@@ -2005,7 +2971,6 @@ static void draw_toolbox(const char *str, uint8_t len)
 	area.rect.y = 1;
 	area.rect.width = toolbox.size - ITEM_V_MARGIN;
 	area.rect.height = toolbox.size - ITEM_V_MARGIN;
-	clear_area(toolbox.win, toolbox.gc, &area);
 
 	set_text_str(toolbox.text, str, len);
 	get_text_size(toolbox.text, &w, &h);
@@ -2020,13 +2985,8 @@ static void draw_toolbox(const char *str, uint8_t len)
 		y++;
 	y /= 2;
 
-	set_text_pos(toolbox.text, x, y);
-
-	xcb.dpy = dpy;
-	xcb.win = toolbox.win;
-	xcb.gc = toolbox.gc;
-
-	draw_text_xcb(&xcb, toolbox.text);
+	draw_label(toolbox.win, toolbox.gc, toolbox.text, str, len, &area,
+		   get_color(NOTICE_FG), x - 1, y - 1);
 }
 
 static void show_toolbox(struct client *cli)
@@ -2122,8 +3082,7 @@ static void focus_root(void)
 	hide_toolbar();
 
 	print_title(curscr, XCB_WINDOW_NONE);
-	xcb_set_input_focus_checked(dpy, XCB_NONE, rootscr->root,
-				    XCB_CURRENT_TIME);
+	txn_input(rootscr->root);
 }
 
 static void focus_any(pid_t pid)
@@ -2150,7 +3109,8 @@ static void focus_any(pid_t pid)
 		arg.cli = pointer2cli();
 
 	if (arg.cli) {
-		if (window_status(arg.cli->win) != WIN_STATUS_VISIBLE) {
+		if (arg.cli->parked ||
+		    window_status(arg.cli->win) != WIN_STATUS_VISIBLE) {
 			ww("invisible front win %#x\n", arg.cli->win);
 			arg.cli = NULL;
 		} else {
@@ -2419,7 +3379,6 @@ static struct screen *cli2scr(struct client *cli)
 static void draw_toolbar_text(struct toolbar_item *item, uint8_t flag)
 {
 	struct area area;
-	struct xcb xcb;
 	uint32_t fg;
 	uint16_t item_w;
 	uint16_t xx;
@@ -2461,17 +3420,8 @@ static void draw_toolbar_text(struct toolbar_item *item, uint8_t flag)
 	area.rect.y = 1;
 	area.rect.width = toolbox.size - ITEM_V_MARGIN;
 	area.rect.height = toolbox.size - ITEM_V_MARGIN;
-	clear_area(toolbar.panel.win, toolbar.panel.gc, &area);
-
-	set_text_str(toolbar.panel.text, item->str, item->len);
-	set_text_color(toolbar.panel.text, fg, area.color);
-	set_text_pos(toolbar.panel.text, item->x + xx, icon_text_y);
-
-	xcb.dpy = dpy;
-	xcb.win = toolbar.panel.win;
-	xcb.gc = toolbar.panel.gc;
-
-	draw_text_xcb(&xcb, toolbar.panel.text);
+	draw_label(toolbar.panel.win, toolbar.panel.gc, toolbar.panel.text,
+		   item->str, item->len, &area, fg, xx, icon_text_y - 1);
 }
 
 static void focus_toolbar_item(struct toolbar_item *item, int16_t x)
@@ -2552,7 +3502,7 @@ static void spawn_cleanup(int sig)
 
 static void shutdown_wm(int sig)
 {
-	shutdown = 1;
+	shutdown_ = 1;
 }
 
 static void spawn(struct arg *arg)
@@ -2917,9 +3867,14 @@ static int panel_window(xcb_window_t win)
 
 static void window_state(xcb_window_t win, uint8_t state)
 {
-	uint32_t data[] = { state, XCB_NONE };
-	xcb_change_property_checked(dpy, XCB_PROP_MODE_REPLACE, win,
-				    a_state, a_state, 32, 2, data);
+	struct txn_win *cur;
+
+	if (!(cur = txn_win(win)))
+		return;
+
+	cur->state = state;
+	cur->flags |= TXN_STATE;
+	txn_done();
 }
 
 static void setup_toolbar(struct client *cli)
@@ -3004,12 +3959,16 @@ static void show_toolbar(struct arg *arg)
 
 static struct client *prev_client(struct client *cli)
 {
-	struct list_head *cur;
+	struct list_head *cur = &cli->head;
 
-	list_back(cur, &cli->head) {
-		cli = list2cli(cur);
-		if (window_status(cli->win) == WIN_STATUS_VISIBLE)
-			return cli;
+	if (!cli->tag)
+		return NULL;
+
+	while ((cur = list_prev(cur, &cli->tag->clients)) != &cli->head) {
+		struct client *ret = list2cli(cur);
+
+		if (ret->mapped && !ret->parked)
+			return ret;
 	}
 
 	return NULL;
@@ -3022,12 +3981,16 @@ static struct client *next_client(struct client *cli)
 	if (!cli) {
 		ww("client has gone\n");
 		return NULL;
+	} else if (!cli->tag) {
+		return cli;
 	}
 
-	list_walk(cur, &cli->head) {
+	cur = &cli->head;
+
+	while ((cur = list_next(cur, &cli->tag->clients)) != &cli->head) {
 		struct client *ret = list2cli(cur);
 
-		if (window_status(ret->win) == WIN_STATUS_VISIBLE) {
+		if (ret->mapped && !ret->parked) {
 			dd("ret %p %s:%d\n", ret, __func__, __LINE__);
 			return ret;
 		}
@@ -3037,6 +4000,107 @@ static struct client *next_client(struct client *cli)
 	return cli;
 }
 
+/* next is older in focus history, prev wraps to the oldest one */
+
+static struct client *mru_client(struct client *cli, enum dir dir)
+{
+	struct list_head *cur = &cli->mru;
+
+	while (1) {
+		struct client *ret;
+
+		if (dir == DIR_NEXT)
+			cur = list_next(cur, &cli->tag->mru);
+		else
+			cur = list_prev(cur, &cli->tag->mru);
+
+		if (cur == &cli->mru)
+			return NULL;
+
+		ret = mru2cli(cur);
+
+		if (ret->mapped && !ret->parked && ret->win != top_win)
+			return ret;
+	}
+}
+
+static uint8_t mod_pressed(void)
+{
+	xcb_query_pointer_cookie_t c;
+	xcb_query_pointer_reply_t *r;
+	uint8_t ret;
+
+	c = xcb_query_pointer(dpy, rootscr->root);
+	if (!(r = xcb_query_pointer_reply(dpy, c, NULL)))
+		return 0;
+
+	ret = !!(r->mask & MOD);
+	free(r);
+	return ret;
+}
+
+static uint8_t grab_keyboard(void)
+{
+	xcb_grab_keyboard_cookie_t c;
+	xcb_grab_keyboard_reply_t *r;
+	uint8_t ret;
+
+	c = xcb_grab_keyboard(dpy, 0, rootscr->root, XCB_CURRENT_TIME,
+			      XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+	if (!(r = xcb_grab_keyboard_reply(dpy, c, NULL)))
+		return 0;
+
+	if (!(ret = r->status == XCB_GRAB_STATUS_SUCCESS))
+		ww("keyboard grab failed, status %u\n", r->status);
+
+	free(r);
+	return ret;
+}
+
+static struct client *cycle_window(struct screen *scr, enum dir dir)
+{
+	struct arg arg;
+	uint8_t grabbed = 1;
+
+	hide_toolbox();
+	hide_toolbar();
+
+	if (mru_cycle_ && mru_cycle_->tag == scr->tag) {
+		arg.cli = mru_cycle_;
+	} else if (!list_empty(&scr->tag->mru)) {
+		arg.cli = mru2cli(scr->tag->mru.next);
+	} else {
+		ee("no front windows found\n");
+		return NULL;
+	}
+
+	if (!(arg.cli = mru_client(arg.cli, dir)))
+		return NULL;
+
+	scr->flags |= SCR_FLG_SWITCH_WINDOW;
+
+	tt("scr %u tag '%s' mru cli %p, win %#x\n",
+	   scr->id, scr->tag->name, arg.cli, arg.cli->win);
+
+	if (!mru_cycle_) /* to see modifier release */
+		grabbed = grab_keyboard();
+
+	mru_cycle_ = arg.cli;
+	arg.kmap = NULL;
+	raise_client(&arg);
+	center_pointer(arg.cli);
+
+	if (top_win != XCB_WINDOW_NONE)
+		raise_window(top_win);
+
+	/* release is never seen without grab or already happened */
+	if (!grabbed || !mod_pressed())
+		end_cycle(1);
+
+	xcb_flush(dpy);
+	return arg.cli;
+}
+
 static struct client *switch_window(struct screen *scr, enum dir dir)
 {
 	struct arg arg;
@@ -3104,28 +4168,266 @@ static struct client *switch_window(struct screen *scr, enum dir dir)
 	return arg.cli;
 }
 
+/* Layouts fill cells with outer geometry (borders included) of tiled windows
+ * within tag space. Cells come in stacking order, so front window is the last
+ * one and layouts with master area give it to that window.
+ */
+
 #define GRIDCELL_MIN_WIDTH 100
+#define MASTER_RATIO .6
+
+enum layout_id {
+	LAYOUT_GRID,
+	LAYOUT_MASTER,
+	LAYOUT_COLUMNS,
+	LAYOUT_SPIRAL,
+	LAYOUT_MONOCLE,
+	LAYOUT_MAX,
+};
+
+struct cell {
+	struct client *cli;
+	struct rect r;
+};
+
+struct layout {
+	const char *name;
+	/* toggle is set when user repeats the action, return 0 to leave
+	 * windows as they are
+	 */
+	uint8_t (*arrange)(struct tag *tag, struct cell *cells, uint16_t n,
+			   uint8_t toggle);
+};
+
+static struct cell *cells_;
+static uint16_t cells_max_;
+
+static uint8_t grow_cells(void)
+{
+	uint16_t max = cells_max_ ? cells_max_ * 2 : 32;
+	struct cell *tmp = realloc(cells_, max * sizeof(*tmp));
+
+	if (!tmp) {
+		ee("realloc(%zu) failed\n", max * sizeof(*tmp));
+		return 0;
+	}
+
+	cells_ = tmp;
+	cells_max_ = max;
+	return 1;
+}
 
-static uint8_t cell_size(uint16_t n, uint16_t *w, uint16_t *h)
+static uint8_t cell_size(struct rect *space, uint16_t n, uint16_t *w,
+			 uint16_t *h)
 {
 	uint16_t i;
 
-	for (i = 1; i < curscr->tag->space.w / GRIDCELL_MIN_WIDTH; i++) {
+	for (i = 1; i < space->w / GRIDCELL_MIN_WIDTH; i++) {
 		if (i * i >= n) {
-			*w = curscr->tag->space.w / i;
-			*h = curscr->tag->space.h / i;
+			*w = space->w / i;
+			*h = space->h / i;
 			return 1;
 		} else if (i * (i + 1) >= n) {
-			*w = curscr->tag->space.w / (i + 1);
-			*h = curscr->tag->space.h / i;
+			*w = space->w / (i + 1);
+			*h = space->h / i;
 			return 1;
 		}
 	}
 
-	ww("failed to calculate cell size for screen %d\n", curscr->id);
-	return 0;
+	ww("failed to calculate cell size for %u windows\n", n);
+	return 0;
+}
+
+/* stretch cell to space end if the gap left there cannot fit a border */
+
+static uint16_t fit_cell(int16_t end, int16_t pos, uint16_t len)
+{
+	uint16_t gap = end - (pos + len);
+
+	return (gap > 2 * BORDER_WIDTH) ? len : len + gap;
+}
+
+/* slice area into n equal parts side by side or one above another, last
+ * part takes rounding leftovers
+ */
+
+static void split_even(struct rect *area, struct cell *cells, uint16_t n,
+		       uint8_t vert)
+{
+	uint16_t i;
+	uint16_t len = (vert ? area->w : area->h) / n;
+
+	for (i = 0; i < n; i++) {
+		struct rect *r = &cells[i].r;
+
+		*r = *area;
+
+		if (vert) {
+			r->x += i * len;
+			r->w = (i + 1 < n) ? len : area->w - i * len;
+		} else {
+			r->y += i * len;
+			r->h = (i + 1 < n) ? len : area->h - i * len;
+		}
+	}
+}
+
+static uint8_t layout_grid(struct tag *tag, struct cell *cells, uint16_t n,
+			   uint8_t toggle)
+{
+	struct rect *space = &tag->space;
+	uint16_t cw, ch; /* cell size */
+	int16_t x, y;
+	uint16_t i;
+
+	if (n == 1 && !tag->anchor) {
+		return 0;
+	} else if (n == 1) {
+		cw = space->w;
+		ch = space->h;
+	} else if (n == 2) {
+		if (toggle)
+			tag->grid2v = !tag->grid2v;
+
+		if (tag->grid2v) { /* vertical split */
+			cw = space->w / 2;
+			ch = space->h;
+		} else { /* horizontal split */
+			cw = space->w;
+			ch = space->h / 2;
+		}
+	} else if (!cell_size(space, n, &cw, &ch)) {
+		return 0;
+	}
+
+	ii("%d cells size of (%u,%u)\n", n, cw, ch);
+	x = y = 0;
+
+	for (i = 0; i < n; i++) {
+		struct rect *r = &cells[i].r;
+
+		r->x = space->x + x;
+		r->y = space->y + y;
+		r->w = fit_cell(space->x + space->w, r->x, cw);
+		r->h = fit_cell(space->y + space->h, r->y, ch);
+
+		if (i + 1 == n && n != 2) /* last window occupies remaining space */
+			r->w = space->w - (r->x - space->x);
+
+		x += cw;
+
+		if (x > space->w - cw) {
+			x = 0;
+			y += ch;
+		}
+	}
+
+	return 1;
+}
+
+static uint8_t layout_master(struct tag *tag, struct cell *cells, uint16_t n,
+			     uint8_t toggle)
+{
+	struct rect *master = &cells[n - 1].r;
+	struct rect stack = tag->space;
+
+	if (toggle)
+		tag->grid2v = !tag->grid2v;
+
+	*master = tag->space;
+
+	if (n == 1)
+		return 1;
+
+	if (tag->grid2v) { /* master on the left, stack on the right */
+		master->w = tag->space.w * MASTER_RATIO;
+		stack.x += master->w;
+		stack.w -= master->w;
+	} else { /* master on top, stack below */
+		master->h = tag->space.h * MASTER_RATIO;
+		stack.y += master->h;
+		stack.h -= master->h;
+	}
+
+	split_even(&stack, cells, n - 1, !tag->grid2v);
+	return 1;
+}
+
+static uint8_t layout_columns(struct tag *tag, struct cell *cells, uint16_t n,
+			      unused(uint8_t toggle))
+{
+	split_even(&tag->space, cells, n, 1);
+	return 1;
+}
+
+/* each next window takes half of what is left going clockwise from the left
+ * edge, windows which would get less than a grid cell share the rest
+ */
+
+static uint8_t layout_spiral(struct tag *tag, struct cell *cells, uint16_t n,
+			     unused(uint8_t toggle))
+{
+	struct rect rest = tag->space;
+	uint16_t i, k;
+	uint16_t len;
+
+	for (i = n, k = 0; i-- > 0; k++) {
+		struct rect *r = &cells[i].r;
+
+		*r = rest;
+
+		if (i == 0)
+			break;
+
+		len = (k % 2) ? rest.h / 2 : rest.w / 2;
+
+		if (len < GRIDCELL_MIN_WIDTH)
+			continue;
+
+		switch (k % 4) {
+		case 0: /* left */
+			r->w = len;
+			rest.x += len;
+			rest.w -= len;
+			break;
+		case 1: /* top */
+			r->h = len;
+			rest.y += len;
+			rest.h -= len;
+			break;
+		case 2: /* right */
+			r->x = rest.x + rest.w - len;
+			r->w = len;
+			rest.w -= len;
+			break;
+		case 3: /* bottom */
+			r->y = rest.y + rest.h - len;
+			r->h = len;
+			rest.h -= len;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+static uint8_t layout_monocle(struct tag *tag, struct cell *cells, uint16_t n,
+			      unused(uint8_t toggle))
+{
+	while (n--)
+		cells[n].r = tag->space;
+
+	return 1;
 }
 
+static const struct layout layouts_[LAYOUT_MAX] = {
+	[LAYOUT_GRID] = { "grid", layout_grid, },
+	[LAYOUT_MASTER] = { "master", layout_master, },
+	[LAYOUT_COLUMNS] = { "columns", layout_columns, },
+	[LAYOUT_SPIRAL] = { "spiral", layout_spiral, },
+	[LAYOUT_MONOCLE] = { "monocle", layout_monocle, },
+};
+
 static void recalc_space(struct screen *scr, enum winpos pos)
 {
 	struct client *cli = scr->tag->anchor;
@@ -3151,15 +4453,12 @@ static void recalc_space(struct screen *scr, enum winpos pos)
 	return;
 }
 
-static void make_grid(struct arg *arg)
+static void tile_windows(struct arg *arg)
 {
 	struct tag *tag = curscr->tag;
+	const struct layout *layout = &layouts_[tag->layout];
 	struct list_head *cur;
-	uint16_t i;
-	uint16_t n = 0;
-	uint16_t cw, ch; /* cell size */
-	int16_t x, y;
-	uint64_t ts;
+	uint16_t i, n = 0;
 
 	list_walk(cur, &tag->clients) {
 		struct client *cli = list2cli(cur);
@@ -3168,100 +4467,75 @@ static void make_grid(struct arg *arg)
 			continue;
 		else if (cli->flags & CLI_FLG_POPUP)
 			continue;
-		else if (window_status(cli->win) == WIN_STATUS_VISIBLE)
-			n++;
+		else if (!cli->mapped)
+			continue;
+		else if (n == cells_max_ && !grow_cells())
+			return;
+
+		cells_[n++].cli = cli;
 	}
 
 	if (n == 0) {
 		return;
-	} else if (n == 1 && !tag->anchor) {
-		return;
 	} else if (n == 1 && tag->anchor) {
 		tag->grid2v = (tag->anchor->h > tag->anchor->w);
 
 		if (tag->grid2v) { /* vertical split */
 			tag->space.w = curscr->w - tag->anchor->w;
 			tag->space.w -= 2 * BORDER_WIDTH;
-			cw = tag->space.w;
-			ch = tag->space.h;
 		} else { /* horizontal split */
 			tag->space.h = curscr->h - tag->anchor->h;
 			tag->space.h -= 2 * BORDER_WIDTH;
-			cw = tag->space.w;
-			ch = tag->space.h;
-		}
-	} else if (n == 2) {
-		if (!arg->data) { /* only toggle via shortcut */
-			if (tag->grid2v)
-				tag->grid2v = 0;
-			else
-				tag->grid2v = 1;
 		}
-
-		if (tag->grid2v) { /* vertical split */
-			cw = tag->space.w / 2;
-			ch = tag->space.h;
-		} else { /* horizontal split */
-			cw = tag->space.w;
-			ch = tag->space.h / 2;
-		}
-	} else if (!cell_size(n, &cw, &ch)) {
-		return;
 	}
 
-	ii("%d cells size of (%u,%u)\n", n, cw, ch);
-	i = x = y = 0;
-	ts = 0;
+	if (!layout->arrange(tag, cells_, n, !arg->data)) /* only via shortcut */
+		return;
 
-	list_walk(cur, &tag->clients) {
-		int16_t yy;
-		int16_t xx;
-		uint16_t hh;
-		uint16_t ww;
-		struct client *cli = list2cli(cur);
+	ii("tag '%s' layout %s windows %u\n", tag->name, layout->name, n);
+	txn_begin();
 
-		if (ts) { /* equalize timestamps so toolbox will not be hidden */
-			cli->ts = ts;
-		} else {
-			cli->ts = time_us();
-			ts = cli->ts;
-		}
+	for (i = 0; i < n; i++) {
+		struct client *cli = cells_[i].cli;
+		struct rect *r = &cells_[i].r;
 
-		if (tag->anchor == cli)
-			continue;
-		else if (cli->flags & CLI_FLG_POPUP)
-			continue;
-		if (window_status(cli->win) != WIN_STATUS_VISIBLE)
-			continue;
+		client_moveresize(cli, r->x, r->y,
+				  r->w - 2 * BORDER_WIDTH - WINDOW_PAD,
+				  r->h - 2 * BORDER_WIDTH - WINDOW_PAD);
+		border_color(cli->win, get_color(BORDER_FG));
+	}
 
-		xx = tag->space.x + x;
-		ww = (tag->space.x + tag->space.w) - (xx + cw);
-		(ww > 2 * BORDER_WIDTH) ? (ww = cw) : (ww += cw);
-		ww -= 2 * BORDER_WIDTH - WINDOW_PAD;
+	focus_any(0);
+	txn_commit();
+}
 
-		yy = tag->space.y + y;
-		hh = (tag->space.y + tag->space.h) - (yy + ch);
-		(hh > 2 * BORDER_WIDTH) ? (hh = ch) : (hh += ch);
-		hh -= 2 * BORDER_WIDTH - WINDOW_PAD;
+static void set_layout(struct tag *tag, const char *name)
+{
+	struct arg arg = { .data = 1, }; /* do not toggle split */
+	uint8_t i;
 
-		if (++i >= n && n != 2) { /* last window occupies remaining space */
-			ww = tag->space.w - 2 * BORDER_WIDTH;
-			ww -= xx - tag->space.x;
+	if (!*name) {
+		tag->layout = (tag->layout + 1) % LAYOUT_MAX;
+	} else {
+		for (i = 0; i < LAYOUT_MAX; i++) {
+			if (strcmp(layouts_[i].name, name) == 0)
+				break;
 		}
 
-		client_moveresize(cli, xx, yy, ww, hh);
-		x += cw;
-
-		if (x > tag->space.w - cw) {
-			x = 0;
-			y += ch;
+		if (i == LAYOUT_MAX) {
+			ww("unknown layout '%s'\n", name);
+			return;
 		}
 
-		unfocus_window(cli->win);
+		tag->layout = i;
 	}
 
-	focus_any(0);
-	xcb_flush(dpy);
+	tile_windows(&arg);
+}
+
+static void next_layout(unused(struct arg *arg))
+{
+	set_layout(curscr->tag, "");
 }
 
 static void flag_window(struct arg *arg)
@@ -3360,7 +4634,7 @@ static void update_flagged_window(struct arg *arg, int16_t x, int16_t y,
 	if (curscr->tag->anchor == arg->cli) {
 		recalc_space(curscr, pos);
 		arg->data = 1; /* disable vert/horiz toggle */
-		make_grid(arg);
+		tile_windows(arg);
 	}
 
 	if (arg->cli != toolbar.cli)
@@ -3581,12 +4855,61 @@ static void place_window(struct arg *arg)
 
 static void next_window(unused(struct arg *arg))
 {
-	switch_window(curscr, DIR_NEXT);
+	cycle_window(curscr, DIR_NEXT);
 }
 
 static void prev_window(unused(struct arg *arg))
 {
-	switch_window(curscr, DIR_PREV);
+	cycle_window(curscr, DIR_PREV);
+}
+
+/* parked window stays mapped beyond root window bounds, so client neither
+ * tears down nor repaints its content when tag is shown again
+ */
+
+static void park_window(struct client *cli, uint8_t park)
+{
+	uint32_t val[2];
+	uint16_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
+
+	val[0] = park ? root_w : cli->x;
+	val[1] = cli->y;
+	txn_configure(cli->win, mask, val);
+	cli->parked = park;
+}
+
+static void unpark_clients(void)
+{
+	struct list_head *cur;
+
+	list_walk(cur, &clients) {
+		struct client *cli = glob2client(cur);
+
+		if (!cli->parked)
+			continue;
+
+		txn_map(cli->win, 0); /* unmap first to not flash on screen */
+		cli->mapped = 0;
+		park_window(cli, 0);
+	}
+}
+
+/* root window has grown or shrunk, so move parked clients to its new edge */
+
+static void repark_clients(void)
+{
+	struct list_head *cur;
+
+	txn_begin();
+
+	list_walk(cur, &clients) {
+		struct client *cli = glob2client(cur);
+
+		if (cli->parked)
+			park_window(cli, 1);
+	}
+
+	txn_commit();
 }
 
 static void show_windows(struct tag *tag, uint8_t focus)
@@ -3605,7 +4928,14 @@ static void show_windows(struct tag *tag, uint8_t focus)
 	list_walk(cur, &tag->clients) {
 		struct client *cli = list2cli(cur);
 		window_state(cli->win, XCB_ICCCM_WM_STATE_NORMAL);
-		xcb_map_window_checked(dpy, cli->win);
+
+		if (cli->parked) {
+			park_window(cli, 0);
+		} else {
+			txn_map(cli->win, 1);
+			cli->mapped = 1;
+		}
+
 		if (!arg.cli)
 			arg.cli = cli;
 	}
@@ -3630,7 +4960,13 @@ static void hide_windows(struct tag *tag)
 	list_walk(cur, &tag->clients) {
 		struct client *cli = list2cli(cur);
 		window_state(cli->win, XCB_ICCCM_WM_STATE_ICONIC);
-		xcb_unmap_window_checked(dpy, cli->win);
+
+		if (park_ && cli->mapped) {
+			park_window(cli, 1);
+		} else {
+			txn_map(cli->win, 0);
+			cli->mapped = 0;
+		}
 	}
 }
 
@@ -3638,6 +4974,7 @@ static void focus_tag(struct screen *scr, struct tag *tag)
 {
 	hide_toolbox();
 	hide_toolbar();
+	txn_begin();
 
 	if (scr->tag) {
 		print_tag(scr, scr->tag, ITEM_FLG_NORMAL);
@@ -3649,6 +4986,8 @@ static void focus_tag(struct screen *scr, struct tag *tag)
 
 	if (!(scr->flags & SCR_FLG_CLIENT_RETAG))
 		show_windows(tag, 1);
+
+	txn_commit();
 }
 
 static void switch_tag(struct screen *scr, enum dir dir)
@@ -3690,14 +5029,15 @@ static void retag_client(struct arg *arg)
 		return;
 
 	tag = arg->cli->tag;
-	list_del(&arg->cli->head); /* remove from current tag */
+	detach_client(arg->cli); /* remove from current tag */
+	txn_begin();
 	walk_tags(arg); /* switch to next tag */
-	list_add(&curscr->tag->clients, &arg->cli->head); /* re-tag */
+	attach_client(curscr->tag, arg->cli); /* re-tag */
 	arg->cli->scr = curscr;
 	arg->cli->tag = curscr->tag;
 	center_pointer(arg->cli);
 	raise_client(arg);
-	xcb_flush(dpy);
+	txn_commit();
 
 	if (!tag)
 		return;
@@ -3925,6 +5265,11 @@ static void arrange_dock(struct screen *scr)
 
 static void del_dock(struct client *cli)
 {
+	if (cli->ring) {
+		munmap(cli->ring, sizeof(*cli->ring));
+		cli->ring = NULL;
+	}
+
 	list_del(&cli->head);
 	list_del(&cli->list);
 	arrange_dock(cli->scr);
@@ -4063,9 +5408,11 @@ static uint32_t window_exclusive(xcb_window_t win)
 
 static void map_window(xcb_window_t win)
 {
+	xcb_get_geometry_cookie_t c;
 	xcb_get_geometry_reply_t *g;
 
-	g = xcb_get_geometry_reply(dpy, xcb_get_geometry(dpy, win), NULL);
+	c = xcb_get_geometry(dpy, win);
+	g = xcb_get_geometry_reply(dpy, c, NULL);
 
 	if (g) {
 		warp_pointer(win, g->width / 2, g->height / 2);
@@ -4185,6 +5532,7 @@ static struct client *add_window(xcb_window_t win, uint8_t winflags)
 	uint32_t grav;
 	uint8_t border_w;
 	xcb_window_t leader;
+	xcb_get_geometry_cookie_t gc;
 	xcb_get_geometry_reply_t *g;
 	xcb_get_window_attributes_cookie_t c;
 	xcb_get_window_attributes_reply_t *a;
@@ -4201,7 +5549,8 @@ static struct client *add_window(xcb_window_t win, uint8_t winflags)
 	scr = NULL;
 	cli = NULL;
 	a = NULL;
-	g = xcb_get_geometry_reply(dpy, xcb_get_geometry(dpy, win), NULL);
+	gc = xcb_get_geometry(dpy, win);
+	g = xcb_get_geometry_reply(dpy, gc, NULL);
 
 	if (!g) {
 		if (errno != ENOENT) {
@@ -4328,14 +5677,14 @@ static struct client *add_window(xcb_window_t win, uint8_t winflags)
 
 	if ((cli = win2cli(win))) {
 		ii("win %#x already on clients list\n", win);
-		list_del(&cli->head);
+		detach_client(cli);
 		list_del(&cli->list);
 	} else if ((cli = dock2cli(scr, win))) {
 		dd("destroy dock win %#x\n", win);
 		close_client(&cli);
 	} else if ((cli = tag2cli(scr->tag, win))) {
 		ii("win %#x already on [%s] list\n", win, scr->tag->name);
-		list_del(&cli->head);
+		detach_client(cli);
 		list_del(&cli->list);
 	}
 
@@ -4359,6 +5708,8 @@ static struct client *add_window(xcb_window_t win, uint8_t winflags)
 			ee("calloc(%lu) failed\n", sizeof(*cli));
 			goto out;
 		}
+
+		list_init(&cli->mru);
 	}
 
 	cli->div = 1;
@@ -4432,7 +5783,7 @@ static struct client *add_window(xcb_window_t win, uint8_t winflags)
 
 	xcb_change_window_attributes_checked(dpy, win, XCB_CW_EVENT_MASK, val);
 	unfocus_clients(curscr->tag);
-	list_add(&cli->tag->clients, &cli->head);
+	attach_client(cli->tag, cli);
 	list_add(&clients, &cli->list); /* also add to global list of clients */
 
 	if (cli->flags & CLI_FLG_FULLSCREEN) {
@@ -4446,10 +5797,11 @@ static struct client *add_window(xcb_window_t win, uint8_t winflags)
 
 	if (scr->tag != cli->tag) {
 		window_state(cli->win, XCB_ICCCM_WM_STATE_ICONIC);
-		xcb_unmap_window_checked(dpy, cli->win);
+		txn_map(cli->win, 0);
 	} else {
 		window_state(cli->win, XCB_ICCCM_WM_STATE_NORMAL);
-		xcb_map_window_checked(dpy, cli->win);
+		txn_map(cli->win, 1);
+		cli->mapped = 1;
 		center_pointer(cli);
 	}
 
@@ -4467,10 +5819,7 @@ static struct client *add_window(xcb_window_t win, uint8_t winflags)
 	tt("added win %#x scr %d tag '%s' pid %d geo %ux%u%+d%+d cli %p leader %#x\n",
 	   cli->win, scr->id, cli->tag->name, cli->pid, cli->w, cli->h,
 	   cli->x, cli->y, cli, cli->leader);
-	if (winflags & WIN_FLG_SCAN) {
-		cli->ts = time_us();
-	} else if (!(flags & CLI_FLG_PANEL) &&
-		   !(winflags & WIN_FLG_SCAN)) {
+	if (!(flags & CLI_FLG_PANEL) && !(winflags & WIN_FLG_SCAN)) {
 		struct arg arg = { .cli = cli, .kmap = NULL, };
 		arg.data = 1; /* do not update saved pointer coords */
 		raise_client(&arg);
@@ -4526,9 +5875,12 @@ static void raise_client(struct arg *arg)
 	}
 
 	update_head(arg->cli);
+
+	if (!mru_cycle_) /* history is updated once cycling is over */
+		update_mru(arg->cli);
+
 	raise_window(arg->cli->win);
 	focus_window(arg->cli->win);
-	arg->cli->ts = time_us();
 	store_client(arg->cli, 0);
 
 	if (arg->kmap && arg->kmap->arg == 1)
@@ -4646,12 +5998,14 @@ static inline void do_retag(struct tag *tag, struct client *cli)
 	set_crtc_brightness(curscr->crtc, 0);
 
 	hide_toolbox();
+	txn_begin();
 	window_state(cli->win, XCB_ICCCM_WM_STATE_ICONIC);
-	xcb_unmap_window_checked(dpy, cli->win);
-	xcb_flush(dpy);
+	txn_map(cli->win, 0);
+	cli->mapped = 0;
+	txn_commit();
 
-	list_del(&cli->head);
-	list_add(&tag->clients, &cli->head); /* re-tag window */
+	detach_client(cli);
+	attach_client(tag, cli); /* re-tag window */
 
 	cli->tag = tag;
 	cli->scr = curscr;
@@ -4751,6 +6105,8 @@ static void select_tag(struct screen *scr, int16_t x, int16_t y)
 		}
 	}
 
+	txn_begin();
+
 	if (scr->tag && scr->tag != prev) {
 		if (prev)
 			hide_windows(prev);
@@ -4763,10 +6119,10 @@ static void select_tag(struct screen *scr, int16_t x, int16_t y)
 	else
 		hide_toolbox();
 
-	if (scr->panel.win == XCB_WINDOW_NONE)
-		return;
+	if (scr->panel.win != XCB_WINDOW_NONE)
+		txn_input(scr->panel.win);
 
-	xcb_set_input_focus(dpy, XCB_NONE, scr->panel.win, XCB_CURRENT_TIME);
+	txn_commit();
 }
 
 static void clear_tag_area(struct screen *scr, struct tag *tag)
@@ -4779,7 +6135,8 @@ static void clear_tag_area(struct screen *scr, struct tag *tag)
 		area.rect.y = 0;
 		area.rect.width = tag->w;
 		area.rect.height = panel_height;
-		clear_area(scr->panel.win, scr->panel.gc, &area);
+		clear_panel(&scr->panel, &area);
+		tag->hash = 0;
 	}
 }
 
@@ -4796,6 +6153,7 @@ static struct tag *get_tag(struct screen *scr, const char *name, uint8_t id)
 			else if (tag->name)
 				free(tag->name);
 
+			flush_labels(); /* labels refer to names by pointer */
 			clear_tag_area(scr, tag);
 
 			tag->nlen = strlen(name);
@@ -4820,6 +6178,7 @@ static struct tag *get_tag(struct screen *scr, const char *name, uint8_t id)
 	}
 
 	list_init(&tag->clients);
+	list_init(&tag->mru);
 	list_add(&scr->tags, &tag->head);
 
 	struct tag *tmp = scr->tag;
@@ -4877,6 +6236,7 @@ static int tag_del(struct screen *scr, uint8_t id)
 		if (tag->name)
 			free(tag->name);
 
+		flush_labels();
 		free(tag);
 		return 1;
 	}
@@ -4941,9 +6301,22 @@ static int init_tags(struct screen *scr)
 	if (pos == scr->items[PANEL_AREA_TAGS].x) /* none found, add default */
 		pos = add_tag(scr, scr->name, 0, pos, ITEM_FLG_ACTIVE);
 
+	prerender_tags(scr);
 	return pos;
 }
 
+static void init_panel_buf(struct screen *scr)
+{
+	if (scr->panel.buf != XCB_NONE)
+		xcb_free_pixmap(dpy, scr->panel.buf);
+
+	scr->panel.buf = xcb_generate_id(dpy);
+	xcb_create_pixmap(dpy, rootscr->root_depth, scr->panel.buf,
+			  scr->panel.win, scr->w, panel_height);
+	memset(&scr->panel.damage, 0, sizeof(scr->panel.damage));
+	scr->panel.stale = 1;
+}
+
 static void move_panel(struct screen *scr)
 {
 	uint32_t val[3];
@@ -4964,12 +6337,24 @@ static void move_panel(struct screen *scr)
 	mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
 	mask |= XCB_CONFIG_WINDOW_WIDTH;
 	xcb_configure_window(dpy, scr->panel.win, mask, val);
+	init_panel_buf(scr); /* width could change */
 	redraw_panel(scr, NULL, 1);
+	publish_panel(&scr->panel);
 	xcb_flush(dpy);
 }
 
 static inline void clear_panel_area(struct screen *scr)
 {
+	struct list_head *cur;
+	uint8_t i;
+
+	for (i = 0; i < PANEL_AREA_MAX; i++)
+		scr->items[i].hash = 0;
+
+	list_walk(cur, &scr->tags) {
+		list2tag(cur)->hash = 0;
+	}
+
 	if (scr->panel.gc != XCB_NONE) {
 		struct area area;
 
@@ -4978,7 +6363,7 @@ static inline void clear_panel_area(struct screen *scr)
 		area.rect.y = 0;
 		area.rect.width = scr->w;
 		area.rect.height = panel_height;
-		clear_area(scr->panel.win, scr->panel.gc, &area);
+		clear_panel(&scr->panel, &area);
 	}
 }
 
@@ -4987,6 +6372,8 @@ static void reset_screen_panel(struct screen *scr)
 	struct list_head *cur;
 	struct list_head *tmp;
 
+	flush_labels();
+
 	list_walk_safe(cur, tmp, &scr->tags) { /* reset tag list */
 		struct tag *tag = list2tag(cur);
 		list_del(&tag->head);
@@ -5235,6 +6622,13 @@ static void init_keys(void)
 
 static void destroy_panel(struct screen *scr)
 {
+	flush_labels(); /* keyed by text objects destroyed below */
+
+	if (scr->panel.buf != XCB_NONE) {
+		xcb_free_pixmap(dpy, scr->panel.buf);
+		scr->panel.buf = XCB_NONE;
+	}
+
 	if (scr->panel.gc != XCB_NONE) {
 		xcb_free_gc_checked(dpy, scr->panel.gc);
 		scr->panel.gc = XCB_NONE;
@@ -5344,6 +6738,8 @@ static bool create_panel(struct screen *scr)
 	mask = XCB_GC_FOREGROUND | XCB_GC_BACKGROUND;
 	val[0] = val[1] = get_color(NORMAL_BG);
 	xcb_create_gc(dpy, scr->panel.gc, scr->panel.win, mask, val);
+	init_panel_buf(scr);
+	clear_panel_area(scr);
 
 	xcb_map_window_checked(dpy, scr->panel.win);
 
@@ -5757,6 +7153,8 @@ static void init_outputs(void)
 
 	init_fonts();
 
+	txn_begin(); /* move clients at once */
+
 	list_walk(cur, &screens) {
 		scr = list2screen(cur);
 		if (create_panel(scr))
@@ -5773,12 +7171,15 @@ static void init_outputs(void)
 		reinit_panel(scr); /* force reinit panel */
 	}
 
+	txn_commit(); /* rescan reads geometry back from server */
 	list_init(&clients); /* now can safely reset client's list */
 
 	init_tray();
 	init_toolbox();
+	txn_begin();
 	focus_root();
 	scan_clients(false);
+	txn_commit();
 
 	list_walk(cur, &screens) {
 		scr = list2screen(cur);
@@ -5830,6 +7231,8 @@ static void init_colors(void)
 		snprintf(path, len, "%s/colors/%s", homedir, ptr->fname);
 		load_color(path, ptr++);
 	}
+
+	flush_labels();
 }
 
 static void focus_screen(uint8_t id)
@@ -5947,112 +7350,404 @@ static uint16_t count_clients(struct tag *tag)
 			clicnt++;
 	}
 
-	return clicnt;
-}
+	return clicnt;
+}
+
+static void dump_tags(void)
+{
+	struct list_head *cur;
+	char path[homelen + sizeof("/tmp/tags")];
+	int fd;
+	char buf[256] = {0};
+
+	sprintf(path, "%s/tmp/tags", homedir);
+
+	if ((fd = open(path, O_WRONLY | O_TRUNC | O_CREAT)) < 0) {
+		ee("failed to open file %s, %s\n", path, strerror(errno));
+		return;
+	}
+
+	list_walk(cur, &screens) {
+		struct list_head *curtag;
+		struct screen *scr = list2screen(cur);
+
+		list_walk(curtag, &scr->tags) {
+			struct tag *tag = list2tag(curtag);
+			uint8_t current;
+			uint16_t clicnt = count_clients(tag);
+			struct client *cli;
+			xcb_window_t win;
+
+			if ((cli = front_client(tag)))
+				win = cli->win;
+			else
+				win = XCB_WINDOW_NONE;
+
+			curscr->tag == tag ? (current = 1) : (current = 0);
+			snprintf(buf, sizeof(buf),
+			  "%u\t%u\t%s\t%ux%u%+d%+d\t%u\t%u\t%#x\n", scr->id,
+			  tag->id, tag->name, tag->w, panel_height,
+			  tag->x, scr->panel.y, clicnt, current, win);
+			write(fd, buf, strlen(buf));
+			memset(buf, 0, sizeof(buf));
+		}
+	}
+
+	close(fd);
+	update_seq();
+}
+
+static void dump_screens(void)
+{
+	struct list_head *cur;
+	char path[homelen + sizeof("/tmp/screens")];
+	FILE *f;
+
+	sprintf(path, "%s/tmp/screens", homedir);
+
+	if (!(f = fopen(path, "w+"))) {
+		ee("fopen(%s) failed, %s\n", path, strerror(errno));
+		return;
+	}
+
+	list_walk(cur, &screens) {
+		struct screen *scr = list2screen(cur);
+		char current;
+
+		curscr == scr ? (current = '*') : (current = ' ');
+		fprintf(f, "%u\t%s\t%ux%u%+d%+d\t%c\n", scr->id, scr->name,
+			scr->w, scr->h + panel_height + PANEL_SCREEN_GAP,
+			scr->x, scr->y, current);
+	}
+
+	fclose(f);
+	update_seq();
+}
+
+struct client_req {
+	xcb_get_window_attributes_cookie_t attr;
+	xcb_get_property_cookie_t title;
+	xcb_get_property_cookie_t pid;
+};
+
+static const char *event_name(uint8_t slot, char *buf, size_t size)
+{
+	static const char *names[] = {
+		[0] = "error",
+		[XCB_KEY_PRESS] = "key-press",
+		[XCB_KEY_RELEASE] = "key-release",
+		[XCB_BUTTON_PRESS] = "button-press",
+		[XCB_BUTTON_RELEASE] = "button-release",
+		[XCB_MOTION_NOTIFY] = "motion-notify",
+		[XCB_ENTER_NOTIFY] = "enter-notify",
+		[XCB_LEAVE_NOTIFY] = "leave-notify",
+		[XCB_EXPOSE] = "expose",
+		[XCB_VISIBILITY_NOTIFY] = "visibility-notify",
+		[XCB_CREATE_NOTIFY] = "create-notify",
+		[XCB_DESTROY_NOTIFY] = "destroy-notify",
+		[XCB_UNMAP_NOTIFY] = "unmap-notify",
+		[XCB_MAP_NOTIFY] = "map-notify",
+		[XCB_MAP_REQUEST] = "map-request",
+		[XCB_CONFIGURE_NOTIFY] = "configure-notify",
+		[XCB_CONFIGURE_REQUEST] = "configure-request",
+		[XCB_PROPERTY_NOTIFY] = "property-notify",
+		[XCB_CLIENT_MESSAGE] = "client-message",
+	};
+
+	if (slot == STATS_CONTROL)
+		return "control";
+	else if (randrbase && /* 0 without RandR */
+		 slot == randrbase + XCB_RANDR_SCREEN_CHANGE_NOTIFY)
+		return "randr-screen-change";
+	else if (slot < ARRAY_SIZE(names) && names[slot])
+		return names[slot];
+
+	snprintf(buf, size, "event-%u", slot);
+	return buf;
+}
+
+/* upper bound of bucket where given share of events ends, in us */
+
+static uint32_t stats_percentile(struct event_stats *stats, uint8_t pct)
+{
+	uint64_t want = ((uint64_t) stats->count * pct + 99) / 100;
+	uint64_t sum = 0;
+	uint8_t i;
+
+	for (i = 0; i < STATS_BUCKETS - 1; i++) {
+		if ((sum += stats->hist[i]) >= want)
+			break;
+	}
+
+	return 1U << i;
+}
+
+static void dump_stats(uint8_t reset)
+{
+	char path[homelen + sizeof("/tmp/stats")];
+	char buf[sizeof("event-255")];
+	struct event_stats *stats;
+	uint16_t i, j;
+	FILE *f;
+
+	sprintf(path, "%s/tmp/stats", homedir);
+
+	if (!(f = fopen(path, "w+"))) {
+		ee("fopen(%s) failed, %s\n", path, strerror(errno));
+		return;
+	}
+
+	fprintf(f, "# %" PRIu64 " ms, panel regions repainted %u skipped %u\n",
+		(time_ns() - stats_since_) / 1000000, panel_stats_.repainted,
+		panel_stats_.skipped);
+	fprintf(f, "# event\tcount\treplies\tavg_us\tmax_us\tp50_us\t"
+		"p99_us\thist_log2_us\n");
+
+	for (i = 0; i < ARRAY_SIZE(stats_); i++) {
+		stats = &stats_[i];
+
+		if (!stats->count)
+			continue;
+
+		fprintf(f, "%s\t%u\t%u\t%" PRIu64 "\t%" PRIu64 "\t%u\t%u\t",
+			event_name(i, buf, sizeof(buf)), stats->count,
+			stats->replies, stats->total_ns / stats->count / 1000,
+			stats->max_ns / 1000, stats_percentile(stats, 50),
+			stats_percentile(stats, 99));
+
+		for (j = 0; j < STATS_BUCKETS; j++)
+			fprintf(f, j ? ",%u" : "%u", stats->hist[j]);
+
+		fputc('\n', f);
+	}
+
+	fclose(f);
+
+	if (reset) {
+		memset(stats_, 0, sizeof(stats_));
+		memset(&panel_stats_, 0, sizeof(panel_stats_));
+		stats_since_ = time_ns();
+	}
+}
+
+/* event trace, see trace.h */
+
+static struct {
+	FILE *f;
+	uint64_t last_us;
+	xcb_atom_t *atoms; /* names already recorded */
+	uint16_t atoms_num;
+	uint16_t atoms_max;
+} trace_;
+
+static void stop_trace(void)
+{
+	if (!trace_.f)
+		return;
+
+	if (fclose(trace_.f) != 0)
+		ee("failed to close trace, %s\n", strerror(errno));
+
+	trace_.f = NULL;
+	free(trace_.atoms);
+	trace_.atoms = NULL;
+	trace_.atoms_num = trace_.atoms_max = 0;
+	ii("trace stopped\n");
+}
+
+static void trace_write(enum trace_type type, const void *data, uint8_t len)
+{
+	struct trace_record rec;
+	uint64_t now = time_ns() / 1000;
+
+	if (now - trace_.last_us > UINT32_MAX)
+		rec.delta_us = UINT32_MAX;
+	else
+		rec.delta_us = now - trace_.last_us;
+
+	rec.type = type;
+	rec.len = len;
+	trace_.last_us = now;
+
+	if (fwrite(&rec, sizeof(rec), 1, trace_.f) != 1 ||
+	    (len && fwrite(data, len, 1, trace_.f) != 1)) {
+		ee("failed to write trace, %s\n", strerror(errno));
+		stop_trace();
+	}
+}
+
+static void trace_atom(xcb_atom_t atom)
+{
+	xcb_get_atom_name_cookie_t c;
+	xcb_get_atom_name_reply_t *r;
+	uint8_t buf[UCHAR_MAX];
+	xcb_atom_t *tmp;
+	uint16_t len;
+	uint16_t i;
+
+	if (atom <= XCB_ATOM_WM_TRANSIENT_FOR) /* predefined */
+		return;
+
+	for (i = 0; i < trace_.atoms_num; i++) {
+		if (trace_.atoms[i] == atom)
+			return;
+	}
+
+	if (trace_.atoms_num == trace_.atoms_max) {
+		uint16_t max = trace_.atoms_max ? trace_.atoms_max * 2 : 64;
 
-static void dump_tags(void)
-{
-	struct list_head *cur;
-	char path[homelen + sizeof("/tmp/tags")];
-	int fd;
-	char buf[256] = {0};
+		if (max <= trace_.atoms_max) /* name is left unknown */
+			return;
 
-	sprintf(path, "%s/tmp/tags", homedir);
+		if (!(tmp = realloc(trace_.atoms, max * sizeof(*tmp)))) {
+			ee("realloc(%zu) failed\n", max * sizeof(*tmp));
+			return;
+		}
 
-	if ((fd = open(path, O_WRONLY | O_TRUNC | O_CREAT)) < 0) {
-		ee("failed to open file %s, %s\n", path, strerror(errno));
-		return;
+		trace_.atoms = tmp;
+		trace_.atoms_max = max;
 	}
 
-	list_walk(cur, &screens) {
-		struct list_head *curtag;
-		struct screen *scr = list2screen(cur);
+	/* remember atom even if there is no reply to not ask again */
+	trace_.atoms[trace_.atoms_num++] = atom;
+	c = xcb_get_atom_name(dpy, atom);
 
-		list_walk(curtag, &scr->tags) {
-			struct tag *tag = list2tag(curtag);
-			uint8_t current;
-			uint16_t clicnt = count_clients(tag);
-			struct client *cli;
-			xcb_window_t win;
+	if (!(r = xcb_get_atom_name_reply(dpy, c, NULL)))
+		return;
 
-			if ((cli = front_client(tag)))
-				win = cli->win;
-			else
-				win = XCB_WINDOW_NONE;
+	len = xcb_get_atom_name_name_length(r);
 
-			curscr->tag == tag ? (current = 1) : (current = 0);
-			snprintf(buf, sizeof(buf),
-			  "%u\t%u\t%s\t%ux%u%+d%+d\t%u\t%u\t%#x\n", scr->id,
-			  tag->id, tag->name, tag->w, panel_height,
-			  tag->x, scr->panel.y, clicnt, current, win);
-			write(fd, buf, strlen(buf));
-			memset(buf, 0, sizeof(buf));
-		}
-	}
+	if (len > sizeof(buf) - sizeof(atom))
+		len = sizeof(buf) - sizeof(atom);
 
-	close(fd);
-	update_seq();
+	memcpy(buf, &atom, sizeof(atom));
+	memcpy(buf + sizeof(atom), xcb_get_atom_name_name(r), len);
+	free(r);
+	trace_write(TRACE_REC_ATOM, buf, sizeof(atom) + len);
 }
 
-static void dump_screens(void)
+static void trace_event(xcb_generic_event_t *e)
 {
-	struct list_head *cur;
-	char path[homelen + sizeof("/tmp/screens")];
-	FILE *f;
+	uint8_t type = XCB_EVENT_RESPONSE_TYPE(e);
 
-	sprintf(path, "%s/tmp/screens", homedir);
+	if (type == XCB_PROPERTY_NOTIFY)
+		trace_atom(((xcb_property_notify_event_t *) e)->atom);
+	else if (type == XCB_CLIENT_MESSAGE)
+		trace_atom(((xcb_client_message_event_t *) e)->type);
 
-	if (!(f = fopen(path, "w+"))) {
+	if (trace_.f) /* could be stopped on error */
+		trace_write(TRACE_REC_EVENT, e, TRACE_EVENT_LEN);
+}
+
+static void start_trace(const char *path)
+{
+	const xcb_setup_t *setup = xcb_get_setup(dpy);
+	struct trace_header hdr = {0};
+
+	stop_trace();
+
+	if (!(trace_.f = fopen(path, "w"))) {
 		ee("fopen(%s) failed, %s\n", path, strerror(errno));
 		return;
 	}
 
-	list_walk(cur, &screens) {
-		struct screen *scr = list2screen(cur);
-		char current;
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.root_w = rootscr->width_in_pixels;
+	hdr.root_h = rootscr->height_in_pixels;
+	hdr.randrbase = randrbase;
+	hdr.resource_base = setup->resource_id_base;
+	hdr.resource_mask = setup->resource_id_mask;
 
-		curscr == scr ? (current = '*') : (current = ' ');
-		fprintf(f, "%u\t%s\t%ux%u%+d%+d\t%c\n", scr->id, scr->name,
-			scr->w, scr->h + panel_height + PANEL_SCREEN_GAP,
-			scr->x, scr->y, current);
+	if (fwrite(&hdr, sizeof(hdr), 1, trace_.f) != 1) {
+		ee("failed to write trace header, %s\n", strerror(errno));
+		stop_trace();
+		return;
 	}
 
-	fclose(f);
-	update_seq();
+	trace_.last_us = time_ns() / 1000;
+	trace_.atoms_num = 0;
+	ii("trace events to %s\n", path);
 }
 
-static void dump_clients(uint8_t all)
+/* all requests are sent upfront to pay one round-trip for whole list */
+
+static void write_clients(FILE *f, uint8_t all)
 {
-	char path[homelen + sizeof("/tmp/clients")];
 	struct list_head *cur;
-	FILE *f;
+	struct client_req *req;
+	xcb_window_t win = pointer2win();
+	uint16_t n = 0;
+	uint16_t i;
 
-	sprintf(path, "%s/tmp/clients", homedir);
+	list_walk(cur, &clients) {
+		n++;
+	}
 
-	if (!(f = fopen(path, "w+"))) {
-		ee("fopen(%s) failed, %s\n", path, strerror(errno));
+	if (!n)
+		return;
+
+	if (!(req = calloc(n, sizeof(*req)))) {
+		ee("calloc(%lu) failed\n", n * sizeof(*req));
 		return;
 	}
 
+	i = 0;
+	list_walk(cur, &clients) {
+		struct client *cli = glob2client(cur);
+
+		req[i].attr = xcb_get_window_attributes(dpy, cli->win);
+		req[i].title = xcb_get_property(dpy, 0, cli->win, a_net_wm_name,
+						XCB_GET_PROPERTY_TYPE_ANY, 0,
+						UINT_MAX);
+		if (!cli->pid)
+			req[i].pid = xcb_get_property(dpy, 0, cli->win,
+						      a_net_wm_pid,
+						      XCB_ATOM_CARDINAL, 0, 1);
+		i++;
+	}
+
+	i = 0;
 	list_walk(cur, &clients) {
-		struct sprop title;
 		char temp[sizeof("255 ") + TAG_NAME_MAX +
 			  2 * sizeof("0xffffffff ") + sizeof("65535 ")];
 		struct client *cli = glob2client(cur);
-		xcb_window_t win = pointer2win();
+		xcb_get_window_attributes_reply_t *a;
+		xcb_get_property_reply_t *title;
+		xcb_get_property_reply_t *prop;
 		enum winstatus status;
 		const char *tag;
+		pid_t pid = cli->pid;
 		char current;
 
+		a = xcb_get_window_attributes_reply(dpy, req[i].attr, NULL);
+		title = xcb_get_property_reply(dpy, req[i].title, NULL);
+
+		if (!pid && (prop = xcb_get_property_reply(dpy, req[i].pid,
+							   NULL))) {
+			if (prop->format == 32 &&
+			    xcb_get_property_value_length(prop))
+				pid = *((pid_t *) xcb_get_property_value(prop));
+			free(prop);
+		}
+
+		i++;
+
+		if (!a)
+			status = WIN_STATUS_UNKNOWN;
+		else if (a->map_state != XCB_MAP_STATE_VIEWABLE)
+			status = WIN_STATUS_HIDDEN;
+		else
+			status = WIN_STATUS_VISIBLE;
+
+		free(a);
 		cli->win == win ? (current = '*') : (current = ' ');
-		status = window_status(cli->win);
 
-		if (!all && status == WIN_STATUS_UNKNOWN)
-			continue;
-		else if (!all && cli->flags & CLI_FLG_DOCK)
-			continue;
-		else if (!all && cli->flags & CLI_FLG_TRAY)
+		if (!all && (status == WIN_STATUS_UNKNOWN ||
+			     cli->flags & (CLI_FLG_DOCK | CLI_FLG_TRAY))) {
+			free(title);
 			continue;
+		}
 
 		if (cli->tag)
 			tag = cli->tag->name;
@@ -6064,30 +7759,102 @@ static void dump_clients(uint8_t all)
 			tag = "<nil>";
 
 		snprintf(temp, sizeof(temp), "%c\t%u\t%s\t%#x\t%d\t",
-			 current, cli->scr->id, tag, cli->win,
-			 win2pid(cli->win));
+			 current, cli->scr->id, tag, cli->win, pid);
 		fwrite(temp, strlen(temp), 1, f);
 
-		get_sprop(&title, cli->win, a_net_wm_name, UINT_MAX);
-
-		if (!title.ptr || !title.len) {
+		if (!title || !xcb_get_property_value_length(title)) {
 			fputs("<nil>\n", f);
 		} else {
-			fwrite(title.str, title.len, 1, f);
+			fwrite(xcb_get_property_value(title),
+			       xcb_get_property_value_length(title), 1, f);
 			fputc('\n', f);
-			free(title.ptr);
 		}
+
+		free(title);
+	}
+
+	free(req);
+}
+
+static void dump_clients(uint8_t all)
+{
+	char path[homelen + sizeof("/tmp/clients")];
+	FILE *f;
+
+	sprintf(path, "%s/tmp/clients", homedir);
+
+	if (!(f = fopen(path, "w+"))) {
+		ee("fopen(%s) failed, %s\n", path, strerror(errno));
+		return;
 	}
 
+	write_clients(f, all);
 	fclose(f);
 	update_seq();
 }
 
+/* same list as dump_clients() but in sealed memory passed to the peer */
+
+#define SNAPSHOT_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+static void send_clients(int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct msghdr msg = {0};
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char ok = 0;
+	int memfd;
+	FILE *f;
+
+	if ((memfd = memfd_create("fwm-clients",
+				  MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+		ee("memfd_create() failed, %s\n", strerror(errno));
+		return;
+	}
+
+	if (!(f = fdopen(dup(memfd), "w"))) {
+		ee("fdopen(%d) failed, %s\n", memfd, strerror(errno));
+		goto out;
+	}
+
+	write_clients(f, 0);
+
+	if (fclose(f) != 0) {
+		ee("failed to write clients, %s\n", strerror(errno));
+		goto out;
+	} else if (fcntl(memfd, F_ADD_SEALS, SNAPSHOT_SEALS) < 0) {
+		ee("fcntl(F_ADD_SEALS) failed, %s\n", strerror(errno));
+		goto out;
+	}
+
+	iov.iov_base = &ok;
+	iov.iov_len = sizeof(ok);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0)
+		ee("sendmsg(%d) failed, %s\n", fd, strerror(errno));
+out:
+	close(memfd);
+}
+
 #define match(str0, str1) strncmp(str0, str1, sizeof(str1) - 1) == 0
 
 static void handle_user_request(int fd)
 {
-	char req[64] = {0};
+	char req[128] = {0};
 	struct sprop name;
 
 	if (fd < 0) {
@@ -6098,18 +7865,25 @@ static void handle_user_request(int fd)
 				return;
 		}
 	} else {
-		if ((name.len = read(fd, req, sizeof(req))) < 1) {
+		ssize_t len = read(fd, req, sizeof(req) - 1);
+
+		if (len < 1) {
 			ee("read(%d) failed, %s\n", fd, strerror(errno));
 			return;
 		}
 
-		req[name.len] = '\0';
+		req[len] = '\0';
+		name.len = len;
 		name.str = req;
 		name.ptr = NULL;
 	}
 
 	tt("handle request '%s' len %u\n", name.str, name.len);
 
+	if (trace_.f)
+		trace_write(TRACE_REC_CONTROL, name.str, name.len > UCHAR_MAX ?
+			    UCHAR_MAX : name.len);
+
 	if (match(name.str, "reload-keys")) {
 		init_keys();
 	} else if (match(name.str, "lock")) {
@@ -6151,13 +7925,20 @@ static void handle_user_request(int fd)
 			focus_window_req(win);
 	} else if (match(name.str, "make-grid")) {
 		struct arg arg = { .data = 0, };
-		make_grid(&arg);
+		tile_windows(&arg);
+	} else if (match(name.str, "layout")) {
+		char *arg = &name.str[slen("layout")];
+
+		arg[strcspn(arg, "\n")] = '\0';
+		set_layout(curscr->tag, *arg == ' ' ? arg + 1 : arg);
 	} else if (match(name.str, "reload-colors")) {
 		struct list_head *cur;
 
 		init_colors();
 
 		list_walk(cur, &screens) {
+			prerender_tags(list2screen(cur));
+			list2screen(cur)->panel.stale = 1; /* gaps too */
 			redraw_panel(list2screen(cur), NULL, 1);
 		}
 	} else if (match(name.str, "update-dock")) {
@@ -6165,11 +7946,34 @@ static void handle_user_request(int fd)
 
 		if (arg) {
 			char *msg;
-			pid_t pid = strtol(arg, &msg, 10);
+			uint32_t id = strtoul(arg, &msg, 0); /* 0x for window */
+
+			if (id && msg && *msg == ' ' && strlen(msg) > 1)
+				update_dock(id, ++msg);
+		}
+	} else if (match(name.str, "trace-start")) {
+		char path[homelen + sizeof("/tmp/trace")];
+		char *arg = &name.str[slen("trace-start")];
+
+		arg[strcspn(arg, "\n")] = '\0';
 
-			if (pid && msg && *msg == ' ' && strlen(msg) > 1)
-				update_dock(pid, ++msg);
+		if (*arg == ' ') {
+			start_trace(++arg);
+		} else {
+			sprintf(path, "%s/tmp/trace", homedir);
+			start_trace(path);
 		}
+	} else if (match(name.str, "trace-stop")) {
+		stop_trace();
+	} else if (match(name.str, "stats")) {
+		dump_stats(strstr(name.str, "reset") != NULL);
+	} else if (match(name.str, "progress-dock")) {
+		char *arg = &name.str[sizeof("progress-dock")];
+		char *val;
+		uint32_t id = strtoul(arg, &val, 0);
+
+		if (id && val && *val == ' ')
+			progress_dock(id, atoi(val));
 	}
 
 	free(name.ptr);
@@ -6567,11 +8371,10 @@ static void handle_motion_notify(xcb_motion_notify_event_t *e)
 	val[0] = cli->x;
 	val[1] = cli->y;
 	xcb_configure_window_checked(dpy, cli->win, mask, val);
-	cli->ts = time_us();
 
 	if (cli->scr != curscr && !(cli->flags & CLI_FLG_DOCK)) { /* retag */
-		list_del(&cli->head);
-		list_add(&curscr->tag->clients, &cli->head);
+		detach_client(cli);
+		attach_client(curscr->tag, cli);
 		cli->tag = curscr->tag;
 		cli->scr = curscr;
 		ii("win %#x now on tag %s screen %d\n", e->child,
@@ -6622,6 +8425,21 @@ static void toolbar_key_press(xcb_key_press_event_t *e)
 	draw_toolbar_text(focused_item, flg);
 }
 
+static uint8_t cycle_key(xcb_keycode_t key)
+{
+	struct list_head *cur;
+
+	list_walk(cur, &keymap) {
+		struct keymap *kmap = list2keymap(cur);
+
+		if (kmap->key == key && (kmap->action == next_window ||
+					 kmap->action == prev_window))
+			return 1;
+	}
+
+	return 0;
+}
+
 static void handle_key_release(xcb_key_release_event_t *e)
 {
 	te("XCB_KEY_RELEASE: root %#x, win %#x, child %#x, key %d\n",
@@ -6629,6 +8447,9 @@ static void handle_key_release(xcb_key_release_event_t *e)
 
 	curscr->flags &= ~SCR_FLG_SWITCH_WINDOW;
 
+	if (mru_cycle_ && !cycle_key(e->detail))
+		end_cycle(1);
+
 	if (curscr->flags & SCR_FLG_CLIENT_RETAG) {
 		curscr->flags &= ~SCR_FLG_CLIENT_RETAG;
 		show_windows(curscr->tag, 1);
@@ -6682,11 +8503,13 @@ static void handle_visibility(xcb_visibility_notify_event_t *e)
 		list_walk(cur, &screens) {
 			struct screen *scr = list2screen(cur);
 
-			if (scr->panel.win != e->window) {
+			if (scr->panel.win != e->window)
 				continue;
-			} else if (scr->panel.visibility_state != e->state) {
+
+			/* back buffer survives obscuring, expose copies it */
+			if (scr->panel.buf == XCB_NONE &&
+			    scr->panel.visibility_state != e->state)
 				scr->panel.refresh = 1;
-			}
 
 			scr->panel.visibility_state = e->state;
 			break;
@@ -6704,15 +8527,22 @@ static void handle_exposure(xcb_expose_event_t *e)
 		list_walk(cur, &screens) {
 			struct screen *scr = list2screen(cur);
 
-			if (scr->panel.win != e->window) {
+			if (scr->panel.win != e->window)
 				continue;
-			} else if (scr->panel.refresh) {
-				struct client *cli = pointer2cli();
-				if (cli) {
-					unfocus_clients(scr->tag);
-					focus_window(cli->win);
-				}
 
+			xcb_rectangle_t rect = {
+				e->x, e->y, e->width, e->height,
+			};
+
+			/* back buffer has exposed area, otherwise it is lost */
+			if (scr->panel.buf != XCB_NONE) {
+				damage_panel(&scr->panel, &rect);
+			} else if (!e->count) {
+				scr->panel.stale = 1;
+				scr->panel.refresh = 1;
+			}
+
+			if (scr->panel.refresh) {
 				redraw_panel(scr, front_client(scr->tag), 0);
 				scr->panel.refresh = 0;
 			}
@@ -6721,9 +8551,18 @@ static void handle_exposure(xcb_expose_event_t *e)
 	}
 }
 
+static void handle_map_notify(xcb_map_notify_event_t *e)
+{
+	struct client *cli;
+
+	if ((cli = win2cli(e->window)))
+		cli->mapped = 1;
+}
+
 static void handle_unmap_notify(xcb_unmap_notify_event_t *e)
 {
 	struct list_head *cur;
+	struct client *cli;
 	xcb_window_t leader;
 
 	if (window_status(e->window) == WIN_STATUS_UNKNOWN) {
@@ -6732,6 +8571,9 @@ static void handle_unmap_notify(xcb_unmap_notify_event_t *e)
 		return;
 	}
 
+	if ((cli = win2cli(e->window)))
+		cli->mapped = 0;
+
 	if (!(leader = window_leader(e->window)))
 		return;
 
@@ -6793,17 +8635,20 @@ static void handle_wmname_cli(struct client *cli)
 	struct area area;
 
 	area.color = get_color(ALERT_BG);
+
+	if (!region_changed(&cli->tag->hash, region_hash(cli->tag->name,
+	    cli->tag->nlen, cli->tag->x, cli->tag->w, get_color(NOTICE_FG),
+	    area.color)))
+		return; /* already alerted */
+
 	area.rect.x = cli->tag->x;
 	area.rect.y = tag_rect_y;
 	area.rect.width = cli->tag->w;
 	area.rect.height = tag_rect_h;
-	clear_area(cli->scr->panel.win, cli->scr->panel.gc, &area);
-
-	set_text_str(cli->scr->panel.text, cli->tag->name, cli->tag->nlen);
-	set_text_pos(cli->scr->panel.text, cli->tag->x + tag_text_margin,
-	 panel_text_y);
-	set_text_color(cli->scr->panel.text, get_color(NOTICE_FG), area.color);
-	draw_panel_text(&cli->scr->panel, cli->scr->panel.text);
+	draw_panel_label(&cli->scr->panel, cli->scr->panel.text,
+			 cli->tag->name, cli->tag->nlen, &area,
+			 get_color(NOTICE_FG), tag_text_margin,
+			 panel_text_y - tag_rect_y);
 }
 
 static void handle_wmname(xcb_property_notify_event_t *e)
@@ -6818,11 +8663,10 @@ static void handle_wmname(xcb_property_notify_event_t *e)
  * 4. See current window gets title of window from another tag
  */
 	if (cli && cli->tag == curscr->tag) {
-		print_title(cli->scr, e->window);
-		xcb_flush(dpy);
+		cli->scr->panel.title_win = e->window;
+		cli->scr->panel.title_dirty = 1;
 	} else if (cli) {
-		handle_wmname_cli(cli);
-		xcb_flush(dpy);
+		handle_wmname_cli(cli); /* no-op if tag is already alerted */
 	}
 }
 
@@ -6882,8 +8726,80 @@ static void print_configure_notify(xcb_configure_notify_event_t *e)
 }
 #endif
 
+/* keep tag stacking in sync with restacks done by clients themselves */
+
+static inline uint8_t stack_sibling(struct client *cli, struct client *sib)
+{
+	return sib && sib != cli && sib->tag == cli->tag &&
+	       !(sib->flags & CLI_FLG_PANEL);
+}
+
+/* parked windows of other tags and unmanaged ones are stacked in between,
+ * so look for nearest window of the same tag below given one, NULL sibling
+ * means bottom of tag stack
+ */
+
+static int find_sibling(struct client *cli, xcb_window_t above,
+			struct client **sib)
+{
+	xcb_query_tree_cookie_t c;
+	xcb_query_tree_reply_t *tree;
+	xcb_window_t *wins;
+	int ret = -1;
+	int i;
+
+	c = xcb_query_tree(dpy, rootscr->root);
+	if (!(tree = xcb_query_tree_reply(dpy, c, 0))) {
+		ee("xcb_query_tree_reply(...) failed\n");
+		return -1;
+	}
+
+	wins = xcb_query_tree_children(tree);
+	i = xcb_query_tree_children_length(tree);
+
+	while (--i >= 0 && wins[i] != above)
+		;
+
+	if (i >= 0) /* sibling could be gone already */
+		ret = 0;
+
+	*sib = NULL;
+
+	while (--i >= 0) { /* children go from bottom to top */
+		if (stack_sibling(cli, (*sib = win2cli(wins[i]))))
+			break;
+		*sib = NULL;
+	}
+
+	free(tree);
+	return ret;
+}
+
+static void restack_client(struct client *cli, xcb_window_t above)
+{
+	struct client *sib = NULL;
+
+	if (above != XCB_WINDOW_NONE &&
+	    !stack_sibling(cli, (sib = win2cli(above)))) {
+		if (above == cli->above) /* moved or resized, no round-trip */
+			return;
+		else if (find_sibling(cli, above, &sib) < 0)
+			return;
+	}
+
+	cli->above = above;
+	list_del(&cli->head);
+
+	if (sib)
+		list_top(&sib->head, &cli->head);
+	else /* bottom of tag stack */
+		list_top(&cli->tag->clients, &cli->head);
+}
+
 static void handle_configure_notify(xcb_configure_notify_event_t *e)
 {
+	struct client *cli;
+
 	print_configure_notify(e);
 
 	if (e->event == rootscr->root && e->window == rootscr->root) {
@@ -6891,14 +8807,21 @@ static void handle_configure_notify(xcb_configure_notify_event_t *e)
 			set_root_brightness(0);
 			root_w = e->width;
 			root_h = e->height;
-			shutdown = true;
+			repark_clients();
+			shutdown_ = true;
 			ii("--> default screen wh (%u, %u)\n", defscr->w, defscr->h);
 			ii("--> root size changed wh (%u, %u)\n", e->width, e->height);
 			store_current_tag(time(NULL));
 		}
-	} else if (e->window != rootscr->root && e->border_width) {
-		border_width(e->window, BORDER_WIDTH);
-		xcb_flush(dpy);
+	} else if (e->window != rootscr->root) {
+		if ((cli = win2cli(e->window)) && cli->tag &&
+		    !(cli->flags & CLI_FLG_PANEL))
+			restack_client(cli, e->above_sibling);
+
+		if (e->border_width) {
+			border_width(e->window, BORDER_WIDTH);
+			xcb_flush(dpy);
+		}
 	}
 }
 
@@ -7046,6 +8969,9 @@ static void handle_configure_request(xcb_configure_request_event_t *e)
 		h = cli->h;
 	}
 
+	if ((cli = win2cli(e->window)) && cli->parked)
+		x = root_w; /* keep it off-screen until its tag is shown */
+
 	/* the order has to correspond to the order value_mask bits */
 	if (e->value_mask & XCB_CONFIG_WINDOW_X || e->x != x) {
 		val[i++] = x;
@@ -7074,7 +9000,12 @@ static void handle_configure_request(xcb_configure_request_event_t *e)
 		val[i++] = e->sibling;
 		mask |= XCB_CONFIG_WINDOW_SIBLING;
 	}
-	if (e->value_mask & XCB_CONFIG_WINDOW_STACK_MODE) {
+	if (cli && cli->parked) { /* add_window() would show it, no restack */
+		if (mask & XCB_CONFIG_WINDOW_SIBLING) { /* needs stack mode */
+			mask &= ~XCB_CONFIG_WINDOW_SIBLING;
+			i--;
+		}
+	} else if (e->value_mask & XCB_CONFIG_WINDOW_STACK_MODE) {
 		usleep(WIN_DELAY_US);
 		add_window(e->window, WIN_FLG_USER);
 		return;
@@ -7105,6 +9036,7 @@ static void handle_randr_notify(xcb_randr_screen_change_notify_event_t *e)
 static int handle_events(void)
 {
 	xcb_generic_event_t *e;
+	uint64_t start;
 	uint8_t type;
 
 	e = xcb_poll_for_event(dpy);
@@ -7115,6 +9047,12 @@ static int handle_events(void)
 	if (!e)
 		return 0;
 
+	start = time_ns();
+	replies_ = 0; /* drop round-trips made outside of event handlers */
+
+	if (trace_.f)
+		trace_event(e);
+
 	type = XCB_EVENT_RESPONSE_TYPE(e);
 	dd("got event %d (%d)\n", e->response_type, type);
 
@@ -7199,6 +9137,7 @@ static int handle_events(void)
 		   ((xcb_map_notify_event_t *) e)->event,
 		   ((xcb_map_notify_event_t *) e)->window,
 		   ((xcb_map_notify_event_t *) e)->override_redirect);
+		handle_map_notify((xcb_map_notify_event_t *) e);
 		break;
 	case XCB_MAP_REQUEST:
 		te("XCB_MAP_REQUEST: parent %#x, win %#x\n",
@@ -7237,11 +9176,12 @@ static int handle_events(void)
 		break;
 	}
 
-        if (type - randrbase == XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+        if (randrbase && type - randrbase == XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
 		ii("XCB_RANDR_SCREEN_CHANGE_NOTIFY\n");
 		handle_randr_notify((xcb_randr_screen_change_notify_event_t *) e);
 	}
 
+	account_event(type, start);
 	free(e);
 	return 1;
 }
@@ -7390,6 +9330,7 @@ static void init_homedir(void)
 enum fdtypes {
 	FD_SRV,
 	FD_CTL,
+	FD_SNAP,
 	FD_MAX,
 };
 
@@ -7402,6 +9343,45 @@ static int open_control(int fd)
 	return open_fifo(path, fd);
 }
 
+static int open_snapshot(void)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX, };
+	int fd;
+
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/.clients:%u",
+		 homedir, disp);
+	unlink(sa.sun_path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		ee("socket() failed, %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0 ||
+	    listen(fd, 4) < 0) {
+		ee("bind(%s) failed, %s\n", sa.sun_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	dd("open snapshot %s\n", sa.sun_path);
+	return fd;
+}
+
+static inline void handle_snapshot_event(struct pollfd *pfd)
+{
+	int fd;
+
+	if (pfd->revents & POLLIN) {
+		if ((fd = accept4(pfd->fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+			send_clients(fd);
+			close(fd);
+		}
+	}
+
+	pfd->revents = 0;
+}
+
 static inline void handle_server_event(struct pollfd *pfd)
 {
 	if (pfd->revents & POLLIN)
@@ -7410,10 +9390,27 @@ static inline void handle_server_event(struct pollfd *pfd)
 	pfd->revents = 0;
 }
 
+static void publish_panels(void)
+{
+	struct list_head *cur;
+	uint8_t flush = 0;
+
+	list_walk(cur, &screens) {
+		flush |= publish_panel(&list2screen(cur)->panel);
+	}
+
+	if (flush)
+		xcb_flush(dpy);
+}
+
 static inline void handle_control_event(struct pollfd *pfd)
 {
 	if (pfd->revents & POLLIN) {
+		uint64_t start = time_ns();
+
+		replies_ = 0;
 		handle_user_request(pfd->fd);
+		account_event(STATS_CONTROL, start);
 		pfd->fd = open_control(pfd->fd); /* and reset pipe */
 	}
 
@@ -7462,6 +9459,8 @@ int main()
 	}
 
 	init_homedir();
+	stats_since_ = time_ns();
+	park_ = getenv("FWM_PARK") != NULL;
 
 	if (signal(SIGCHLD, spawn_cleanup) == SIG_ERR)
 		panic("SIGCHLD handler failed\n");
@@ -7497,6 +9496,9 @@ int main()
 	init_outputs();
 	xcb_flush(dpy);
 
+	if (getenv("FWM_TRACE"))
+		start_trace(getenv("FWM_TRACE"));
+
 	autostart();
 
 	pfds[FD_SRV].fd = xcb_get_file_descriptor(dpy);
@@ -7507,15 +9509,22 @@ int main()
 	pfds[FD_CTL].events = POLLIN;
 	pfds[FD_CTL].revents = 0;
 
+	pfds[FD_SNAP].fd = open_snapshot();
+	pfds[FD_SNAP].events = POLLIN;
+	pfds[FD_SNAP].revents = 0;
+
 	root_fade_in(1000, NULL);
 	fresh_start = false;
 
 	ii("defscr %d curscr %d display %u\n", defscr->id, curscr->id, disp);
 	ii("enter events loop\n");
 
-	while (!shutdown) {
+	while (!shutdown_) {
+		int timeout = flush_titles();
+
+		publish_panels(); /* one blit per panel for whole batch */
 		errno = 0;
-		int rc = poll(pfds, ARRAY_SIZE(pfds), -1);
+		int rc = poll(pfds, ARRAY_SIZE(pfds), timeout);
 		if (rc == 0) { /* timeout */
 			/* TODO: some user-defined periodic task */
 		} else if (rc < 0) {
@@ -7528,12 +9537,16 @@ int main()
 
 		handle_server_event(&pfds[FD_SRV]);
 		handle_control_event(&pfds[FD_CTL]);
+		handle_snapshot_event(&pfds[FD_SNAP]);
 
 		if (logfile) {
 			fflush(stdout);
 			fflush(stderr);
 		}
 
+		if (trace_.f)
+			fflush(trace_.f);
+
 		/* FIXME: since ICCCM is not supported by intention this HACK
 		 * allows to discover clients that were created by group leaders;
 		 * for some reason xcb does not catch such events explicitly */
@@ -7544,8 +9557,10 @@ int main()
 		}
 	}
 
+	stop_trace();
 	store_current_tag(time(NULL));
 	store_clients();
+	unpark_clients();
 
 	xcb_set_input_focus(dpy, XCB_NONE, XCB_INPUT_FOCUS_POINTER_ROOT,
 			    XCB_CURRENT_TIME);
@@ -0,0 +1,1177 @@
+/* loadgen.c: synthetic client load for fwm benchmarks
+ *
+ * Runs scripted workloads against fwm on $DISPLAY and reads back event
+ * loop statistics which fwm writes to $FWM_HOME/tmp/stats on 'stats'
+ * request. Requests go through root window name so that they are ordered
+ * with the rest of the generated X traffic, stats dump is used as barrier.
+ *
+ * Replay workload recreates client side of a trace recorded by fwm, see
+ * trace.h, against fresh fwm.
+ *
+ * Copyright (c) 2017, Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * Released under the GNU General Public License, version 2
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+
+#include <X11/keysym.h>
+
+#include "misc.h"
+#include "trace.h"
+
+#define MAX_WINDOWS 1024
+#define STATS_BUCKETS 24 /* see account_event() in fwm.c */
+#define BARRIER_MS 10000
+#define DRAG_STEP 4
+#define DOCK_CLASS "bench-dock" /* registered by fwm-bench */
+#define CONTROL_RETRIES 1000 /* 1 ms apart */
+
+struct sum {
+	uint32_t events;
+	uint32_t replies;
+	uint32_t hist[STATS_BUCKETS];
+};
+
+struct run {
+	uint64_t start;
+	uint64_t cpu; /* fwm clock ticks */
+};
+
+struct map {
+	uint32_t from; /* recorded id */
+	uint32_t to;
+};
+
+struct ctx {
+	xcb_connection_t *dpy;
+	xcb_screen_t *scr;
+	xcb_window_t wins[MAX_WINDOWS];
+	uint16_t wins_num;
+	xcb_keycode_t mod;
+	xcb_keycode_t next_tag;
+	xcb_keycode_t grid;
+	xcb_keycode_t modkeys[8]; /* first keycode of each modifier */
+	xcb_atom_t a_net_wm_name;
+	xcb_atom_t a_net_wm_pid;
+	xcb_atom_t a_utf8;
+	const char *home;
+	char stats[255];
+	int inotify;
+	pid_t wm; /* fwm pid for cpu time */
+	const char *trace;
+	float speed; /* 0 replays as fast as possible */
+	struct map wmap[MAX_WINDOWS]; /* recorded to replayed windows */
+	uint16_t wmap_num;
+	struct map *amap; /* recorded to replayed atoms, grows as needed */
+	uint16_t amap_num;
+	uint16_t amap_max;
+	uint16_t n;
+};
+
+static int opt(const char *arg, const char *args, const char *argl)
+{
+	return (strcmp(arg, args) == 0 || strcmp(arg, argl) == 0);
+}
+
+static void help(const char *prog)
+{
+	printf("Usage: %s [options] [workload ...]\n"
+	 "\nWorkloads (all by default):\n"
+	 "  map      map and destroy n windows at once\n"
+	 "  title    change title of focused window n times\n"
+	 "  tags     cycle tags n times with mod+o\n"
+	 "  grid     make grid of 1, 2, 4 ... n windows with mod+f3\n"
+	 "  drag     drag window with mod+button1 for n motion events\n"
+	 "  dock     send n update-dock requests to own dock window\n"
+	 "  replay   replay trace given with -t\n"
+	 "\nOptions:\n"
+	 "  -n, --count <n>    workload size (default 100)\n"
+	 "  -P, --pid <pid>    fwm pid, to report its cpu time\n"
+	 "  -t, --trace <path> trace recorded with fwm trace-start\n"
+	 "  -x, --speed <f>    replay speed factor, 0 is no delays (default 1)\n"
+	 "  -h, --help         print this message\n"
+	 "\nEach workload prints one line of key=value pairs.\n\n", prog);
+}
+
+static uint64_t time_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/* utime + stime from /proc/<pid>/stat */
+
+static uint64_t cpu_ticks(pid_t pid)
+{
+	unsigned long long utime, stime;
+	char path[sizeof("/proc/2147483647/stat")];
+	char buf[512];
+	char *ptr;
+	ssize_t len;
+	int fd;
+
+	if (!pid)
+		return 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (len <= 0)
+		return 0;
+
+	buf[len] = '\0';
+
+	/* comm may contain spaces, skip past it; utime is 12th field after */
+	if (!(ptr = strrchr(buf, ')')))
+		return 0;
+	else if (sscanf(ptr + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+			"%llu %llu", &utime, &stime) != 2)
+		return 0;
+
+	return utime + stime;
+}
+
+static void request(struct ctx *ctx, const char *str)
+{
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE, ctx->scr->root,
+			    XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, strlen(str),
+			    str);
+	xcb_flush(ctx->dpy);
+}
+
+/* fwm handles events in order, so once stats file is written everything
+ * sent before the request has been handled too
+ */
+
+static int barrier(struct ctx *ctx, const char *req)
+{
+	char buf[sizeof(struct inotify_event) + 256];
+	struct pollfd pfd = { .fd = ctx->inotify, .events = POLLIN, };
+	struct inotify_event *e;
+	ssize_t len;
+	char *ptr;
+
+	while (read(ctx->inotify, buf, sizeof(buf)) > 0) {} /* stale */
+
+	request(ctx, req);
+
+	while (1) {
+		if (poll(&pfd, 1, BARRIER_MS) <= 0) {
+			ee("no reply to '%s' from fwm\n", req);
+			return -1;
+		}
+
+		if ((len = read(ctx->inotify, buf, sizeof(buf))) <= 0)
+			continue;
+
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(*e) + e->len) {
+			e = (struct inotify_event *) ptr;
+
+			if (e->len && strcmp(e->name, "stats") == 0)
+				return 0;
+		}
+	}
+}
+
+static int read_stats(struct ctx *ctx, struct sum *sum)
+{
+	unsigned int count, replies;
+	char line[512];
+	char *ptr;
+	uint8_t i;
+	int n;
+	FILE *f;
+
+	memset(sum, 0, sizeof(*sum));
+
+	if (!(f = fopen(ctx->stats, "r"))) {
+		ee("fopen(%s) failed, %s\n", ctx->stats, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		else if (sscanf(line, "%*s %u %u %*u %*u %*u %*u %n", &count,
+				&replies, &n) != 2)
+			continue;
+
+		sum->events += count;
+		sum->replies += replies;
+		ptr = line + n;
+
+		for (i = 0; i < STATS_BUCKETS && *ptr; i++) {
+			sum->hist[i] += strtoul(ptr, &ptr, 10);
+
+			if (*ptr == ',')
+				ptr++;
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static uint32_t percentile(struct sum *sum, uint8_t pct)
+{
+	uint64_t want = ((uint64_t) sum->events * pct + 99) / 100;
+	uint64_t acc = 0;
+	uint8_t i;
+
+	for (i = 0; i < STATS_BUCKETS - 1; i++) {
+		if ((acc += sum->hist[i]) >= want)
+			break;
+	}
+
+	return 1U << i;
+}
+
+static int begin(struct ctx *ctx, struct run *run)
+{
+	if (barrier(ctx, "stats reset") < 0)
+		return -1;
+
+	run->cpu = cpu_ticks(ctx->wm);
+	run->start = time_ns();
+	return 0;
+}
+
+static int end(struct ctx *ctx, struct run *run, const char *name,
+	       uint16_t n)
+{
+	uint64_t wall;
+	uint64_t cpu;
+	struct sum sum;
+
+	if (barrier(ctx, "stats") < 0 || read_stats(ctx, &sum) < 0)
+		return -1;
+
+	wall = time_ns() - run->start;
+	cpu = cpu_ticks(ctx->wm) - run->cpu;
+
+	printf("bench=%s n=%u wall_ms=%.3f events=%u events_per_s=%.0f "
+	       "p50_us=%u p99_us=%u replies=%u cpu_ms=%.1f\n", name, n,
+	       wall / 1e6, sum.events, sum.events * 1e9 / wall,
+	       percentile(&sum, 50), percentile(&sum, 99), sum.replies,
+	       cpu * 1000.0 / sysconf(_SC_CLK_TCK));
+	fflush(stdout);
+	return 0;
+}
+
+static xcb_atom_t getatom(xcb_connection_t *dpy, const char *name)
+{
+	xcb_intern_atom_cookie_t c;
+	xcb_intern_atom_reply_t *r;
+	xcb_atom_t atom = XCB_NONE;
+
+	c = xcb_intern_atom(dpy, 0, strlen(name), name);
+
+	if ((r = xcb_intern_atom_reply(dpy, c, NULL))) {
+		atom = r->atom;
+		free(r);
+	}
+
+	return atom;
+}
+
+static xcb_keycode_t keycode(struct ctx *ctx, xcb_keysym_t sym)
+{
+	const xcb_setup_t *setup = xcb_get_setup(ctx->dpy);
+	xcb_get_keyboard_mapping_cookie_t c;
+	xcb_get_keyboard_mapping_reply_t *r;
+	xcb_keycode_t code = 0;
+	xcb_keysym_t *syms;
+	int i, len;
+
+	c = xcb_get_keyboard_mapping(ctx->dpy, setup->min_keycode,
+				     setup->max_keycode - setup->min_keycode
+				     + 1);
+
+	if (!(r = xcb_get_keyboard_mapping_reply(ctx->dpy, c, NULL)))
+		return 0;
+
+	syms = xcb_get_keyboard_mapping_keysyms(r);
+	len = xcb_get_keyboard_mapping_keysyms_length(r);
+
+	for (i = 0; i < len; i++) {
+		if (syms[i] == sym) {
+			code = setup->min_keycode + i / r->keysyms_per_keycode;
+			break;
+		}
+	}
+
+	free(r);
+	return code;
+}
+
+static void init_modkeys(struct ctx *ctx)
+{
+	xcb_get_modifier_mapping_cookie_t c;
+	xcb_get_modifier_mapping_reply_t *r;
+	xcb_keycode_t *codes;
+	uint8_t i, j, n;
+
+	c = xcb_get_modifier_mapping(ctx->dpy);
+
+	if (!(r = xcb_get_modifier_mapping_reply(ctx->dpy, c, NULL)))
+		return;
+
+	codes = xcb_get_modifier_mapping_keycodes(r);
+	n = r->keycodes_per_modifier;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->modkeys); i++) {
+		for (j = 0; j < n && !ctx->modkeys[i]; j++)
+			ctx->modkeys[i] = codes[i * n + j];
+	}
+
+	free(r);
+}
+
+static void fake(struct ctx *ctx, uint8_t type, uint8_t detail, int16_t x,
+		 int16_t y)
+{
+	xcb_test_fake_input(ctx->dpy, type, detail, XCB_CURRENT_TIME,
+			    type == XCB_MOTION_NOTIFY ? ctx->scr->root : XCB_NONE,
+			    x, y, XCB_NONE);
+}
+
+static void press_key(struct ctx *ctx, xcb_keycode_t key)
+{
+	fake(ctx, XCB_KEY_PRESS, ctx->mod, 0, 0);
+	fake(ctx, XCB_KEY_PRESS, key, 0, 0);
+	fake(ctx, XCB_KEY_RELEASE, key, 0, 0);
+	fake(ctx, XCB_KEY_RELEASE, ctx->mod, 0, 0);
+}
+
+/* windows are mapped by fwm in reply to map request, wait till it did */
+
+static int wait_mapped(struct ctx *ctx, uint16_t count)
+{
+	struct pollfd pfd;
+	xcb_generic_event_t *e;
+
+	pfd.fd = xcb_get_file_descriptor(ctx->dpy);
+	pfd.events = POLLIN;
+
+	while (count) {
+		while (count && (e = xcb_poll_for_event(ctx->dpy))) {
+			if ((e->response_type & ~0x80) == XCB_MAP_NOTIFY)
+				count--;
+
+			free(e);
+		}
+
+		if (!count) {
+			break;
+		} else if (xcb_connection_has_error(ctx->dpy)) {
+			ee("connection to X server is lost\n");
+			return -1;
+		} else if (poll(&pfd, 1, BARRIER_MS) <= 0) {
+			ee("%u windows were not mapped\n", count);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void set_title(struct ctx *ctx, xcb_window_t win, const char *str)
+{
+	uint16_t len = strlen(str);
+
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE, win,
+			    XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, len, str);
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE, win,
+			    ctx->a_net_wm_name, ctx->a_utf8, 8, len, str);
+}
+
+static int add_windows(struct ctx *ctx, uint16_t count)
+{
+	uint32_t val[2] = { ctx->scr->white_pixel,
+			    XCB_EVENT_MASK_STRUCTURE_NOTIFY, };
+	uint16_t i, from = ctx->wins_num;
+	char title[sizeof("loadgen 65535")];
+	xcb_window_t win;
+
+	if (from + count > MAX_WINDOWS)
+		count = MAX_WINDOWS - from;
+
+	for (i = 0; i < count; i++) {
+		win = xcb_generate_id(ctx->dpy);
+		xcb_create_window(ctx->dpy, XCB_COPY_FROM_PARENT, win,
+				  ctx->scr->root, 0, 0, 200, 100, 0,
+				  XCB_WINDOW_CLASS_INPUT_OUTPUT,
+				  ctx->scr->root_visual,
+				  XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, val);
+		snprintf(title, sizeof(title), "loadgen %u", from + i);
+		set_title(ctx, win, title);
+		ctx->wins[ctx->wins_num++] = win;
+	}
+
+	for (i = from; i < ctx->wins_num; i++)
+		xcb_map_window(ctx->dpy, ctx->wins[i]);
+
+	xcb_flush(ctx->dpy);
+	return wait_mapped(ctx, count);
+}
+
+static void del_windows(struct ctx *ctx)
+{
+	while (ctx->wins_num)
+		xcb_destroy_window(ctx->dpy, ctx->wins[--ctx->wins_num]);
+
+	xcb_flush(ctx->dpy);
+}
+
+static int bench_map(struct ctx *ctx)
+{
+	struct run run;
+	int ret;
+
+	if (begin(ctx, &run) < 0)
+		return -1;
+
+	ret = add_windows(ctx, ctx->n);
+	del_windows(ctx);
+
+	if (ret < 0)
+		return -1;
+
+	return end(ctx, &run, "map", ctx->n);
+}
+
+static int bench_title(struct ctx *ctx)
+{
+	char title[sizeof("loadgen title 65535")];
+	struct run run;
+	uint16_t i;
+
+	if (add_windows(ctx, 1) < 0 || begin(ctx, &run) < 0)
+		goto err;
+
+	for (i = 0; i < ctx->n; i++) {
+		snprintf(title, sizeof(title), "loadgen title %u", i);
+		set_title(ctx, ctx->wins[0], title);
+		xcb_flush(ctx->dpy);
+	}
+
+	if (end(ctx, &run, "title", ctx->n) < 0)
+		goto err;
+
+	del_windows(ctx);
+	return 0;
+err:
+	del_windows(ctx);
+	return -1;
+}
+
+static int bench_tags(struct ctx *ctx)
+{
+	struct run run;
+	uint16_t i;
+
+	if (!ctx->next_tag) {
+		ww("no keycode for next tag key, skip tags\n");
+		return 0;
+	}
+
+	if (add_windows(ctx, 4) < 0 || begin(ctx, &run) < 0)
+		goto err;
+
+	for (i = 0; i < ctx->n; i++)
+		press_key(ctx, ctx->next_tag);
+
+	xcb_flush(ctx->dpy);
+
+	if (end(ctx, &run, "tags", ctx->n) < 0)
+		goto err;
+
+	del_windows(ctx);
+	return 0;
+err:
+	del_windows(ctx);
+	return -1;
+}
+
+static int bench_grid(struct ctx *ctx)
+{
+	struct run run;
+	uint16_t count;
+
+	if (!ctx->grid) {
+		ww("no keycode for grid key, skip grid\n");
+		return 0;
+	}
+
+	for (count = 1; count <= ctx->n; count *= 2) {
+		if (add_windows(ctx, count - ctx->wins_num) < 0)
+			goto err;
+		else if (begin(ctx, &run) < 0)
+			goto err;
+
+		press_key(ctx, ctx->grid);
+		xcb_flush(ctx->dpy);
+
+		if (end(ctx, &run, "grid", count) < 0)
+			goto err;
+	}
+
+	del_windows(ctx);
+	return 0;
+err:
+	del_windows(ctx);
+	return -1;
+}
+
+static int bench_drag(struct ctx *ctx)
+{
+	int16_t x = ctx->scr->width_in_pixels / 4;
+	int16_t y = ctx->scr->height_in_pixels / 4;
+	struct run run;
+	uint16_t i;
+
+	if (add_windows(ctx, 1) < 0)
+		goto err;
+
+	/* windows may be placed anywhere, put it under the pointer */
+	xcb_configure_window(ctx->dpy, ctx->wins[0],
+			     XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y,
+			     (uint32_t []) { x - 100, y - 50, });
+	fake(ctx, XCB_MOTION_NOTIFY, 0, x, y);
+
+	if (begin(ctx, &run) < 0)
+		goto err;
+
+	fake(ctx, XCB_KEY_PRESS, ctx->mod, 0, 0);
+	fake(ctx, XCB_BUTTON_PRESS, XCB_BUTTON_INDEX_1, 0, 0);
+
+	for (i = 0; i < ctx->n; i++) {
+		x += i & 0x40 ? -DRAG_STEP : DRAG_STEP;
+		fake(ctx, XCB_MOTION_NOTIFY, 0, x, y);
+	}
+
+	fake(ctx, XCB_BUTTON_RELEASE, XCB_BUTTON_INDEX_1, 0, 0);
+	fake(ctx, XCB_KEY_RELEASE, ctx->mod, 0, 0);
+	xcb_flush(ctx->dpy);
+
+	if (end(ctx, &run, "drag", ctx->n) < 0)
+		goto err;
+
+	del_windows(ctx);
+	return 0;
+err:
+	del_windows(ctx);
+	return -1;
+}
+
+/* fwm forwards update to dock window as client message when dock has no
+ * ring, so loadgen poses as dock and waits for each message in turn
+ */
+
+static int wait_message(struct ctx *ctx)
+{
+	struct pollfd pfd;
+	xcb_generic_event_t *e;
+	uint8_t type;
+
+	pfd.fd = xcb_get_file_descriptor(ctx->dpy);
+	pfd.events = POLLIN;
+
+	while (1) {
+		while ((e = xcb_poll_for_event(ctx->dpy))) {
+			type = e->response_type & ~0x80;
+			free(e);
+
+			if (type == XCB_CLIENT_MESSAGE)
+				return 0;
+		}
+
+		if (xcb_connection_has_error(ctx->dpy)) {
+			ee("connection to X server is lost\n");
+			return -1;
+		} else if (poll(&pfd, 1, BARRIER_MS) <= 0) {
+			ee("no dock update from fwm\n");
+			return -1;
+		}
+	}
+}
+
+static int bench_dock(struct ctx *ctx)
+{
+	char req[sizeof("update-dock 2147483647 x 0xffffff")];
+	uint32_t pid = getpid();
+	struct run run;
+	uint16_t i;
+
+	ctx->wins[ctx->wins_num] = xcb_generate_id(ctx->dpy);
+	xcb_create_window(ctx->dpy, XCB_COPY_FROM_PARENT,
+			  ctx->wins[ctx->wins_num], ctx->scr->root, 0, 0, 20,
+			  20, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+			  ctx->scr->root_visual, XCB_CW_EVENT_MASK,
+			  (uint32_t []) { XCB_EVENT_MASK_STRUCTURE_NOTIFY, });
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE,
+			    ctx->wins[ctx->wins_num], XCB_ATOM_WM_CLASS,
+			    XCB_ATOM_STRING, 8, sizeof(DOCK_CLASS) - 1,
+			    DOCK_CLASS);
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE,
+			    ctx->wins[ctx->wins_num], ctx->a_net_wm_pid,
+			    XCB_ATOM_CARDINAL, 32, 1, &pid);
+	xcb_map_window(ctx->dpy, ctx->wins[ctx->wins_num++]);
+	xcb_flush(ctx->dpy);
+
+	if (wait_mapped(ctx, 1) < 0 || begin(ctx, &run) < 0)
+		goto err;
+
+	for (i = 0; i < ctx->n; i++) {
+		snprintf(req, sizeof(req), "update-dock %u x %#x", pid,
+			 i & 1 ? 0x808080 : 0xc0c0c0);
+		request(ctx, req);
+
+		if (wait_message(ctx) < 0)
+			goto err;
+	}
+
+	if (end(ctx, &run, "dock", ctx->n) < 0)
+		goto err;
+
+	del_windows(ctx);
+	return 0;
+err:
+	del_windows(ctx);
+	return -1;
+}
+
+/* control requests go through fifo so that they do not overwrite each
+ * other like root window name does; fwm re-creates fifo after each
+ * request, so wait until data is read and old fifo is closed
+ */
+
+static int control(struct ctx *ctx, const char *req, uint8_t len)
+{
+	char path[sizeof(ctx->stats)];
+	const char *disp = getenv("DISPLAY");
+	struct pollfd pfd = { .events = POLLOUT, };
+	uint16_t i;
+	int fd, n;
+
+	snprintf(path, sizeof(path), "%s/.control%s", ctx->home,
+		 disp ? disp : ":0");
+
+	for (i = 0; (fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0;
+	     i++) {
+		if ((errno != ENXIO && errno != ENOENT) || i == CONTROL_RETRIES) {
+			ee("open(%s) failed, %s\n", path, strerror(errno));
+			return -1;
+		}
+
+		usleep(1000);
+	}
+
+	if (write(fd, req, len) != len) {
+		ee("write(%s) failed, %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	while (ioctl(fd, FIONREAD, &n) == 0 && n > 0)
+		usleep(100);
+
+	/* write end reports error once there are no readers */
+	for (i = 0, pfd.fd = fd; i < CONTROL_RETRIES; i++) {
+		if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLERR))
+			break;
+
+		usleep(1000);
+	}
+
+	close(fd);
+
+	if (i == CONTROL_RETRIES) {
+		ee("fwm did not re-open %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint32_t lookup(struct map *map, uint16_t num, uint32_t from)
+{
+	for (uint16_t i = 0; i < num; i++) {
+		if (map[i].from == from)
+			return map[i].to;
+	}
+
+	return XCB_NONE;
+}
+
+static xcb_window_t replay_window(struct ctx *ctx, struct trace_header *hdr,
+				  xcb_window_t from, int16_t x, int16_t y,
+				  uint16_t w, uint16_t h, uint8_t redirect)
+{
+	uint32_t val[3] = { ctx->scr->white_pixel, redirect,
+			    XCB_EVENT_MASK_STRUCTURE_NOTIFY, };
+	xcb_window_t win;
+
+	if ((from & ~hdr->resource_mask) == hdr->resource_base)
+		return XCB_NONE; /* window of fwm itself */
+	else if ((win = lookup(ctx->wmap, ctx->wmap_num, from)))
+		return win;
+	else if (ctx->wmap_num == MAX_WINDOWS || ctx->wins_num == MAX_WINDOWS)
+		return XCB_NONE;
+
+	win = xcb_generate_id(ctx->dpy);
+	xcb_create_window(ctx->dpy, XCB_COPY_FROM_PARENT, win, ctx->scr->root,
+			  x, y, w ? w : 200, h ? h : 100, 0,
+			  XCB_WINDOW_CLASS_INPUT_OUTPUT, ctx->scr->root_visual,
+			  XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT |
+			  XCB_CW_EVENT_MASK, val);
+	ctx->wmap[ctx->wmap_num].from = from;
+	ctx->wmap[ctx->wmap_num++].to = win;
+	ctx->wins[ctx->wins_num++] = win;
+	return win;
+}
+
+static void forget_window(struct ctx *ctx, xcb_window_t win)
+{
+	uint16_t i;
+
+	for (i = 0; i < ctx->wmap_num; i++) {
+		if (ctx->wmap[i].to == win)
+			ctx->wmap[i] = ctx->wmap[--ctx->wmap_num];
+	}
+
+	for (i = 0; i < ctx->wins_num; i++) {
+		if (ctx->wins[i] == win)
+			ctx->wins[i] = ctx->wins[--ctx->wins_num];
+	}
+}
+
+static uint32_t replay_atom(struct ctx *ctx, xcb_atom_t atom)
+{
+	if (atom <= XCB_ATOM_WM_TRANSIENT_FOR)
+		return atom;
+
+	return lookup(ctx->amap, ctx->amap_num, atom);
+}
+
+static void replay_configure(struct ctx *ctx, struct trace_header *hdr,
+			     xcb_configure_request_event_t *e)
+{
+	uint16_t mask = e->value_mask;
+	uint32_t val[7];
+	uint8_t i = 0;
+	xcb_window_t win;
+
+	if (!(win = replay_window(ctx, hdr, e->window, e->x, e->y, e->width,
+				  e->height, 0)))
+		return;
+
+	if (mask & XCB_CONFIG_WINDOW_X)
+		val[i++] = e->x;
+	if (mask & XCB_CONFIG_WINDOW_Y)
+		val[i++] = e->y;
+	if (mask & XCB_CONFIG_WINDOW_WIDTH)
+		val[i++] = e->width;
+	if (mask & XCB_CONFIG_WINDOW_HEIGHT)
+		val[i++] = e->height;
+	if (mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)
+		val[i++] = e->border_width;
+	if (mask & XCB_CONFIG_WINDOW_SIBLING) {
+		if ((val[i] = lookup(ctx->wmap, ctx->wmap_num, e->sibling)))
+			i++;
+		else
+			mask &= ~(XCB_CONFIG_WINDOW_SIBLING |
+				  XCB_CONFIG_WINDOW_STACK_MODE);
+	}
+	if (mask & XCB_CONFIG_WINDOW_STACK_MODE)
+		val[i++] = e->stack_mode;
+
+	xcb_configure_window(ctx->dpy, win, mask, val);
+}
+
+/* only titles are replayed, values of other properties are not traced */
+
+static void replay_property(struct ctx *ctx, xcb_property_notify_event_t *e,
+			    uint32_t seq)
+{
+	char title[sizeof("replay 4294967295")];
+	xcb_atom_t atom = replay_atom(ctx, e->atom);
+	xcb_window_t win;
+
+	if (atom != XCB_ATOM_WM_NAME && atom != ctx->a_net_wm_name)
+		return;
+	else if (e->state != XCB_PROPERTY_NEW_VALUE)
+		return;
+	else if (!(win = lookup(ctx->wmap, ctx->wmap_num, e->window)))
+		return; /* root name carries control requests, traced apart */
+
+	snprintf(title, sizeof(title), "replay %u", seq);
+	xcb_change_property(ctx->dpy, XCB_PROP_MODE_REPLACE, win, atom,
+			    atom == XCB_ATOM_WM_NAME ? XCB_ATOM_STRING :
+			    ctx->a_utf8, 8, strlen(title), title);
+}
+
+static void replay_message(struct ctx *ctx, xcb_client_message_event_t *e)
+{
+	xcb_client_message_event_t msg = *e;
+	uint32_t val;
+	uint8_t i;
+
+	msg.response_type = XCB_CLIENT_MESSAGE;
+
+	if (!(msg.window = lookup(ctx->wmap, ctx->wmap_num, e->window)) ||
+	    !(msg.type = replay_atom(ctx, e->type)))
+		return;
+
+	for (i = 0; e->format == 32 && i < 5; i++) {
+		if ((val = lookup(ctx->wmap, ctx->wmap_num, e->data.data32[i])) ||
+		    (val = lookup(ctx->amap, ctx->amap_num, e->data.data32[i])))
+			msg.data.data32[i] = val;
+	}
+
+	xcb_send_event(ctx->dpy, 0, ctx->scr->root,
+		       XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+		       XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY, (const char *) &msg);
+}
+
+/* grabs only match with modifiers held, which fwm does not see pressed */
+
+static void fake_mods(struct ctx *ctx, uint16_t state, uint8_t type)
+{
+	state &= ~(XCB_MOD_MASK_LOCK | XCB_MOD_MASK_2); /* keep locks as is */
+
+	for (uint8_t i = 0; i < ARRAY_SIZE(ctx->modkeys); i++) {
+		if ((state & (1 << i)) && ctx->modkeys[i])
+			fake(ctx, type, ctx->modkeys[i], 0, 0);
+	}
+}
+
+static void replay_event(struct ctx *ctx, struct trace_header *hdr,
+			 xcb_generic_event_t *e, uint32_t seq)
+{
+	xcb_window_t win;
+	union {
+		xcb_generic_event_t *e;
+		xcb_create_notify_event_t *create;
+		xcb_map_request_event_t *map;
+		xcb_destroy_notify_event_t *destroy;
+		xcb_key_press_event_t *input;
+	} u = { .e = e, };
+
+	switch (e->response_type & ~0x80) {
+	case XCB_CREATE_NOTIFY:
+		replay_window(ctx, hdr, u.create->window, u.create->x,
+			      u.create->y, u.create->width, u.create->height,
+			      u.create->override_redirect);
+		break;
+	case XCB_MAP_REQUEST:
+		if ((win = replay_window(ctx, hdr, u.map->window, 0, 0, 0, 0,
+					 0)))
+			xcb_map_window(ctx->dpy, win);
+		break;
+	case XCB_DESTROY_NOTIFY:
+		if ((win = lookup(ctx->wmap, ctx->wmap_num,
+				  u.destroy->window))) {
+			xcb_destroy_window(ctx->dpy, win);
+			forget_window(ctx, win);
+		}
+		break;
+	case XCB_CONFIGURE_REQUEST:
+		replay_configure(ctx, hdr, (xcb_configure_request_event_t *) e);
+		break;
+	case XCB_PROPERTY_NOTIFY:
+		replay_property(ctx, (xcb_property_notify_event_t *) e, seq);
+		break;
+	case XCB_CLIENT_MESSAGE:
+		replay_message(ctx, (xcb_client_message_event_t *) e);
+		break;
+	case XCB_KEY_PRESS:
+		fake_mods(ctx, u.input->state, XCB_KEY_PRESS);
+		fake(ctx, XCB_KEY_PRESS, u.input->detail, 0, 0);
+		fake_mods(ctx, u.input->state, XCB_KEY_RELEASE);
+		break;
+	case XCB_KEY_RELEASE:
+		fake(ctx, XCB_KEY_RELEASE, u.input->detail, 0, 0);
+		break;
+	case XCB_BUTTON_PRESS:
+		fake(ctx, XCB_MOTION_NOTIFY, 0, u.input->root_x,
+		     u.input->root_y);
+		fake_mods(ctx, u.input->state, XCB_KEY_PRESS);
+		fake(ctx, XCB_BUTTON_PRESS, u.input->detail, 0, 0);
+		fake_mods(ctx, u.input->state, XCB_KEY_RELEASE);
+		break;
+	case XCB_BUTTON_RELEASE:
+		fake(ctx, XCB_MOTION_NOTIFY, 0, u.input->root_x,
+		     u.input->root_y);
+		fake(ctx, XCB_BUTTON_RELEASE, u.input->detail, 0, 0);
+		break;
+	case XCB_MOTION_NOTIFY:
+		fake(ctx, XCB_MOTION_NOTIFY, 0, u.input->root_x,
+		     u.input->root_y);
+		break;
+	default: /* consequences of replayed requests or server state */
+		break;
+	}
+}
+
+static int replay_atom_name(struct ctx *ctx, uint8_t *data, uint8_t len)
+{
+	xcb_intern_atom_cookie_t c;
+	xcb_intern_atom_reply_t *r;
+	xcb_atom_t atom;
+	struct map *tmp;
+
+	if (len <= sizeof(atom))
+		return 0;
+
+	if (ctx->amap_num == ctx->amap_max) {
+		uint16_t max = ctx->amap_max ? ctx->amap_max * 2 : 64;
+
+		if (max <= ctx->amap_max) {
+			errno = 0;
+			ee("too many atoms in trace\n");
+			return -1;
+		} else if (!(tmp = realloc(ctx->amap, max * sizeof(*tmp)))) {
+			ee("realloc(%zu) failed\n", max * sizeof(*tmp));
+			return -1;
+		}
+
+		ctx->amap = tmp;
+		ctx->amap_max = max;
+	}
+
+	memcpy(&atom, data, sizeof(atom));
+	c = xcb_intern_atom(ctx->dpy, 0, len - sizeof(atom),
+			    (char *) data + sizeof(atom));
+
+	if ((r = xcb_intern_atom_reply(ctx->dpy, c, NULL))) {
+		ctx->amap[ctx->amap_num].from = atom;
+		ctx->amap[ctx->amap_num++].to = r->atom;
+		free(r);
+	}
+
+	return 0;
+}
+
+static void pace(struct timespec *at, uint32_t delta_us, float speed)
+{
+	uint64_t ns;
+
+	if (speed <= 0)
+		return;
+
+	ns = at->tv_nsec + (uint64_t) (delta_us * 1000.0 / speed);
+	at->tv_sec += ns / 1000000000;
+	at->tv_nsec = ns % 1000000000;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, at, NULL);
+}
+
+static int bench_replay(struct ctx *ctx)
+{
+	struct trace_header hdr;
+	struct trace_record rec;
+	uint8_t data[UINT8_MAX + 1];
+	struct timespec at;
+	uint32_t seq = 0;
+	struct run run;
+	FILE *f;
+	int ret = -1;
+
+	if (!ctx->trace)
+		return 0; /* only on demand */
+
+	if (!(f = fopen(ctx->trace, "r"))) {
+		ee("fopen(%s) failed, %s\n", ctx->trace, strerror(errno));
+		return -1;
+	} else if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+		   hdr.magic != TRACE_MAGIC || hdr.version != TRACE_VERSION) {
+		ee("%s is not fwm trace\n", ctx->trace);
+		goto out;
+	} else if (begin(ctx, &run) < 0) {
+		goto out;
+	}
+
+	if (hdr.root_w != ctx->scr->width_in_pixels ||
+	    hdr.root_h != ctx->scr->height_in_pixels)
+		ww("trace was recorded on %ux%u screen\n", hdr.root_w,
+		   hdr.root_h);
+
+	clock_gettime(CLOCK_MONOTONIC, &at);
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (rec.len && fread(data, rec.len, 1, f) != 1)
+			break;
+
+		pace(&at, rec.delta_us, ctx->speed);
+		seq++;
+
+		if (rec.type == TRACE_REC_ATOM) {
+			if (replay_atom_name(ctx, data, rec.len) < 0)
+				goto out;
+		} else if (rec.type == TRACE_REC_EVENT) {
+			if (rec.len == TRACE_EVENT_LEN)
+				replay_event(ctx, &hdr,
+					     (xcb_generic_event_t *) data, seq);
+		} else if (rec.type == TRACE_REC_CONTROL) {
+			xcb_flush(ctx->dpy); /* keep order with X traffic */
+
+			if (strncmp((char *) data, "trace-", 6) == 0 ||
+			    strncmp((char *) data, "stats", 5) == 0)
+				continue;
+			else if (control(ctx, (char *) data, rec.len) < 0)
+				goto out;
+		}
+
+		xcb_flush(ctx->dpy);
+	}
+
+	ret = end(ctx, &run, "replay", seq);
+out:
+	del_windows(ctx);
+	ctx->wmap_num = 0;
+	free(ctx->amap);
+	ctx->amap = NULL;
+	ctx->amap_num = ctx->amap_max = 0;
+	fclose(f);
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	int (*fn)(struct ctx *);
+} benches[] = {
+	{ "map", bench_map, },
+	{ "title", bench_title, },
+	{ "tags", bench_tags, },
+	{ "grid", bench_grid, },
+	{ "drag", bench_drag, },
+	{ "dock", bench_dock, },
+	{ "replay", bench_replay, },
+};
+
+static int init(struct ctx *ctx)
+{
+	char path[sizeof(ctx->stats)];
+
+	if (!(ctx->home = getenv("FWM_HOME"))) {
+		ee("FWM_HOME variable is not set\n");
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/tmp", ctx->home);
+	snprintf(ctx->stats, sizeof(ctx->stats), "%s/stats", path);
+
+	if ((ctx->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+		ee("inotify_init1() failed, %s\n", strerror(errno));
+		return -1;
+	} else if (inotify_add_watch(ctx->inotify, path, IN_CLOSE_WRITE) < 0) {
+		ee("inotify_add_watch(%s) failed, %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	ctx->dpy = xcb_connect(NULL, NULL);
+
+	if (xcb_connection_has_error(ctx->dpy)) {
+		ee("xcb_connect() failed\n");
+		return -1;
+	}
+
+	ctx->scr = xcb_setup_roots_iterator(xcb_get_setup(ctx->dpy)).data;
+	ctx->a_net_wm_name = getatom(ctx->dpy, "_NET_WM_NAME");
+	ctx->a_net_wm_pid = getatom(ctx->dpy, "_NET_WM_PID");
+	ctx->a_utf8 = getatom(ctx->dpy, "UTF8_STRING");
+	ctx->mod = keycode(ctx, XK_Alt_L); /* MOD in fwm.c */
+	ctx->next_tag = keycode(ctx, XK_o);
+	ctx->grid = keycode(ctx, XK_F3);
+	init_modkeys(ctx);
+
+	if (!ctx->mod) {
+		ee("no keycode for Alt_L\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ctx ctx = { .n = 100, .speed = 1, };
+	const char *only[ARRAY_SIZE(benches)];
+	uint8_t only_num = 0;
+	int i, j, ret = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (opt(argv[i], "-h", "--help")) {
+			help(argv[0]);
+			return 0;
+		} else if (argv[i][0] != '-') {
+			if (only_num < ARRAY_SIZE(only))
+				only[only_num++] = argv[i];
+			continue;
+		} else if (i + 1 >= argc) {
+			help(argv[0]);
+			return 1;
+		} else if (opt(argv[i], "-n", "--count")) {
+			ctx.n = atoi(argv[++i]);
+		} else if (opt(argv[i], "-P", "--pid")) {
+			ctx.wm = atoi(argv[++i]);
+		} else if (opt(argv[i], "-t", "--trace")) {
+			ctx.trace = argv[++i];
+		} else if (opt(argv[i], "-x", "--speed")) {
+			ctx.speed = atof(argv[++i]);
+		} else {
+			help(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!ctx.n || ctx.n > MAX_WINDOWS) {
+		ee("count must be 1..%u\n", MAX_WINDOWS);
+		return 1;
+	}
+
+	if (init(&ctx) < 0)
+		goto out;
+
+	for (i = 0; i < (int) ARRAY_SIZE(benches); i++) {
+		for (j = 0; j < only_num; j++) {
+			if (strcmp(only[j], benches[i].name) == 0)
+				break;
+		}
+
+		if (only_num && j == only_num)
+			continue;
+		else if (benches[i].fn(&ctx) < 0)
+			goto out;
+	}
+
+	ret = 0;
+out:
+	if (ctx.dpy)
+		xcb_disconnect(ctx.dpy);
+
+	if (ctx.inotify > 0)
+		close(ctx.inotify);
+
+	return ret;
+}
@@ -13,17 +13,23 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <poll.h>
 
 #include <math.h>
 
 #include <xcb/xcb.h>
 #include <xcb/xcb_keysyms.h>
+#include <xcb/xkb.h>
 
 #include <xkbcommon/xkbcommon.h>
 #include <xkbcommon/xkbcommon-x11.h>
@@ -53,10 +59,61 @@
 #define COLOR_DISTANCE 10
 
 #define PROMPT_LEN 2
+#define MAX_PATH 255
 
 #define DEFAULT_FONT_SIZE 10.5
 #define DEFAULT_DPI 96
 
+#define DEFAULT_ROWS_PER_PAGE 25
+
+#define PAGE_CACHE_SIZE 4
+
+#define MENU_JOB_MAX 4096 /* cwd and argv strings */
+#define MENU_ARGS_MAX 64
+
+struct menu_job {
+	uint32_t size; /* payload bytes */
+	uint32_t pid;
+};
+
+#define INDEX_MAGIC 0x494d5746 /* FWMI */
+#define INDEX_VERSION 1
+
+enum index_flags {
+	INDEX_FLG_WIDTHS = (1 << 0),
+	INDEX_FLG_KEYS = (1 << 1),
+};
+
+/* pre-indexed menu file layout, all offsets are relative to file start:
+ *
+ * header
+ * uint32_t rows_off[rows + 1]   row start in heap, last is heap size
+ * uint16_t cols_off[rows * cols] column start relative to row start
+ * uint16_t px[cols], uint8_t len[cols] column widths (INDEX_FLG_WIDTHS)
+ * uint32_t keys[rows]           rows sorted by key column (INDEX_FLG_KEYS)
+ * heap                          original tab-separated text
+ */
+
+struct index_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t rows;
+	uint16_t row_max_len;
+	uint8_t cols;
+	uint8_t key_col;
+	uint16_t hdpi; /* widths were measured with these */
+	uint16_t vdpi;
+	float font_size;
+	uint32_t font_crc;
+	uint32_t rows_off;
+	uint32_t cols_off;
+	uint32_t widths_off;
+	uint32_t keys_off;
+	uint32_t heap_off;
+	uint32_t heap_size;
+};
+
 struct text_info {
 	fontid_t font_id;
 	struct text *txt;
@@ -74,9 +131,14 @@ struct ctx {
 	const char *path;
 	xcb_drawable_t win;
 	xcb_gcontext_t gc;
+	xcb_atom_t pid_atom;
+	xcb_atom_t active_atom;
 	xcb_key_symbols_t *syms;
 	struct xkb_context *xkb;
 	struct xkb_keymap *keymap;
+	uint8_t xkb_event;
+	uint8_t xkb_stale;
+	xcb_atom_t rules_atom;
 	uint16_t w;
 	uint16_t h;
 	uint32_t fg;
@@ -111,7 +173,7 @@ static uint16_t page_w_;
 static uint16_t page_h_;
 
 static uint8_t row_len_; /* characters */
-static uint8_t rows_per_page_ = 25;
+static uint8_t rows_per_page_ = DEFAULT_ROWS_PER_PAGE;
 static uint8_t pages_num_;
 static uint8_t rows_rem_;
 
@@ -122,6 +184,19 @@ struct page {
 
 static struct page pages_[UCHAR_MAX + 1];
 
+struct page_cache {
+	xcb_pixmap_t norm; /* all rows unselected */
+	xcb_pixmap_t sel; /* selected rows, rendered on demand */
+	uint32_t selmask[(UCHAR_MAX + 1) / 32];
+	uint32_t stamp;
+	uint8_t page;
+	uint8_t valid;
+};
+
+static struct page_cache page_cache_[PAGE_CACHE_SIZE];
+static struct page_cache *curpage_;
+static uint32_t page_stamp_;
+
 static uint8_t search_bar_;
 static uint8_t append_;
 static uint8_t print_input_;
@@ -154,6 +229,13 @@ static char data_buf_[128];
 static char *data_;
 static size_t data_size_;
 
+static struct index_hdr *index_;
+static size_t index_size_;
+static uint32_t *rows_off_;
+static uint16_t *cols_off_;
+static uint32_t *keys_;
+static const char *index_out_;
+
 static struct row *selrow_;
 static struct row *rows_;
 
@@ -199,15 +281,15 @@ static void get_space_width(fontid_t font_id)
 	destroy_text(&text);
 }
 
-static void fill_rect(uint32_t c, int16_t x, int16_t y, uint16_t w, uint16_t h)
+static void fill_rect(xcb_drawable_t d, uint32_t c, int16_t x, int16_t y,
+ uint16_t w, uint16_t h)
 {
 	xcb_rectangle_t rect = { x, y, w, h, };
 	xcb_change_gc(ctx_.dpy, ctx_.gc, XCB_GC_FOREGROUND, &c);
-	xcb_poly_fill_rectangle(ctx_.dpy, ctx_.win, ctx_.gc, 1, &rect);
-	xcb_flush(ctx_.dpy);
+	xcb_poly_fill_rectangle(ctx_.dpy, d, ctx_.gc, 1, &rect);
 }
 
-static int16_t draw_rect(uint8_t idx, uint8_t focus)
+static int16_t draw_rect(xcb_drawable_t d, uint8_t idx, uint8_t focus)
 {
 	int16_t y = idx * ctx_.row_h + y_pad_;
 	uint32_t bg;
@@ -220,20 +302,20 @@ static int16_t draw_rect(uint8_t idx, uint8_t focus)
 		     ((bg & 0xff) + COLOR_DISTANCE);
 	}
 
-	fill_rect(bg, x_pad_, y, page_w_, ctx_.row_h);
+	fill_rect(d, bg, x_pad_, y, page_w_, ctx_.row_h);
 	ctx_.curbg = bg;
 	return y;
 }
 
-static int16_t draw_col(struct column *col, uint8_t i, int16_t x, int16_t y,
- uint8_t focus)
+static int16_t draw_col(xcb_drawable_t d, struct column *col, uint8_t i,
+ int16_t x, int16_t y, uint8_t focus)
 {
 	uint16_t w;
 	uint16_t h;
 	uint32_t fg;
 	uint32_t bg;
 	uint8_t len;
-	struct xcb xcb = { ctx_.dpy, ctx_.win, ctx_.gc };
+	struct xcb xcb = { ctx_.dpy, d, ctx_.gc };
 
 	if (!col->str || !col->len)
 		return 0;
@@ -270,7 +352,7 @@ static void draw_search_bar(void)
 {
 	struct xcb xcb = { ctx_.dpy, ctx_.win, ctx_.gc };
 	int16_t x = x_pad_ * 2;
-	int16_t y = draw_rect(rows_per_page_, 0) + ctx_.text_y;
+	int16_t y = draw_rect(ctx_.win, rows_per_page_, 0) + ctx_.text_y;
 	uint8_t len;
 	char *str = search_buf_;
 
@@ -326,15 +408,41 @@ static void warp_pointer(int16_t x, int16_t y)
 	}
 }
 
-static void draw_row(struct row *row, uint8_t idx, uint8_t focus)
+static char *index_col(uint16_t rowidx, uint8_t i, uint8_t *len)
+{
+	uint16_t *off = &cols_off_[rowidx * cols_per_row_];
+	uint16_t end;
+
+	if (i + 1 < cols_per_row_)
+		end = off[i + 1] - 1;
+	else
+		end = rows_off_[rowidx + 1] - rows_off_[rowidx] - 1;
+
+	end > off[i] ? (*len = end - off[i]) : (*len = 0);
+	return data_ + rows_off_[rowidx] + off[i];
+}
+
+static void split_index_row(struct row *row)
+{
+	struct column *col = row->cols;
+	uint8_t i;
+
+	for (i = 0; i < cols_per_row_; i++, col++) {
+		col->str = index_col(row - rows_, i, &col->len);
+
+		if (col->len && *col->str == '\a')
+			col->text = icon_.txt;
+		else
+			col->text = text_.txt;
+	}
+}
+
+static void split_row(struct row *row)
 {
 	struct column *col = row->cols;
 	char *start = row->str;
 	char *ptr = start;
 	const char *end = ptr + row->len;
-	int16_t x;
-	int16_t y;
-	uint8_t i;
 
 	col->str = start;
 	col->text = text_.txt;
@@ -355,8 +463,21 @@ static void draw_row(struct row *row, uint8_t idx, uint8_t focus)
 
 	if (ptr == end)
 		col->len = ptr - start;
+}
+
+static void draw_row(xcb_drawable_t d, struct row *row, uint8_t idx,
+ uint8_t focus)
+{
+	int16_t x;
+	int16_t y;
+	uint8_t i;
 
-	y = draw_rect(idx, focus) + ctx_.text_y;
+	if (index_)
+		split_index_row(row);
+	else
+		split_row(row);
+
+	y = draw_rect(d, idx, focus) + ctx_.text_y;
 	x = x_pad_ * 2;
 
 	if (swap_col_idx_)
@@ -368,69 +489,164 @@ static void draw_row(struct row *row, uint8_t idx, uint8_t focus)
 		if (row->cols[i].text == icon_.txt)
 			start_y--; /* HACK: icon is better aligned ths way */
 
-		draw_col(&row->cols[i], i, x, start_y, focus);
+		draw_col(d, &row->cols[i], i, x, start_y, focus);
 		x += cols_px_[i];
 	}
+}
+
+static xcb_pixmap_t create_page_pixmap(void)
+{
+	xcb_pixmap_t pix = xcb_generate_id(ctx_.dpy);
+
+	xcb_create_pixmap(ctx_.dpy, ctx_.scr->root_depth, pix, ctx_.win,
+	 page_w_ + 2 * x_pad_, page_h_ + 2 * y_pad_);
+	return pix;
+}
+
+static struct page_cache *get_page(uint8_t idx, uint8_t rows)
+{
+	struct page_cache *pc = NULL;
+	uint16_t w = page_w_ + 2 * x_pad_;
+	uint16_t h = page_h_ + 2 * y_pad_;
+	uint8_t i;
+
+	for (i = 0; i < PAGE_CACHE_SIZE; i++) {
+		if (page_cache_[i].valid && page_cache_[i].page == idx) {
+			page_cache_[i].stamp = ++page_stamp_;
+			return &page_cache_[i];
+		} else if (!pc || page_cache_[i].stamp < pc->stamp) {
+			pc = &page_cache_[i]; /* least recently used */
+		}
+	}
+
+	if (!pc->norm) {
+		pc->norm = create_page_pixmap();
+		pc->sel = create_page_pixmap();
+	}
+
+	dd("render page %u\n", idx);
+
+	pc->page = idx;
+	pc->valid = 1;
+	pc->stamp = ++page_stamp_;
+	memset(pc->selmask, 0, sizeof(pc->selmask));
+
+	fill_rect(pc->norm, ctx_.bg, 0, 0, w, h);
+	fill_rect(pc->sel, ctx_.bg, 0, 0, w, h);
+
+	for (i = 0; i < rows; i++)
+		draw_row(pc->norm, view_[i], i, 0);
+
+	return pc;
+}
+
+static void show_row(uint8_t idx, uint8_t focus)
+{
+	int16_t y = idx * ctx_.row_h + y_pad_;
+	xcb_pixmap_t src = curpage_->norm;
+
+	if (focus) {
+		uint32_t *mask = &curpage_->selmask[idx / 32];
+		uint32_t bit = 1 << (idx % 32);
+
+		if (!(*mask & bit)) {
+			draw_row(curpage_->sel, view_[idx], idx, 1);
+			*mask |= bit;
+		}
+
+		src = curpage_->sel;
+	}
+
+	xcb_copy_area(ctx_.dpy, src, ctx_.win, ctx_.gc, 0, y, 0, y,
+	 page_w_ + 2 * x_pad_, ctx_.row_h);
 
 	if (focus)
-		warp_pointer(page_w_ + x_pad_, y);
+		warp_pointer(page_w_ + x_pad_, y + ctx_.text_y);
 }
 
-static void draw_menu(void)
+static void select_row(uint8_t idx)
+{
+	show_row(selidx_, 0);
+	selidx_ = idx;
+	selrow_ = view_[idx];
+	show_row(selidx_, 1);
+	xcb_flush(ctx_.dpy);
+}
+
+static uint8_t load_index_page(void)
+{
+	uint16_t rowidx = pages_[page_idx_].rowidx;
+	uint8_t i;
+
+	for (i = 0; i < rows_per_page_ && rowidx < rows_num_; i++, rowidx++) {
+		struct row *row = &rows_[rowidx];
+
+		row->str = data_ + rows_off_[rowidx];
+		row->len = rows_off_[rowidx + 1] - rows_off_[rowidx] - 1;
+
+		if (!selrow_ && i == selidx_)
+			selrow_ = row;
+
+		view_[i] = row;
+	}
+
+	return i;
+}
+
+static uint8_t load_page(void)
 {
 	char *start = pages_[page_idx_].rowptr;
 	char *end = data_ + data_size_;
 	char *ptr = start;
-	uint8_t focus = 0;
 	uint16_t rowidx = pages_[page_idx_].rowidx;
 	uint8_t i = 0;
 
+	if (index_)
+		return load_index_page();
+
 	while (ptr < end) {
 		if (*ptr == '\n') {
-			size_t size = ptr - start;
 			struct row *row = &rows_[rowidx++];
 
 			row->str = start;
-			row->len = size;
+			row->len = ptr - start;
 
-			if (!selrow_ && selidx_ && i == selidx_) {
+			if (!selrow_ && i == selidx_)
 				selrow_ = row;
-				focus = 1;
-			} else if (!selrow_ && !selidx_) {
-				selrow_ = row;
-				focus = 1;
-			} else if (selrow_ == row) {
-				focus = 1;
-			} else {
-				focus = 0;
-			}
 
-			draw_row(row, i, focus);
 			view_[i] = row;
 			i++;
 			start = ptr + 1;
 
-			if (rowidx >= rows_num_) { /* fill dummy rows ... */
-				for (; i < rows_per_page_; i++) {
-					int16_t y = i * ctx_.row_h + y_pad_;
-					fill_rect(ctx_.bg, x_pad_, y, page_w_,
-					 ctx_.row_h);
-				}
-
-				break; /* ... and return */
-			}
-
-			if (i >= rows_per_page_)
+			if (rowidx >= rows_num_)
+				break; /* last page */
+			else if (i >= rows_per_page_)
 				break; /* page done */
 		}
 
 		ptr++;
 	}
 
+	return i;
+}
+
+static void draw_menu(void)
+{
+	uint8_t rows = load_page();
+
+	curpage_ = get_page(page_idx_, rows);
+
+	xcb_copy_area(ctx_.dpy, curpage_->norm, ctx_.win, ctx_.gc, 0, y_pad_,
+	 0, y_pad_, page_w_ + 2 * x_pad_, page_h_);
+
+	if (selidx_ < rows && view_[selidx_] == selrow_)
+		show_row(selidx_, 1);
+
 	if (search_bar_)
 		draw_search_bar();
 
 	warp_pointer(page_w_ + x_pad_, ctx_.row_h - y_pad_);
+	xcb_flush(ctx_.dpy);
 }
 
 static uint8_t match_col(const char *col, uint8_t len)
@@ -477,14 +693,112 @@ static uint8_t find_col(const char *rowstr, uint8_t idx)
 	return 0;
 }
 
-static void find_row(xcb_keysym_t sym)
+static int32_t find_text_row(uint8_t tab)
 {
 	const char *ptr = data_;
-	const char *row = ptr;
 	const char *end = data_ + data_size_;
-	uint8_t selidx = 0;
-	uint8_t rowidx = 0;
-	uint8_t pageidx = 0;
+	int32_t rowidx = 0;
+
+	while (ptr < end) {
+		if (find_col(ptr, search_col_idx_) && (!tab || found_idx_ < rowidx))
+			return rowidx;
+
+		while (ptr < end && *ptr != '\n')
+			ptr++;
+
+		ptr++;
+		rowidx++;
+	}
+
+	return -1;
+}
+
+static uint8_t index_key(uint32_t rowidx, const char **key, uint8_t *len)
+{
+	uint8_t idx = search_col_idx_;
+
+	if (data_[rows_off_[rowidx]] == '\a' && idx < cols_per_row_)
+		idx++; /* skip icon column like find_col() does */
+
+	if (idx >= cols_per_row_)
+		return 0;
+
+	*key = index_col(rowidx, idx, len);
+	return 1;
+}
+
+static int cmp_key(uint32_t rowidx, const char *str, uint8_t len)
+{
+	const char *key;
+	uint8_t key_len;
+	int rc;
+
+	if (!index_key(rowidx, &key, &key_len))
+		return -1; /* rows without key go first */
+
+	rc = memcmp(key, str, key_len < len ? key_len : len);
+
+	if (rc == 0 && key_len < len)
+		return -1;
+
+	return rc;
+}
+
+static int32_t find_index_row(uint8_t tab)
+{
+	const char *str = search_buf_ + PROMPT_LEN;
+	uint8_t len = search_idx_ - PROMPT_LEN;
+	const char *key;
+	uint8_t key_len;
+	int32_t found = -1;
+	uint32_t lo;
+	uint32_t hi;
+	uint32_t i;
+
+	if (!keys_ || index_->key_col != search_col_idx_) {
+		for (i = 0; i < rows_num_; i++) {
+			if (!index_key(i, &key, &key_len))
+				continue;
+			else if (!match_col(key, key_len))
+				continue;
+			else if (!tab || found_idx_ < (int32_t) i)
+				return i;
+		}
+
+		return -1;
+	}
+
+	lo = 0;
+	hi = rows_num_;
+
+	while (lo < hi) { /* first key not less than search string */
+		uint32_t mid = (lo + hi) / 2;
+
+		if (cmp_key(keys_[mid], str, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (i = lo; i < rows_num_; i++) {
+		if (!index_key(keys_[i], &key, &key_len))
+			continue;
+		else if (!match_col(key, key_len))
+			break; /* past matching range */
+		else if (tab && (int32_t) keys_[i] <= found_idx_)
+			continue;
+		else if (found < 0 || (int32_t) keys_[i] < found)
+			found = keys_[i];
+	}
+
+	return found;
+}
+
+static void find_row(xcb_keysym_t sym)
+{
+	int32_t rowidx;
+	uint8_t pageidx;
+	uint8_t selidx;
 	uint8_t tab = 0;
 
 	if (sym == 0x75 && control_) { /* control + u */
@@ -504,41 +818,29 @@ static void find_row(xcb_keysym_t sym)
 	if (search_bar_)
 		draw_search_bar();
 
-	while (ptr < end) {
-		if (find_col(row, search_col_idx_)) {
-			if (!tab || found_idx_ < rowidx) {
-				if (page_idx_ != pageidx) {
-					page_idx_ = pageidx;
-					selrow_ = NULL;
-					selidx_ = selidx;
-					draw_menu();
-				} else {
-					draw_row(selrow_, selidx_, 0);
-					selrow_ = view_[selidx];
-					draw_row(selrow_, selidx, 1);
-					selidx_ = selidx;
-				}
-
-				found_idx_ = rowidx;
-				return;
-			}
-		}
+	if (index_)
+		rowidx = find_index_row(tab);
+	else
+		rowidx = find_text_row(tab);
 
-		if (*ptr == '\n') {
-			rowidx++;
-			row = ptr + 1;
+	if (rowidx < 0) {
+		found_idx_ = -1;
+		return;
+	}
 
-			if (selidx++ >= rows_per_page_ - 1) {
-				selidx = 0;
-				if (pages_num_ > 1)
-					pageidx++;
-			}
-		}
+	pageidx = rowidx / rows_per_page_;
+	selidx = rowidx % rows_per_page_;
 
-		ptr++;
+	if (page_idx_ != pageidx) {
+		page_idx_ = pageidx;
+		selrow_ = NULL;
+		selidx_ = selidx;
+		draw_menu();
+	} else {
+		select_row(selidx);
 	}
 
-	found_idx_ = -1;
+	found_idx_ = rowidx;
 }
 
 static void page_up(void)
@@ -595,11 +897,8 @@ static void line_up(void)
 		return;
 	}
 
-	draw_row(selrow_, selidx_, 0);
-	selidx_--;
-	selrow_ = view_[selidx_];
 	warp_ = 1;
-	draw_row(selrow_, selidx_, 1);
+	select_row(selidx_ - 1);
 }
 
 static void line_down(void)
@@ -617,11 +916,8 @@ static void line_down(void)
 		return;
 	}
 
-	draw_row(selrow_, selidx_, 0);
-	selidx_++;
-	selrow_ = view_[selidx_];
 	warp_ = 1;
-	draw_row(selrow_, selidx_, 1);
+	select_row(selidx_ + 1);
 }
 
 static xcb_keysym_t get_keysyms(xcb_keycode_t code)
@@ -795,12 +1091,8 @@ static void follow_pointer(xcb_motion_notify_event_t *e)
 		if (e->event_y >= lolim && e->event_y <= uplim) {
 			struct row *row = view_[i];
 
-			if (selrow_ != row) {
-				draw_row(selrow_, selidx_, 0);
-				selidx_ = i;
-				selrow_ = row;
-				draw_row(selrow_, selidx_, 1);
-			}
+			if (selrow_ != row)
+				select_row(i);
 
 			break;
 		}
@@ -836,7 +1128,31 @@ static void grab_pointer(void)
 	return;
 }
 
-static int init_rows(void)
+static int alloc_cols(void)
+{
+	cols_len_ = calloc(sizeof(*cols_len_), cols_per_row_);
+
+	if (!cols_len_) {
+		ee("calloc(%lu) failed\n", sizeof(*cols_len_) * cols_per_row_);
+		return -1;
+	}
+
+	cols_px_ = calloc(sizeof(*cols_px_), cols_per_row_);
+
+	if (!cols_px_) {
+		ee("calloc(%lu) failed\n", sizeof(*cols_px_) * cols_per_row_);
+		return -1;
+	}
+
+	if (search_col_idx_ >= cols_per_row_) {
+		search_col_idx_ = 0;
+		swap_col_idx_ = 0;
+	}
+
+	return 0;
+}
+
+static int parse_rows(uint8_t *max_len)
 {
 	uint16_t i;
 	char *ptr;
@@ -850,15 +1166,6 @@ static int init_rows(void)
 	uint8_t icon;
 	struct text *text;
 
-	x_pad_ = ctx_.space_w;
-	y_pad_ = x_pad_;
-	ctx_.row_h = ctx_.text_h + 2 * (ctx_.space_w / 3);
-	ctx_.text_y = (ctx_.row_h - ctx_.text_h) / 2;
-	ctx_.icon_y = ctx_.text_y;
-
-	if (!(ctx_.text_y % 2))
-		ctx_.text_y++;
-
 	ptr = data_;
 	while (ptr < end) { /* calc number of items in row */
 		if (*ptr == '\t') {
@@ -880,27 +1187,10 @@ static int init_rows(void)
 	if (!cols_per_row_) {
 		ee("failed to find number of items in row\n");
 		return -1;
-	}
-
-	cols_len_ = calloc(sizeof(*cols_len_), cols_per_row_);
-
-	if (!cols_len_) {
-		ee("calloc(%lu) failed\n", sizeof(*cols_len_) * cols_per_row_);
-		return -1;
-	}
-
-	cols_px_ = calloc(sizeof(*cols_px_), cols_per_row_);
-
-	if (!cols_px_) {
-		ee("calloc(%lu) failed\n", sizeof(*cols_px_) * cols_per_row_);
+	} else if (alloc_cols() < 0) {
 		return -1;
 	}
 
-	if (search_col_idx_ >= cols_per_row_) {
-		search_col_idx_ = 0;
-		swap_col_idx_ = 0;
-	}
-
 #ifdef DEBUG
 	uint8_t col_max_len = row_len_ / cols_per_row_;
 	dd("max col len %u\n", col_max_len);
@@ -930,8 +1220,12 @@ static int init_rows(void)
 			}
 
 			cols_len_[i] = ptr - col_start + 1;
-			set_text_str(text, col_start, cols_len_[i]);
-			get_text_size(text, &w, &h);
+			w = 0;
+
+			if (text) { /* no fonts are opened in index mode */
+				set_text_str(text, col_start, cols_len_[i]);
+				get_text_size(text, &w, &h);
+			}
 
 			if (w > cols_px_[i])
 				cols_px_[i] = w;
@@ -1002,6 +1296,23 @@ static int init_rows(void)
 		}
 	}
 
+	*max_len = row_max_len;
+	return 0;
+}
+
+static int init_layout(uint8_t row_max_len)
+{
+	uint16_t i;
+
+	x_pad_ = ctx_.space_w;
+	y_pad_ = x_pad_;
+	ctx_.row_h = ctx_.text_h + 2 * (ctx_.space_w / 3);
+	ctx_.text_y = (ctx_.row_h - ctx_.text_h) / 2;
+	ctx_.icon_y = ctx_.text_y;
+
+	if (!(ctx_.text_y % 2))
+		ctx_.text_y++;
+
 	if (rows_per_page_ > rows_num_)
 		rows_per_page_ = rows_num_;
 
@@ -1059,29 +1370,498 @@ static int init_rows(void)
 	return 0;
 }
 
-static int init_xkb(void)
+static int init_rows(void)
 {
-	int32_t dev;
+	uint8_t row_max_len;
 
-	if (!(ctx_.xkb = xkb_context_new(XKB_CONTEXT_NO_FLAGS))) {
-		ee("xkb_context_new() failed\n");
+	if (parse_rows(&row_max_len) < 0)
 		return -1;
-	}
 
-	if ((dev = xkb_x11_get_core_keyboard_device_id(ctx_.dpy)) < 0) {
-		ee("xkb_x11_get_core_keyboard_device_id() failed\n");
-		return -1;
-	}
+	return init_layout(row_max_len);
+}
 
-	ctx_.keymap = xkb_x11_keymap_new_from_device(ctx_.xkb, ctx_.dpy, dev,
-	 XKB_KEYMAP_COMPILE_NO_FLAGS);
-	if (!ctx_.keymap) {
+static uint32_t font_crc(void)
+{
+	uint32_t crc = 0;
+
+	if (ctx_.text_font)
+		crc ^= crc32((char *) ctx_.text_font, strlen(ctx_.text_font));
+
+	if (ctx_.icon_font)
+		crc ^= crc32((char *) ctx_.icon_font, strlen(ctx_.icon_font));
+
+	return crc;
+}
+
+static int sort_keys(const void *a, const void *b)
+{
+	uint32_t row1 = *(const uint32_t *) a;
+	uint32_t row2 = *(const uint32_t *) b;
+	const char *key1;
+	const char *key2;
+	uint8_t len1;
+	uint8_t len2;
+	uint8_t has1 = index_key(row1, &key1, &len1);
+	uint8_t has2 = index_key(row2, &key2, &len2);
+	int rc;
+
+	if (!has1 || !has2)
+		return has1 - has2;
+	else if ((rc = memcmp(key1, key2, len1 < len2 ? len1 : len2)))
+		return rc;
+	else if (len1 != len2)
+		return len1 - len2;
+
+	return row1 - row2;
+}
+
+#define align4(n) (((n) + 3) & ~3U)
+
+static int write_index(void)
+{
+	struct index_hdr hdr = {0};
+	char tmp[strlen(index_out_) + sizeof(".tmp")];
+	const char *end = data_ + data_size_;
+	const char *row_start = data_;
+	const char *ptr;
+	uint32_t zero = 0;
+	uint32_t off;
+	uint32_t r;
+	uint8_t row_max_len;
+	uint8_t nl = 0;
+	uint8_t c;
+	int ret = -1;
+	FILE *f;
+
+	if (parse_rows(&row_max_len) < 0)
+		return -1;
+
+	rows_off_ = calloc(rows_num_ + 1, sizeof(*rows_off_));
+	cols_off_ = calloc(rows_num_ * cols_per_row_, sizeof(*cols_off_));
+	keys_ = calloc(rows_num_, sizeof(*keys_));
+
+	if (!rows_off_ || !cols_off_ || !keys_) {
+		ee("calloc(%u) failed\n", rows_num_);
+		goto out;
+	}
+
+	for (ptr = data_, r = 0, c = 0; ptr < end && r < rows_num_; ptr++) {
+		if (*ptr == '\t') {
+			if (++c < cols_per_row_)
+				cols_off_[r * cols_per_row_ + c] = ptr + 1 - row_start;
+		} else if (*ptr == '\n') {
+			for (c++; c < cols_per_row_; c++) /* missing columns */
+				cols_off_[r * cols_per_row_ + c] = ptr + 1 - row_start;
+
+			row_start = ptr + 1;
+			rows_off_[++r] = row_start - data_;
+			c = 0;
+		}
+	}
+
+	if (r < rows_num_ && row_start < end) { /* no trailing newline */
+		for (c++; c < cols_per_row_; c++)
+			cols_off_[r * cols_per_row_ + c] = end + 1 - row_start;
+
+		rows_off_[++r] = data_size_ + 1;
+		nl = 1;
+	}
+
+	rows_num_ = r;
+
+	for (r = 0; r < rows_num_; r++)
+		keys_[r] = r;
+
+	qsort(keys_, rows_num_, sizeof(*keys_), sort_keys);
+
+	hdr.magic = INDEX_MAGIC;
+	hdr.version = INDEX_VERSION;
+	hdr.flags = INDEX_FLG_KEYS; /* widths are stored on first load */
+	hdr.rows = rows_num_;
+	hdr.row_max_len = row_max_len;
+	hdr.cols = cols_per_row_;
+	hdr.key_col = search_col_idx_;
+	hdr.hdpi = ctx_.hdpi;
+	hdr.vdpi = ctx_.vdpi;
+	hdr.font_size = ctx_.font_size;
+	hdr.font_crc = font_crc();
+
+	off = sizeof(hdr);
+	hdr.rows_off = off;
+	off += (rows_num_ + 1) * sizeof(*rows_off_);
+	hdr.cols_off = off;
+	off += align4(rows_num_ * cols_per_row_ * sizeof(*cols_off_));
+	hdr.widths_off = off;
+	off += align4(cols_per_row_ * (sizeof(*cols_px_) + sizeof(*cols_len_)));
+	hdr.keys_off = off;
+	off += rows_num_ * sizeof(*keys_);
+	hdr.heap_off = off;
+	hdr.heap_size = data_size_ + nl;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", index_out_);
+
+	if (!(f = fopen(tmp, "w"))) {
+		ee("fopen(%s) failed\n", tmp);
+		goto out;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(rows_off_, sizeof(*rows_off_), rows_num_ + 1, f);
+	fwrite(cols_off_, sizeof(*cols_off_), rows_num_ * cols_per_row_, f);
+	fwrite(&zero, 1, hdr.widths_off - ftell(f), f);
+	fwrite(cols_px_, sizeof(*cols_px_), cols_per_row_, f);
+	fwrite(cols_len_, sizeof(*cols_len_), cols_per_row_, f);
+	fwrite(&zero, 1, hdr.keys_off - ftell(f), f);
+	fwrite(keys_, sizeof(*keys_), rows_num_, f);
+	fwrite(data_, 1, data_size_, f);
+	fwrite("\n", 1, nl, f);
+
+	if (ferror(f) | fclose(f)) {
+		ee("failed to write %s\n", tmp);
+		unlink(tmp);
+	} else if (rename(tmp, index_out_) < 0) {
+		ee("rename(%s, %s) failed\n", tmp, index_out_);
+		unlink(tmp);
+	} else {
+		ii("indexed %u rows to %s\n", rows_num_, index_out_);
+		ret = 0;
+	}
+out:
+	free(rows_off_);
+	free(cols_off_);
+	free(keys_);
+	rows_off_ = NULL;
+	cols_off_ = NULL;
+	keys_ = NULL;
+	return ret;
+}
+
+static void measure_index(void)
+{
+	struct text *text;
+	uint16_t w;
+	uint16_t h;
+	uint16_t r;
+	uint8_t len;
+	uint8_t c;
+	char *str;
+
+	for (r = 0; r < rows_num_; r++) {
+		for (c = 0; c < cols_per_row_; c++) {
+			str = index_col(r, c, &len);
+			text = text_.txt;
+
+			if (len && *str == '\a') {
+				text = icon_.txt;
+				str++;
+				len--;
+			}
+
+			cols_len_[c] = len + 1;
+			set_text_str(text, str, cols_len_[c]);
+			get_text_size(text, &w, &h);
+
+			if (w > cols_px_[c])
+				cols_px_[c] = w;
+		}
+	}
+}
+
+/* index is written without fonts, so widths measured on load are stored
+ * back to let next loads skip measuring
+ */
+
+static void store_index_widths(void)
+{
+	struct index_hdr hdr = *index_;
+	off_t off = hdr.widths_off;
+	int fd;
+
+	if ((fd = open(ctx_.path, O_WRONLY)) < 0) {
+		dd("index %s is read-only\n", ctx_.path);
+		return;
+	}
+
+	hdr.flags |= INDEX_FLG_WIDTHS;
+	hdr.hdpi = ctx_.hdpi;
+	hdr.vdpi = ctx_.vdpi;
+	hdr.font_size = ctx_.font_size;
+	hdr.font_crc = font_crc();
+
+	/* widths go first, so header never flags what is not there */
+	if (pwrite(fd, cols_px_, cols_per_row_ * sizeof(*cols_px_), off) < 0 ||
+	    pwrite(fd, cols_len_, cols_per_row_ * sizeof(*cols_len_),
+	     off + cols_per_row_ * sizeof(*cols_px_)) < 0 ||
+	    pwrite(fd, &hdr, sizeof(hdr), 0) < 0)
+		ee("failed to store widths in %s\n", ctx_.path);
+
+	close(fd);
+}
+
+static int init_index(void)
+{
+	struct index_hdr *hdr = index_;
+	char *base = (char *) index_;
+	size_t size = index_size_;
+	uint16_t *px;
+	uint32_t r;
+	uint8_t c;
+
+	if (hdr->version != INDEX_VERSION) {
+		errno = 0;
+		ee("unsupported index version %u\n", hdr->version);
+		return -1;
+	} else if (!hdr->rows || hdr->rows > INT16_MAX || !hdr->cols) {
+		goto corrupted;
+	} else if ((size_t) hdr->heap_off + hdr->heap_size > size) {
+		goto corrupted;
+	} else if ((size_t) hdr->rows_off + (hdr->rows + 1) * 4 > size) {
+		goto corrupted;
+	} else if ((size_t) hdr->cols_off + hdr->rows * hdr->cols * 2 > size) {
+		goto corrupted;
+	} else if (hdr->rows_off % 4 || hdr->cols_off % 2) {
+		goto corrupted;
+	}
+
+	data_ = base + hdr->heap_off;
+	data_size_ = hdr->heap_size;
+	rows_off_ = (uint32_t *) (base + hdr->rows_off);
+	cols_off_ = (uint16_t *) (base + hdr->cols_off);
+	rows_num_ = hdr->rows;
+	cols_per_row_ = hdr->cols;
+
+	for (r = 0; r < rows_num_; r++) { /* offsets are trusted from here */
+		uint32_t len = rows_off_[r + 1] - rows_off_[r];
+
+		if (rows_off_[r + 1] <= rows_off_[r])
+			goto corrupted;
+		else if (rows_off_[r + 1] > data_size_)
+			goto corrupted;
+
+		for (c = 0; c < cols_per_row_; c++) {
+			if (cols_off_[r * cols_per_row_ + c] > len)
+				goto corrupted;
+		}
+	}
+
+	if (alloc_cols() < 0)
+		return -1;
+
+	px = (uint16_t *) (base + hdr->widths_off);
+
+	if ((size_t) hdr->widths_off + hdr->cols * 3 > size) {
+		goto corrupted;
+	} else if (!(hdr->flags & INDEX_FLG_WIDTHS)) {
+		measure_index();
+		store_index_widths();
+	} else if (hdr->font_size != ctx_.font_size ||
+		   hdr->hdpi != ctx_.hdpi || hdr->vdpi != ctx_.vdpi ||
+		   hdr->font_crc != font_crc()) {
+		dd("index widths were measured with another font\n");
+		measure_index();
+		store_index_widths();
+	} else {
+		memcpy(cols_px_, px, cols_per_row_ * sizeof(*cols_px_));
+		memcpy(cols_len_, px + cols_per_row_,
+		 cols_per_row_ * sizeof(*cols_len_));
+	}
+
+	if (!(hdr->flags & INDEX_FLG_KEYS)) {
+		keys_ = NULL;
+	} else if ((size_t) hdr->keys_off + hdr->rows * 4 > size) {
+		goto corrupted;
+	} else {
+		keys_ = (uint32_t *) (base + hdr->keys_off);
+
+		for (r = 0; r < rows_num_; r++) {
+			if (keys_[r] >= rows_num_)
+				goto corrupted;
+		}
+	}
+
+	for (r = 0; r < UCHAR_MAX && r * rows_per_page_ < rows_num_; r++) {
+		pages_[r].rowidx = r * rows_per_page_;
+		pages_[r].rowptr = data_ + rows_off_[pages_[r].rowidx];
+	}
+
+	pages_[UCHAR_MAX].rowptr = data_ + data_size_;
+	pages_[UCHAR_MAX].rowidx = 0;
+
+	return init_layout(hdr->row_max_len);
+
+corrupted:
+	errno = 0;
+	ee("corrupted index %s\n", ctx_.path);
+	return -1;
+}
+
+static void unmap_menu(void)
+{
+	if (index_)
+		munmap(index_, index_size_);
+	else if (data_ && data_ != data_buf_)
+		munmap(data_, data_size_);
+
+	index_ = NULL;
+	rows_off_ = NULL;
+	cols_off_ = NULL;
+	keys_ = NULL;
+	data_ = NULL;
+	data_size_ = 0;
+}
+
+#define KEYMAP_HDR_LEN (sizeof("ffffffff\n") - 1)
+
+static uint8_t keymap_path(char *path, size_t size, uint8_t mkdirs)
+{
+	const char *home = getenv("FWM_HOME");
+	const char *display = getenv("DISPLAY");
+	int len;
+
+	if (!home || !display)
+		return 0;
+
+	if (mkdirs) {
+		snprintf(path, size, "%s/tmp", home);
+		mkdir(path, 0700);
+	}
+
+	len = snprintf(path, size, "%s/tmp/keymap%s", home, display);
+	return len > 0 && len < size;
+}
+
+/* cheap fingerprint of server keyboard: core map plus rules names */
+
+static uint32_t keymap_key(int32_t dev)
+{
+	const xcb_setup_t *setup = xcb_get_setup(ctx_.dpy);
+	xcb_get_keyboard_mapping_cookie_t kc;
+	xcb_get_keyboard_mapping_reply_t *kr;
+	xcb_get_property_cookie_t pc;
+	xcb_get_property_reply_t *pr;
+	uint32_t key = dev;
+
+	kc = xcb_get_keyboard_mapping(ctx_.dpy, setup->min_keycode,
+	 setup->max_keycode - setup->min_keycode + 1);
+	pc = xcb_get_property(ctx_.dpy, 0, ctx_.scr->root, ctx_.rules_atom,
+	 XCB_ATOM_STRING, 0, UCHAR_MAX);
+
+	if ((kr = xcb_get_keyboard_mapping_reply(ctx_.dpy, kc, NULL))) {
+		key ^= crc32((char *) xcb_get_keyboard_mapping_keysyms(kr),
+		 xcb_get_keyboard_mapping_keysyms_length(kr) *
+		 sizeof(xcb_keysym_t));
+		free(kr);
+	}
+
+	if ((pr = xcb_get_property_reply(ctx_.dpy, pc, NULL))) {
+		key = (key << 1 | key >> 31);
+		key ^= crc32(xcb_get_property_value(pr),
+		 xcb_get_property_value_length(pr));
+		free(pr);
+	}
+
+	return key;
+}
+
+static struct xkb_keymap *load_keymap(uint32_t key)
+{
+	struct xkb_keymap *keymap = NULL;
+	char path[MAX_PATH];
+	char hdr[KEYMAP_HDR_LEN + 1];
+	struct stat st;
+	char *buf;
+	int fd;
+
+	if (!keymap_path(path, sizeof(path), 0))
+		return NULL;
+	else if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	else if (fstat(fd, &st) < 0 || st.st_size <= KEYMAP_HDR_LEN)
+		goto out;
+
+	snprintf(hdr, sizeof(hdr), "%08x\n", key);
+
+	if (!(buf = malloc(st.st_size + 1))) {
+		ee("malloc(%ld) failed\n", (long) st.st_size + 1);
+		goto out;
+	}
+
+	if (read(fd, buf, st.st_size) != st.st_size) {
+		ee("read(%s) failed\n", path);
+	} else if (memcmp(buf, hdr, KEYMAP_HDR_LEN) == 0) {
+		buf[st.st_size] = '\0';
+		keymap = xkb_keymap_new_from_string(ctx_.xkb,
+		 buf + KEYMAP_HDR_LEN, XKB_KEYMAP_FORMAT_TEXT_V1,
+		 XKB_KEYMAP_COMPILE_NO_FLAGS);
+	}
+
+	free(buf);
+out:
+	close(fd);
+	return keymap;
+}
+
+static void save_keymap(uint32_t key)
+{
+	char path[MAX_PATH];
+	char tmp[MAX_PATH];
+	char *str;
+	FILE *f;
+
+	if (!keymap_path(path, sizeof(path), 1))
+		return;
+	else if (!(str = xkb_keymap_get_as_string(ctx_.keymap,
+	 XKB_KEYMAP_FORMAT_TEXT_V1)))
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+	if (!(f = fopen(tmp, "w"))) {
+		ww("fopen(%s) failed\n", tmp);
+		free(str);
+		return;
+	}
+
+	fprintf(f, "%08x\n%s", key, str);
+
+	if (ferror(f) | fclose(f))
+		unlink(tmp);
+	else if (rename(tmp, path) < 0)
+		unlink(tmp);
+
+	free(str);
+}
+
+static int init_keymap(int32_t dev, uint8_t cached)
+{
+	struct timespec t0;
+	struct timespec t1;
+	uint32_t key;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	key = keymap_key(dev);
+
+	if (!cached || !(ctx_.keymap = load_keymap(key))) {
+		ctx_.keymap = xkb_x11_keymap_new_from_device(ctx_.xkb,
+		 ctx_.dpy, dev, XKB_KEYMAP_COMPILE_NO_FLAGS);
+		cached = 0;
+	}
+
+	if (!ctx_.keymap) {
 		ee("xkb_x11_keymap_new_from_device() failed\n");
 		return -1;
 	}
 
+	/* cold start compiles keymap, compare with cached one to see savings */
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ii("keymap %08x %s in %ld us\n", key, cached ? "loaded" : "compiled",
+	   (t1.tv_sec - t0.tv_sec) * 1000000 +
+	   (t1.tv_nsec - t0.tv_nsec) / 1000);
+
+	if (!cached)
+		save_keymap(key);
+
 #ifdef DEBUG
-	dd("DEBUG %s:%d\n", __func__, __LINE__);
 	state_ = xkb_x11_state_new_from_device(ctx_.keymap, ctx_.dpy, dev);
 	if (!state_) {
 		ee("xkb_x11_state_new_from_device() failed\n");
@@ -1092,12 +1872,176 @@ static int init_xkb(void)
 	return 0;
 }
 
+static int init_xkb(void)
+{
+	uint16_t parts = XCB_XKB_MAP_PART_KEY_TYPES |
+	 XCB_XKB_MAP_PART_KEY_SYMS | XCB_XKB_MAP_PART_MODIFIER_MAP |
+	 XCB_XKB_MAP_PART_EXPLICIT_COMPONENTS |
+	 XCB_XKB_MAP_PART_KEY_ACTIONS | XCB_XKB_MAP_PART_VIRTUAL_MODS |
+	 XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP;
+	uint16_t events = XCB_XKB_EVENT_TYPE_NEW_KEYBOARD_NOTIFY |
+	 XCB_XKB_EVENT_TYPE_MAP_NOTIFY;
+	int32_t dev;
+
+	if (!(ctx_.xkb = xkb_context_new(XKB_CONTEXT_NO_FLAGS))) {
+		ee("xkb_context_new() failed\n");
+		return -1;
+	}
+
+	if ((dev = xkb_x11_get_core_keyboard_device_id(ctx_.dpy)) < 0) {
+		ee("xkb_x11_get_core_keyboard_device_id() failed\n");
+		return -1;
+	}
+
+	/* cached keymap stays valid until server says otherwise */
+
+	if (ctx_.xkb_event) {
+		xcb_xkb_select_events(ctx_.dpy, XCB_XKB_ID_USE_CORE_KBD,
+		 events, 0, events, parts, parts, NULL);
+	}
+
+	return init_keymap(dev, 1);
+}
+
+static void reload_xkb(void)
+{
+	int32_t dev;
+
+	ctx_.xkb_stale = 0;
+
+	if ((dev = xkb_x11_get_core_keyboard_device_id(ctx_.dpy)) < 0) {
+		ee("xkb_x11_get_core_keyboard_device_id() failed\n");
+		return;
+	}
+
+#ifdef DEBUG
+	if (state_)
+		xkb_state_unref(state_);
+
+	state_ = NULL;
+#endif
+	if (ctx_.keymap)
+		xkb_keymap_unref(ctx_.keymap);
+
+	ctx_.keymap = NULL;
+	init_keymap(dev, 0);
+}
+
+static void xkb_notify(xcb_generic_event_t *e)
+{
+	switch (((xcb_xkb_new_keyboard_notify_event_t *) e)->xkbType) {
+	case XCB_XKB_NEW_KEYBOARD_NOTIFY: /* fall through */
+	case XCB_XKB_MAP_NOTIFY:
+		dd("keyboard changed, drop keymap\n");
+		ctx_.xkb_stale = 1; /* bursts of notifies, reload once */
+		break;
+	}
+}
+
+/* socket path: peer hands over sealed memory with menu contents */
+
+static int open_snapshot(const char *path)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct sockaddr_un sa = { .sun_family = AF_UNIX, };
+	struct cmsghdr *cmsg;
+	struct msghdr msg = {0};
+	char ok;
+	struct iovec iov = { &ok, sizeof(ok) };
+	int sock;
+	int fd = -1;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(sa.sun_path, path);
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		ee("connect(%s) failed\n", path);
+		goto out;
+	}
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	if (recvmsg(sock, &msg, 0) != sizeof(ok)) {
+		ee("recvmsg(%s) failed\n", path);
+	} else if (!(cmsg = CMSG_FIRSTHDR(&msg)) ||
+		   cmsg->cmsg_type != SCM_RIGHTS) {
+		errno = 0;
+		ee("no snapshot from %s\n", path);
+	} else {
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+	}
+out:
+	close(sock);
+	return fd;
+}
+
+#define MMAP_PROT (PROT_READ | PROT_WRITE)
+
+/* index keeps row and column offsets and sorted keys; column widths depend
+ * on fonts and dpi of the menu which loads it, so they are left to that menu
+ */
+
+static int make_index(void)
+{
+	struct stat st;
+	int ret = -1;
+	int fd;
+
+	if ((fd = open(ctx_.path, O_RDONLY)) < 0) {
+		ee("open(%s) failed\n", ctx_.path);
+		return -1;
+	} else if (fstat(fd, &st) < 0) {
+		ee("fstat(%s) failed\n", ctx_.path);
+		goto out;
+	}
+
+	data_ = mmap(NULL, st.st_size, MMAP_PROT, MAP_PRIVATE, fd, 0);
+
+	if (data_ == MAP_FAILED) {
+		ee("mmap(%s) failed\n", ctx_.path);
+		data_ = NULL;
+		goto out;
+	}
+
+	data_size_ = st.st_size;
+
+	if (data_size_ > sizeof(*index_) && *(uint32_t *) data_ == INDEX_MAGIC) {
+		errno = 0;
+		ee("%s is already indexed\n", ctx_.path);
+	} else {
+		ret = write_index();
+	}
+
+	unmap_menu();
+out:
+	close(fd);
+	return ret;
+}
+
 static int init_menu(void)
 {
 	int fd;
 	struct stat st;
 
-	if ((fd = open(ctx_.path, O_RDONLY)) < 0) {
+	if (stat(ctx_.path, &st) == 0 && S_ISSOCK(st.st_mode))
+		fd = open_snapshot(ctx_.path);
+	else
+		fd = open(ctx_.path, O_RDONLY);
+
+	if (fd < 0) {
 		ee("open(%s) failed\n", ctx_.path);
 		return -1;
 	}
@@ -1107,8 +2051,6 @@ static int init_menu(void)
 		goto err;
 	}
 
-#define MMAP_PROT (PROT_READ | PROT_WRITE)
-
 	data_ = mmap(NULL, st.st_size, MMAP_PROT, MAP_PRIVATE, fd, 0);
 
 	if (data_ == MAP_FAILED) {
@@ -1119,12 +2061,19 @@ static int init_menu(void)
 
 	data_size_ = st.st_size;
 
-	if (init_rows() == 0)
+	if (data_size_ > sizeof(*index_) && *(uint32_t *) data_ == INDEX_MAGIC) {
+		index_ = (struct index_hdr *) data_;
+		index_size_ = data_size_;
+
+		if (init_index() == 0)
+			return fd;
+	} else if (init_rows() == 0) {
 		return fd;
+	}
 
 	/* skip rows cleanup in init just unmap memory */
 
-	munmap(data_, data_size_);
+	unmap_menu();
 err:
 	data_ = NULL;
 	close(fd);
@@ -1155,6 +2104,8 @@ static void help(const char *name)
 	 "  -b, --search-bar             show search bar\n"
 	 "  -x, --hide-input             hide input in the search bar\n"
 	 "  -w, --wait-visible           wait until window becomes fully visible\n"
+	 "  -D, --daemon                 serve menus from resident instance\n"
+	 "  -I, --index <out>            write pre-indexed copy of <file> and exit\n"
 	 "  -0, --normalfg <hex>         rgb color, default 0x%x\n"
 	 "  -1, --normalbg <hex>         rgb color, default 0x%x\n"
 	 "  -2, --activefg <hex>         rgb color, default 0x%x\n"
@@ -1162,6 +2113,8 @@ static void help(const char *name)
 	 "\nFile format:\n"
 	 "  Tab-separated values (max cols %u, max rows %u)\n"
 	 "  Font icon columns start with '\\a'\n"
+	 "  Files written with --index are detected and loaded as is\n"
+	 "  Unix socket <file> is read from descriptor sent by its peer\n"
 	 "\nEnvironment:\n"
 	 "  FWM_ICONS=%s\n"
 	 "  FWM_FONT=%s\n"
@@ -1187,20 +2140,11 @@ static int opt(const char *arg, const char *args, const char *argl)
 	return (strcmp(arg, args) == 0 || strcmp(arg, argl) == 0);
 }
 
-static uint8_t opts(int argc, char *argv[])
+static void init_env(void)
 {
 	const char *hdpi_str;
 	const char *vdpi_str;
 	const char *font_size_str;
-	int i;
-
-	/* init these defaults before checkig args */
-
-	ctx_.name = "menu";
-	ctx_.fg = 0xa0a0a0;
-	ctx_.bg = 0x0f0f0f;
-	ctx_.selfg = 0xe0e0e0;
-	ctx_.selbg = 0x303030;
 
 	if ((hdpi_str = getenv("FWM_HDPI")))
 		ctx_.hdpi = atoi(hdpi_str);
@@ -1217,8 +2161,52 @@ static uint8_t opts(int argc, char *argv[])
 	else
 		ctx_.font_size = DEFAULT_FONT_SIZE;
 
-	ctx_.icon_font = getenv("FWM_ICONS");
-	ctx_.text_font = getenv("FWM_FONT");
+	ctx_.icon_font = getenv("FWM_ICONS");
+	ctx_.text_font = getenv("FWM_FONT");
+}
+
+static uint8_t init_fonts(void)
+{
+	if (!ctx_.icon_font) {
+		ww("Icons font is not set\n");
+	} else {
+		icon_.font_id = open_font(ctx_.icon_font, ctx_.hdpi, ctx_.vdpi);
+		if (invalid_font_id(icon_.font_id))
+			return 0;
+		else if (!init_text(&icon_))
+			return 0;
+
+		get_space_width(icon_.font_id);
+	}
+
+	if (!ctx_.text_font) {
+		ww("Text font is not set\n");
+	} else {
+		text_.font_id = open_font(ctx_.text_font, ctx_.hdpi, ctx_.vdpi);
+		if (invalid_font_id(text_.font_id))
+			return 0;
+		else if (!init_text(&text_))
+			return 0;
+
+		get_space_width(text_.font_id);
+	}
+
+	return 1;
+}
+
+static uint8_t opts(int argc, char *argv[])
+{
+	int i;
+
+	/* init these defaults before checkig args */
+
+	ctx_.name = "menu";
+	ctx_.fg = 0xa0a0a0;
+	ctx_.bg = 0x0f0f0f;
+	ctx_.selfg = 0xe0e0e0;
+	ctx_.selbg = 0x303030;
+
+	init_env();
 
 	if (argc < 2) {
 		help(argv[0]);
@@ -1230,7 +2218,7 @@ static uint8_t opts(int argc, char *argv[])
 
 		if (opt(arg, "-h", "--help")) {
 			help(argv[0]);
-			exit(0);
+			return 0;
 		} else if (opt(arg, "-c", "--cols")) {
 			i++;
 			row_len_ = atoi(argv[i]);
@@ -1259,6 +2247,9 @@ static uint8_t opts(int argc, char *argv[])
 			search_bar_ = 1;
 		} else if (opt(arg, "-w", "--wait-visible")) {
 			wait_visible_ = 1;
+		} else if (opt(arg, "-I", "--index")) {
+			i++;
+			index_out_ = argv[i];
 		} else if (opt(arg, "-0", "--normal-foreground")) {
 			i++;
 			if (argv[i])
@@ -1287,30 +2278,6 @@ static uint8_t opts(int argc, char *argv[])
 		return 0;
 	}
 
-	if (!ctx_.icon_font) {
-		ww("Icons font is not set\n");
-	} else {
-		icon_.font_id = open_font(ctx_.icon_font, ctx_.hdpi, ctx_.vdpi);
-		if (invalid_font_id(icon_.font_id))
-			return 0;
-		else if (!init_text(&icon_))
-			return 0;
-
-		get_space_width(icon_.font_id);
-	}
-
-	if (!ctx_.text_font) {
-		ww("Text font is not set\n");
-	} else {
-		text_.font_id = open_font(ctx_.text_font, ctx_.hdpi, ctx_.vdpi);
-		if (invalid_font_id(text_.font_id))
-			return 0;
-		else if (!init_text(&text_))
-			return 0;
-
-		get_space_width(text_.font_id);
-	}
-
 	return 1;
 }
 
@@ -1451,6 +2418,9 @@ static uint8_t events(uint8_t wait)
 		draw_menu();
 		break;
 	case XCB_KEY_PRESS:
+		if (ctx_.xkb_stale)
+			reload_xkb();
+
 		key_press((xcb_key_press_event_t *) e);
 		break;
 	case XCB_KEY_RELEASE:
@@ -1464,6 +2434,11 @@ static uint8_t events(uint8_t wait)
 		follow_pointer((xcb_motion_notify_event_t *) e);
 		break;
 	default:
+		if (ctx_.xkb_event == (e->response_type & ~0x80)) {
+			xkb_notify(e);
+			break;
+		}
+
 		dd("event %d (%d)\n", e->response_type & ~0x80, e->response_type);
 	}
 
@@ -1471,35 +2446,25 @@ static uint8_t events(uint8_t wait)
 	return 1;
 }
 
-int main(int argc, char *argv[])
+static int init_x(void)
 {
-	uint8_t ret = 1;
-	struct pollfd pfd;
-	int fd = -1;
 	uint32_t mask;
-	xcb_screen_t *scr;
 	uint32_t val[2];
-	char *env = getenv("FWM_SCALE");
-	float font_scale;
-
-	env ? (font_scale = atof(env)) : (font_scale = 1);
 
-	if (!opts(argc, argv))
-		return 1;
-	else if (!(ctx_.dpy = xcb_connect(NULL, NULL))) {
+	if (!(ctx_.dpy = xcb_connect(NULL, NULL))) {
 		ee("xcb_connect() failed\n");
-		return 1;
+		return -1;
 	}
 
-	scr = xcb_setup_roots_iterator(xcb_get_setup(ctx_.dpy)).data;
-	if (!scr) {
+	ctx_.scr = xcb_setup_roots_iterator(xcb_get_setup(ctx_.dpy)).data;
+	if (!ctx_.scr) {
 		ee("failed to get screen\n");
-		return 1;
+		return -1;
 	}
 
 	xkb_x11_setup_xkb_extension(ctx_.dpy, XKB_X11_MIN_MAJOR_XKB_VERSION,
 	 XKB_X11_MIN_MINOR_XKB_VERSION, XKB_X11_SETUP_XKB_EXTENSION_NO_FLAGS,
-	 NULL, NULL, NULL, NULL);
+	 NULL, NULL, &ctx_.xkb_event, NULL);
 
 	ctx_.win = xcb_generate_id(ctx_.dpy);
 	ctx_.gc = xcb_generate_id(ctx_.dpy);
@@ -1508,11 +2473,21 @@ int main(int argc, char *argv[])
 	val[0] = ctx_.fg;
 	mask |= XCB_GC_GRAPHICS_EXPOSURES;
 	val[1] = 0;
-	xcb_create_gc(ctx_.dpy, ctx_.gc, scr->root, mask, val);
+	xcb_create_gc(ctx_.dpy, ctx_.gc, ctx_.scr->root, mask, val);
 
+	ctx_.pid_atom = get_atom("_NET_WM_PID", sizeof("_NET_WM_PID") - 1);
+	ctx_.rules_atom = get_atom("_XKB_RULES_NAMES",
+	 sizeof("_XKB_RULES_NAMES") - 1);
+	ctx_.active_atom = get_atom("_NET_ACTIVE_WINDOW",
+	 sizeof("_NET_ACTIVE_WINDOW") - 1);
+	return 0;
+}
+
+static int load_menu(int *fd)
+{
 	if (!hide_input_) {
-		if ((fd = init_menu()) < 0)
-			goto err;
+		if ((*fd = init_menu()) < 0)
+			return -1;
 	} else {
 		uint32_t sz1 = strlen(ctx_.name);
 		uint32_t sz2 = sizeof(data_buf_) - 3;
@@ -1528,7 +2503,7 @@ int main(int argc, char *argv[])
 		data_size_ = sz1 + 1;
 
 		if (init_rows() != 0)
-			goto err;
+			return -1;
 	}
 
 	page_h_ = ctx_.row_h * rows_per_page_;
@@ -1537,6 +2512,23 @@ int main(int argc, char *argv[])
 	   page_w_, page_h_, row_len_, rows_per_page_, rows_num_,
 	   page_w_ / x_pad_, ctx_.row_h);
 
+	return 0;
+}
+
+static void menu_size(uint16_t *w, uint16_t *h)
+{
+	*w = page_w_ + 2 * x_pad_;
+	*h = page_h_ + 2 * y_pad_;
+
+	if (search_bar_)
+		*h += ctx_.row_h;
+}
+
+static void create_window(uint16_t w, uint16_t h)
+{
+	uint32_t mask;
+	uint32_t val[2];
+
 	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
 	val[0] = ctx_.bg;
 	val[1] = XCB_EVENT_MASK_EXPOSURE;
@@ -1548,31 +2540,392 @@ int main(int argc, char *argv[])
 	val[1] |= XCB_EVENT_MASK_LEAVE_WINDOW;
 	val[1] |= XCB_EVENT_MASK_ENTER_WINDOW;
 
-	uint16_t tmp;
-	search_bar_ ? (tmp = ctx_.row_h) : (tmp = 0);
-
-	xcb_create_window(ctx_.dpy, XCB_COPY_FROM_PARENT, ctx_.win, scr->root,
-	 0, 0, page_w_ + 2 * x_pad_, page_h_ + 2 * y_pad_ + tmp, 0,
-	 XCB_WINDOW_CLASS_INPUT_OUTPUT, scr->root_visual, mask, val);
+	xcb_create_window(ctx_.dpy, XCB_COPY_FROM_PARENT, ctx_.win,
+	 ctx_.scr->root, 0, 0, w, h, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+	 ctx_.scr->root_visual, mask, val);
+}
 
-        xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
+static void map_window(uint32_t pid)
+{
+	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
 	 XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, strlen(ctx_.name), ctx_.name);
 
-        xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
+	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
 	 XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8, strlen(ctx_.name), ctx_.name);
 
-	xcb_atom_t atom = get_atom("_NET_WM_PID", sizeof("_NET_WM_PID") - 1);
-	uint32_t data = getpid();
-	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win, atom,
-	 XCB_ATOM_CARDINAL, 32, 1, &data);
+	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.win,
+	 ctx_.pid_atom, XCB_ATOM_CARDINAL, 32, 1, &pid);
 
 	xcb_map_window(ctx_.dpy, ctx_.win);
-	atom = get_atom("_NET_ACTIVE_WINDOW", sizeof("_NET_ACTIVE_WINDOW") - 1);
-	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, scr->root, atom,
-	 XCB_ATOM_WINDOW, 32, 1, &ctx_.win);
+	xcb_change_property(ctx_.dpy, XCB_PROP_MODE_REPLACE, ctx_.scr->root,
+	 ctx_.active_atom, XCB_ATOM_WINDOW, 32, 1, &ctx_.win);
 	xcb_set_input_focus_checked(ctx_.dpy, XCB_NONE, ctx_.win,
 	 XCB_CURRENT_TIME);
 	xcb_flush(ctx_.dpy);
+}
+
+static void reset_menu(void)
+{
+	uint16_t i;
+
+	for (i = 0; i < PAGE_CACHE_SIZE; i++) {
+		if (page_cache_[i].norm) {
+			xcb_free_pixmap(ctx_.dpy, page_cache_[i].norm);
+			xcb_free_pixmap(ctx_.dpy, page_cache_[i].sel);
+		}
+	}
+
+	memset(page_cache_, 0, sizeof(page_cache_));
+	curpage_ = NULL;
+
+	for (i = 0; rows_ && i < rows_num_; i++)
+		free(rows_[i].cols);
+
+	free(rows_);
+	free(view_);
+	free(cols_px_);
+	free(cols_len_);
+	unmap_menu();
+
+	rows_ = NULL;
+	view_ = NULL;
+	cols_px_ = NULL;
+	cols_len_ = NULL;
+	selrow_ = NULL;
+	index_out_ = NULL;
+
+	memset(pages_, 0, sizeof(pages_));
+	memset(search_buf_, 0, sizeof(search_buf_));
+	memset(hidden_buf_, 0, sizeof(hidden_buf_));
+
+	search_idx_ = PROMPT_LEN;
+	rows_per_page_ = DEFAULT_ROWS_PER_PAGE;
+	warp_ = 1;
+	found_idx_ = 0;
+	page_w_ = page_h_ = 0;
+	row_len_ = 0;
+	pages_num_ = rows_rem_ = 0;
+	search_bar_ = append_ = print_input_ = interlace_ = 0;
+	level_ = control_ = 0;
+	x_pad_ = y_pad_ = 0;
+	cols_per_row_ = 0;
+	rows_num_ = 0;
+	swap_col_idx_ = search_col_idx_ = 0;
+	selidx_ = page_idx_ = 0;
+	follow_ = 0;
+	wait_visible_ = 0;
+	hide_input_ = 0;
+	hidden_idx_ = 0;
+	ctx_.done = 0;
+}
+
+static uint8_t menu_socket(struct sockaddr_un *sa)
+{
+	const char *home = getenv("FWM_HOME");
+	const char *display = getenv("DISPLAY");
+	int len;
+
+	if (!home || !display)
+		return 0;
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	len = snprintf(sa->sun_path, sizeof(sa->sun_path), "%s/.menu%s",
+	 home, display);
+
+	return len > 0 && len < sizeof(sa->sun_path);
+}
+
+static int run_client(int argc, char *argv[])
+{
+	char buf[MENU_JOB_MAX];
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr *cmsg;
+	struct sockaddr_un sa;
+	struct menu_job job;
+	struct msghdr msg = {0};
+	struct iovec iov[2];
+	int out = STDOUT_FILENO;
+	size_t size;
+	size_t len;
+	uint8_t ret;
+	int fd;
+	int i;
+
+	if (argc < 2 || !menu_socket(&sa))
+		return -1;
+	else if (!getcwd(buf, sizeof(buf)))
+		return -1;
+
+	size = strlen(buf) + 1;
+
+	for (i = 0; i < argc; i++) {
+		len = strlen(argv[i]) + 1;
+
+		if (size + len > sizeof(buf) || i >= MENU_ARGS_MAX)
+			return -1; /* do not fit, run locally */
+		else if (opt(argv[i], "-I", "--index"))
+			return -1; /* converter does not need daemon */
+
+		memcpy(buf + size, argv[i], len);
+		size += len;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1; /* no resident menu, run locally */
+	}
+
+	job.size = size;
+	job.pid = getpid();
+
+	iov[0].iov_base = &job;
+	iov[0].iov_len = sizeof(job);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = size;
+
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(out));
+	memcpy(CMSG_DATA(cmsg), &out, sizeof(out));
+
+	if (sendmsg(fd, &msg, 0) < 0) {
+		ee("sendmsg(%s) failed\n", sa.sun_path);
+		close(fd);
+		return -1;
+	}
+
+	if (read(fd, &ret, sizeof(ret)) != sizeof(ret))
+		ret = 1;
+
+	close(fd);
+	return ret;
+}
+
+static int recv_job(int fd, struct menu_job *job, char *buf, int *out)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr *cmsg;
+	struct msghdr msg = {0};
+	struct iovec iov = { job, sizeof(*job) };
+	size_t off;
+	ssize_t n;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	if (recvmsg(fd, &msg, 0) != sizeof(*job)) {
+		ee("recvmsg() failed\n");
+		return -1;
+	}
+
+	if (!(cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_type != SCM_RIGHTS) {
+		errno = 0;
+		ee("job without output\n");
+		return -1;
+	}
+
+	memcpy(out, CMSG_DATA(cmsg), sizeof(*out));
+
+	if (!job->size || job->size > MENU_JOB_MAX) {
+		errno = 0;
+		ee("bad job size %u\n", job->size);
+		goto err;
+	}
+
+	for (off = 0; off < job->size; off += n) {
+		if ((n = read(fd, buf + off, job->size - off)) <= 0) {
+			ee("read(%u) failed\n", job->size);
+			goto err;
+		}
+	}
+
+	if (buf[job->size - 1] != '\0') {
+		errno = 0;
+		ee("malformed job\n");
+		goto err;
+	}
+
+	return 0;
+err:
+	close(*out);
+	return -1;
+}
+
+static void run_job(int cli, int srv)
+{
+	struct pollfd pfd[3];
+
+	pfd[0].fd = xcb_get_file_descriptor(ctx_.dpy);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = cli; /* client gone */
+	pfd[1].events = POLLIN;
+	pfd[2].fd = srv; /* next menu replaces this one */
+	pfd[2].events = POLLIN;
+
+	while (!ctx_.done) {
+		while (events(0)) {};
+
+		if (ctx_.done)
+			break;
+
+		errno = 0;
+		if (poll(pfd, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[0].revents & (POLLHUP | POLLERR))
+			break;
+		else if (pfd[1].revents)
+			break;
+		else if (pfd[2].revents && !wait_visible_)
+			break;
+	}
+}
+
+static void serve_job(int cli, int srv, int out)
+{
+	char buf[MENU_JOB_MAX];
+	char *argv[MENU_ARGS_MAX + 1];
+	char *ptr;
+	struct menu_job job;
+	xcb_generic_event_t *e;
+	uint16_t w;
+	uint16_t h;
+	uint8_t ret = 1;
+	int argc = 0;
+	int job_out;
+	int fd = -1;
+
+	if (recv_job(cli, &job, buf, &job_out) < 0)
+		return;
+
+	for (ptr = buf + strlen(buf) + 1; ptr < buf + job.size;) {
+		if (argc >= MENU_ARGS_MAX)
+			break;
+
+		argv[argc++] = ptr;
+		ptr += strlen(ptr) + 1;
+	}
+
+	argv[argc] = NULL;
+
+	if (chdir(buf) < 0)
+		ww("chdir(%s) failed\n", buf);
+
+	fflush(stdout);
+	dup2(job_out, STDOUT_FILENO);
+	close(job_out);
+
+	if (argc && !opts(argc, argv))
+		argc = 0;
+
+	if (argc && index_out_) { /* client runs converter locally */
+		errno = 0;
+		ee("index job from pid %u is not served\n", job.pid);
+	} else if (argc && load_menu(&fd) == 0) {
+		uint32_t val[2];
+
+		menu_size(&w, &h);
+		val[0] = w;
+		val[1] = h;
+
+		xcb_configure_window(ctx_.dpy, ctx_.win,
+		 XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, val);
+		xcb_change_window_attributes(ctx_.dpy, ctx_.win,
+		 XCB_CW_BACK_PIXEL, &ctx_.bg);
+
+		map_window(job.pid);
+		run_job(cli, srv);
+
+		xcb_ungrab_pointer(ctx_.dpy, XCB_CURRENT_TIME);
+		xcb_unmap_window(ctx_.dpy, ctx_.win);
+		ret = 0;
+	}
+
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	write(cli, &ret, sizeof(ret));
+
+	if (fd >= 0)
+		close(fd);
+
+	reset_menu();
+
+	/* drop whatever is left from this menu */
+	free(xcb_get_input_focus_reply(ctx_.dpy,
+	 xcb_get_input_focus(ctx_.dpy), NULL));
+
+	while ((e = xcb_poll_for_event(ctx_.dpy))) {
+		if (ctx_.xkb_event == (e->response_type & ~0x80))
+			xkb_notify(e);
+
+		free(e);
+	}
+}
+
+static int run_daemon(void)
+{
+	struct sockaddr_un sa;
+	int srv;
+	int out;
+	int fd;
+
+	if (!menu_socket(&sa)) {
+		ee("FWM_HOME or DISPLAY is not set\n");
+		return 1;
+	}
+
+	if ((srv = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		ee("socket() failed\n");
+		return 1;
+	}
+
+	if (connect(srv, (struct sockaddr *) &sa, sizeof(sa)) == 0) {
+		ii("menu server is already running on %s\n", sa.sun_path);
+		close(srv);
+		return 0;
+	}
+
+	unlink(sa.sun_path);
+
+	if (bind(srv, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		ee("bind(%s) failed\n", sa.sun_path);
+		return 1;
+	} else if (listen(srv, 8) < 0) {
+		ee("listen(%s) failed\n", sa.sun_path);
+		return 1;
+	}
+
+	/* do not get in the way of stopcmd fwm-menu */
+	prctl(PR_SET_NAME, "fwm-menud");
+	signal(SIGPIPE, SIG_IGN);
+
+	init_env();
+
+	if (init_x() < 0 || !init_fonts())
+		goto err;
+
+	create_window(1, 1);
 
 	if (!(ctx_.syms = xcb_key_symbols_alloc(ctx_.dpy)))
 		ww("xcb_key_symbols_alloc() failed\n");
@@ -1580,7 +2933,62 @@ int main(int argc, char *argv[])
 	if (init_xkb() < 0)
 		goto err;
 
-	ctx_.scr = scr;
+	xcb_flush(ctx_.dpy);
+	out = dup(STDOUT_FILENO);
+	ii("serve menus on %s\n", sa.sun_path);
+
+	while (!xcb_connection_has_error(ctx_.dpy)) {
+		if ((fd = accept(srv, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ee("accept(%s) failed\n", sa.sun_path);
+			break;
+		}
+
+		serve_job(fd, srv, out);
+		close(fd);
+	}
+
+err:
+	unlink(sa.sun_path);
+	close(srv);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t ret = 1;
+	struct pollfd pfd;
+	int fd = -1;
+	uint16_t w;
+	uint16_t h;
+	int rc;
+
+	if (argc > 1 && opt(argv[1], "-D", "--daemon"))
+		return run_daemon();
+	else if ((rc = run_client(argc, argv)) >= 0)
+		return rc;
+
+	if (!opts(argc, argv))
+		return 1;
+	else if (index_out_)
+		return make_index() < 0;
+	else if (!init_fonts() || init_x() < 0)
+		return 1;
+
+	if (load_menu(&fd) < 0)
+		goto err;
+
+	menu_size(&w, &h);
+	create_window(w, h);
+	map_window(getpid());
+
+	if (!(ctx_.syms = xcb_key_symbols_alloc(ctx_.dpy)))
+		ww("xcb_key_symbols_alloc() failed\n");
+
+	if (init_xkb() < 0)
+		goto err;
 
 	while (!ctx_.done)
 		events(1);
@@ -1615,9 +3023,7 @@ err:
 	close_font(icon_.font_id);
 	close_font(text_.font_id);
 
-	if (data_ != NULL) {
-		munmap(data_, data_size_);
-	}
+	unmap_menu();
 	close(fd);
 
 	return ret;
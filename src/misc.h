@@ -203,6 +203,28 @@ static inline uint32_t crc32(char *buf, size_t len)
 }
 #endif /* USE_CRC32 */
 
+#define STRFTIME_SECONDS "sSTrcX+" /* conversions showing seconds */
+
+/* true if strftime format has any of given conversions */
+static inline uint8_t strftime_has(const char *fmt, const char *convs)
+{
+	const char *ptr;
+
+	for (ptr = fmt; (ptr = strchr(ptr, '%')); ptr++) {
+		if (!*++ptr)
+			break;
+
+		while (*ptr == 'E' || *ptr == 'O' || *ptr == '_' || *ptr == '-' ||
+		       *ptr == '0' || *ptr == '^' || *ptr == '#')
+			ptr++; /* skip flags and modifiers */
+
+		if (*ptr && strchr(convs, *ptr))
+			return 1;
+	}
+
+	return 0;
+}
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
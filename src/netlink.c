@@ -1,47 +1,157 @@
 /* netlink.c: wait for NETLINK_KOBJECT_UEVENT event and exit.
  * Retrun 0 if event occured or 1 otherwise
  *
+ * With -f keep running and stream every uevent as one line made of
+ * kernel header followed by space separated KEY=VALUE fields, optionally
+ * filtered by subsystem and action and fanned out to local subscribers.
+ *
  * Copyright (c) 2017, Aliaksei Katovich <aliaksei.katovich at gmail.com>
  *
  * Released under the GNU General Public License, version 2
  */
 
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <signal.h>
 #include <poll.h>
 #include <net/if.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <linux/netlink.h>
 
 #include "misc.h"
 
 #define MAX_BUF 256
+#define MAX_MSG 8192 /* well above kernel UEVENT_BUFFER_SIZE */
+#define MAX_FILTERS 8
+#define MAX_SUBS 16
+#define RCVBUF_SIZE (1024 * 1024) /* survive hotplug bursts */
+
+struct filter {
+	const char *str[MAX_FILTERS];
+	uint8_t len[MAX_FILTERS];
+	uint8_t num;
+};
+
+static struct filter subsystems_;
+static struct filter actions_;
+static int subs_[MAX_SUBS];
+static uint8_t subs_num_;
+
+static int opt(const char *arg, const char *args, const char *argl)
+{
+	return (strcmp(arg, args) == 0 || strcmp(arg, argl) == 0);
+}
+
+static void help(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	 "\nWithout options wait for one uevent, print its header and exit.\n"
+	 "\nOptions:\n"
+	 "  -f, --follow              stream all uevents, one per line\n"
+	 "  -s, --subsystem <str>     only pass given subsystem (max %u)\n"
+	 "  -a, --action <str>        only pass given action (max %u)\n"
+	 "  -l, --listen <path>       serve stream to unix socket subscribers\n"
+	 "  -c, --connect <path>      print stream served by another instance\n"
+	 "  -h, --help                print this message\n\n",
+	 prog, MAX_FILTERS, MAX_FILTERS);
+}
+
+static int add_filter(struct filter *filter, const char *str)
+{
+	if (!str) {
+		ee("missing filter value\n");
+		return -1;
+	} else if (filter->num == MAX_FILTERS) {
+		ee("too many filters, max %u\n", MAX_FILTERS);
+		return -1;
+	}
+
+	filter->str[filter->num] = str;
+	filter->len[filter->num] = strlen(str);
+	filter->num++;
+	return 0;
+}
+
+/* look for ' KEY=<value> ' token in formatted record */
+static uint8_t match_field(const char *line, const char *key, uint8_t keylen,
+ struct filter *filter)
+{
+	const char *ptr = line;
+	uint8_t i;
+
+	if (!filter->num)
+		return 1;
+
+	while ((ptr = strstr(ptr, key))) {
+		if (ptr != line && ptr[-1] != ' ') {
+			ptr += keylen;
+			continue;
+		}
+
+		ptr += keylen;
+
+		for (i = 0; i < filter->num; i++) {
+			if (strncmp(ptr, filter->str[i], filter->len[i]) == 0 &&
+			    (ptr[filter->len[i]] == ' ' ||
+			     ptr[filter->len[i]] == '\n'))
+				return 1;
+		}
+
+		return 0;
+	}
+
+	return 0;
+}
+
+static uint8_t match_record(const char *line)
+{
+	return match_field(line, "SUBSYSTEM=", sizeof("SUBSYSTEM=") - 1,
+	 &subsystems_) && match_field(line, "ACTION=", sizeof("ACTION=") - 1,
+	 &actions_);
+}
 
-int main(void)
+static int open_uevents(int32_t size)
 {
-        char msg[MAX_BUF] = {0};
-	int32_t size = MAX_BUF;
 	struct sockaddr_nl sa = {0};
-	struct pollfd fds;
+	int fd;
 
-	fds.fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
 
-	if (fds.fd < 0) {
+	if (fd < 0) {
 		ee("socket() failed\n");
-		return 1;
+		return -1;
 	}
 
 	sa.nl_family = AF_NETLINK;
-	sa.nl_pid = getpid();
 	sa.nl_groups = 1;
 
-	setsockopt(fds.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	/* FORCE variant ignores rmem_max but needs CAP_NET_ADMIN */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
 
-	if (bind(fds.fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
 		ee("bind() failed\n");
-		return 1;
+		close(fd);
+		return -1;
 	}
 
+	return fd;
+}
+
+static int wait_uevent(void)
+{
+	char msg[MAX_BUF] = {0};
+	struct pollfd fds;
+
+	if ((fds.fd = open_uevents(MAX_BUF)) < 0)
+		return 1;
+
 	fds.events = POLLIN;
 	fds.revents = 0;
 
@@ -49,10 +159,240 @@ int main(void)
 		return 1;
 
 	if (fds.revents & POLLIN) {
-		recv(fds.fd, msg, sizeof(msg), MSG_DONTWAIT);
+		recv(fds.fd, msg, sizeof(msg) - 1, MSG_DONTWAIT);
 		printf("%s\n", msg);
 		return 0;
 	}
 
 	return 1;
 }
+
+/* kernel message is '\0' separated: action@devpath KEY=VALUE ... */
+static ssize_t read_record(int fd, char *line, size_t size)
+{
+	struct sockaddr_nl sa;
+	socklen_t salen = sizeof(sa);
+	ssize_t len;
+	char *ptr;
+
+	len = recvfrom(fd, line, size - 1, MSG_DONTWAIT, (struct sockaddr *) &sa,
+	 &salen);
+
+	if (len <= 0) {
+		return len;
+	} else if (sa.nl_pid != 0) {
+		return 0; /* not from kernel */
+	} else if (len >= size - 1) {
+		ww("uevent truncated\n");
+		len = size - 2;
+	}
+
+	if (line[len - 1] == '\0')
+		len--;
+
+	for (ptr = line; ptr < line + len; ptr++) {
+		if (*ptr == '\0' || *ptr == '\n')
+			*ptr = ' ';
+	}
+
+	line[len++] = '\n';
+	line[len] = '\0';
+	return len;
+}
+
+static void add_sub(int fd)
+{
+	int sub = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+	if (sub < 0) {
+		ee("accept4() failed, %s\n", strerror(errno));
+		return;
+	} else if (subs_num_ == MAX_SUBS) {
+		ww("too many subscribers, max %u\n", MAX_SUBS);
+		close(sub);
+		return;
+	}
+
+	subs_[subs_num_++] = sub;
+	dd("subscriber %d, total %u\n", sub, subs_num_);
+}
+
+static void del_sub(uint8_t i)
+{
+	dd("drop subscriber %d\n", subs_[i]);
+	close(subs_[i]);
+	subs_[i] = subs_[--subs_num_];
+}
+
+/* subscriber that can not take whole record right away is dropped so it
+ * never stalls others */
+static void fanout(const char *line, size_t len)
+{
+	uint8_t i = 0;
+
+	while (i < subs_num_) {
+		if (send(subs_[i], line, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len)
+			del_sub(i);
+		else
+			i++;
+	}
+}
+
+static int open_listen(const char *path)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX, };
+	int fd;
+
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+	unlink(sa.sun_path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		ee("socket() failed, %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0 ||
+	    listen(fd, MAX_SUBS) < 0) {
+		ee("bind(%s) failed, %s\n", sa.sun_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int follow(const char *path)
+{
+	char line[MAX_MSG];
+	struct pollfd fds[2 + MAX_SUBS];
+	ssize_t len;
+	uint8_t i, n;
+
+	if ((fds[0].fd = open_uevents(RCVBUF_SIZE)) < 0)
+		return 1;
+
+	fds[0].events = POLLIN;
+	fds[1].fd = path ? open_listen(path) : -1;
+	fds[1].events = POLLIN;
+
+	if (path && fds[1].fd < 0)
+		return 1;
+
+	while (1) {
+		for (i = 0, n = 2; i < subs_num_; i++, n++) {
+			fds[n].fd = subs_[i];
+			fds[n].events = POLLIN; /* only hangups are expected */
+		}
+
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ee("poll() failed, %s\n", strerror(errno));
+			return 1;
+		}
+
+		for (i = n - 1; i >= 2; i--) { /* backwards, del_sub reorders */
+			if (fds[i].revents && recv(fds[i].fd, line, sizeof(line),
+			    MSG_DONTWAIT) <= 0)
+				del_sub(i - 2);
+		}
+
+		if (fds[1].revents & POLLIN)
+			add_sub(fds[1].fd);
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		while ((len = read_record(fds[0].fd, line, sizeof(line))) >= 0) {
+			if (len == 0 || !match_record(line))
+				continue;
+			else if (path)
+				fanout(line, len);
+			else if (fwrite(line, 1, len, stdout) != len ||
+				 fflush(stdout) != 0)
+				return 0; /* reader went away */
+		}
+
+		if (errno == ENOBUFS)
+			ww("uevents were lost, receive buffer overrun\n");
+	}
+
+	return 0;
+}
+
+static int subscribe(const char *path)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX, };
+	char line[MAX_MSG];
+	FILE *file;
+	int fd;
+
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		ee("socket() failed, %s\n", strerror(errno));
+		return 1;
+	}
+
+	if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		ee("connect(%s) failed, %s\n", path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	if (!(file = fdopen(fd, "r"))) {
+		close(fd);
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		if (!match_record(line))
+			continue;
+		else if (fputs(line, stdout) < 0 || fflush(stdout) != 0)
+			break;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *listen_path = NULL;
+	const char *connect_path = NULL;
+	uint8_t stream = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (opt(argv[i], "-f", "--follow")) {
+			stream = 1;
+		} else if (opt(argv[i], "-s", "--subsystem")) {
+			if (add_filter(&subsystems_, argv[++i]) < 0)
+				return 1;
+		} else if (opt(argv[i], "-a", "--action")) {
+			if (add_filter(&actions_, argv[++i]) < 0)
+				return 1;
+		} else if (opt(argv[i], "-l", "--listen")) {
+			listen_path = argv[++i];
+			stream = 1;
+		} else if (opt(argv[i], "-c", "--connect")) {
+			connect_path = argv[++i];
+		} else {
+			help(argv[0]);
+			return opt(argv[i], "-h", "--help") ? 0 : 1;
+		}
+
+		if (i >= argc) {
+			help(argv[0]);
+			return 1;
+		}
+	}
+
+	if (connect_path)
+		return subscribe(connect_path);
+	else if (stream)
+		return follow(listen_path);
+
+	return wait_uevent();
+}
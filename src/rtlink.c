@@ -1,6 +1,10 @@
 /* rtlink.c: wait for NETLINK_ROUTE event and exit.
  * Retrun 0 if event occured or 1 otherwise
  *
+ * With -f keep running, track links and their addresses and report only
+ * real changes: carrier going up or down and addresses being added or
+ * removed. Aggregated link state can be pushed to a dock directly.
+ *
  * Copyright (c) 2017, Aliaksei Katovich <aliaksei.katovich at gmail.com>
  *
  * Released under the GNU General Public License, version 2
@@ -8,17 +12,85 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <net/if.h>
+#include <arpa/inet.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <linux/if_arp.h>
 
 #include "misc.h"
 
 #define MAX_BUF 1
+#define MAX_MSG 16384
+#define MAX_IFACES 32
+#define MAX_ADDRS 8
+#define MAX_PATH 255
+#define RCVBUF_SIZE (256 * 1024)
+
+struct addr {
+	uint8_t family;
+	uint8_t prefix;
+	uint8_t data[16];
+};
+
+struct iface {
+	int index;
+	char name[IFNAMSIZ];
+	uint16_t type;
+	uint8_t carrier;
+	uint8_t wireless;
+	uint8_t addrs_num;
+	struct addr addrs[MAX_ADDRS];
+};
+
+enum kind {
+	KIND_ANY,
+	KIND_WIRED,
+	KIND_WIRELESS,
+};
+
+struct dock {
+	const char *pid;
+	const char *icon;
+	const char *fg;
+	const char *dimfg;
+	char ctl[MAX_PATH];
+	int8_t online; /* last pushed state */
+};
+
+static struct iface ifaces_[MAX_IFACES];
+static uint8_t ifaces_num_;
+static uint8_t report_; /* initial dump is not reported */
+static uint8_t overrun_; /* events were dropped, table has to be dumped */
+static enum kind kind_;
+static struct dock dock_ = { .online = -1, };
+
+static int opt(const char *arg, const char *args, const char *argl)
+{
+	return (strcmp(arg, args) == 0 || strcmp(arg, argl) == 0);
+}
 
-int main(void)
+static void help(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	 "\nWithout options wait for one link event and exit.\n"
+	 "\nOptions:\n"
+	 "  -f, --follow              print link and address changes\n"
+	 "  -k, --kind <str>          only track wired or wireless links\n"
+	 "  -p, --pid <pid>           push link state to this dock\n"
+	 "  -i, --icon <glyph>        dock icon\n"
+	 "  -fg, --fgcolor <hex>      dock color when link is up\n"
+	 "  -dim, --dimcolor <hex>    dock color when link is down\n"
+	 "  -h, --help                print this message\n\n", prog);
+}
+
+static int wait_link(void)
 {
 	int32_t size = MAX_BUF;
 	struct sockaddr_nl sa = {0};
@@ -53,3 +125,366 @@ int main(void)
 
 	return 1;
 }
+
+static struct iface *find_iface(int index)
+{
+	for (uint8_t i = 0; i < ifaces_num_; i++) {
+		if (ifaces_[i].index == index)
+			return &ifaces_[i];
+	}
+
+	return NULL;
+}
+
+static uint8_t tracked(struct iface *iface)
+{
+	switch (kind_) {
+	case KIND_WIRED:
+		return iface->type == ARPHRD_ETHER && !iface->wireless;
+	case KIND_WIRELESS:
+		return iface->wireless;
+	default:
+		return iface->type != ARPHRD_LOOPBACK;
+	}
+}
+
+static void report(const char *fmt, ...)
+{
+	va_list args;
+
+	if (!report_ || dock_.pid)
+		return;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	fflush(stdout);
+}
+
+/* link counts as online when carrier is up and it has ipv4 address */
+static void push_dock(void)
+{
+	char msg[128];
+	int8_t online = 0;
+	int fd, len;
+
+	if (!dock_.pid)
+		return;
+
+	for (uint8_t i = 0; i < ifaces_num_; i++) {
+		struct iface *iface = &ifaces_[i];
+
+		if (!tracked(iface) || !iface->carrier)
+			continue;
+
+		for (uint8_t j = 0; j < iface->addrs_num; j++) {
+			if (iface->addrs[j].family == AF_INET)
+				online = 1;
+		}
+	}
+
+	if (online == dock_.online)
+		return;
+
+	len = snprintf(msg, sizeof(msg), "update-dock %s %s %s", dock_.pid,
+	 dock_.icon, online ? dock_.fg : dock_.dimfg);
+
+	/* same as shell printf, fwm re-opens fifo after each request */
+	if ((fd = open(dock_.ctl, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+		ww("open(%s) failed, %s\n", dock_.ctl, strerror(errno));
+		return;
+	}
+
+	if (write(fd, msg, len) == len)
+		dock_.online = online;
+
+	close(fd);
+}
+
+static void handle_link(struct nlmsghdr *hdr)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(hdr);
+	int len = IFLA_PAYLOAD(hdr);
+	struct rtattr *rta;
+	struct iface *iface = find_iface(ifi->ifi_index);
+	const char *name = NULL;
+	char path[MAX_PATH];
+	uint8_t carrier;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME)
+			name = RTA_DATA(rta);
+	}
+
+	if (hdr->nlmsg_type == RTM_DELLINK) {
+		if (!iface)
+			return;
+		else if (tracked(iface))
+			report("link %s removed\n", iface->name);
+
+		*iface = ifaces_[--ifaces_num_];
+		return;
+	}
+
+	if (!iface) {
+		if (ifaces_num_ == MAX_IFACES) {
+			ww("too many links, max %u\n", MAX_IFACES);
+			return;
+		}
+
+		iface = &ifaces_[ifaces_num_++];
+		memset(iface, 0, sizeof(*iface));
+		iface->index = ifi->ifi_index;
+	}
+
+	if (name) {
+		snprintf(iface->name, sizeof(iface->name), "%s", name);
+		snprintf(path, sizeof(path), "/sys/class/net/%s/wireless", name);
+		iface->wireless = access(path, F_OK) == 0;
+	}
+
+	iface->type = ifi->ifi_type;
+	carrier = (ifi->ifi_flags & IFF_UP) && (ifi->ifi_flags & IFF_LOWER_UP);
+
+	if (carrier == iface->carrier)
+		return; /* e.g. statistics or name updates */
+
+	iface->carrier = carrier;
+
+	if (tracked(iface))
+		report("link %s %s\n", iface->name, carrier ? "up" : "down");
+}
+
+static void handle_addr(struct nlmsghdr *hdr)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(hdr);
+	int len = IFA_PAYLOAD(hdr);
+	struct iface *iface = find_iface(ifa->ifa_index);
+	struct rtattr *rta;
+	struct addr addr = {0};
+	char str[INET6_ADDRSTRLEN];
+	void *data = NULL;
+	uint8_t i, size;
+
+	if (!iface) {
+		return;
+	} else if (ifa->ifa_family == AF_INET) {
+		size = 4;
+	} else if (ifa->ifa_family == AF_INET6) {
+		size = 16;
+	} else {
+		return;
+	}
+
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFA_LOCAL)
+			data = RTA_DATA(rta); /* peer address is in IFA_ADDRESS */
+		else if (rta->rta_type == IFA_ADDRESS && !data)
+			data = RTA_DATA(rta);
+	}
+
+	if (!data)
+		return;
+
+	addr.family = ifa->ifa_family;
+	addr.prefix = ifa->ifa_prefixlen;
+	memcpy(addr.data, data, size);
+
+	for (i = 0; i < iface->addrs_num; i++) {
+		if (memcmp(&iface->addrs[i], &addr, sizeof(addr)) == 0)
+			break;
+	}
+
+	if (hdr->nlmsg_type == RTM_NEWADDR) {
+		if (i < iface->addrs_num) {
+			return; /* lifetime refresh */
+		} else if (iface->addrs_num == MAX_ADDRS) {
+			ww("too many addresses on %s\n", iface->name);
+			return;
+		}
+
+		iface->addrs[iface->addrs_num++] = addr;
+	} else if (i < iface->addrs_num) {
+		iface->addrs[i] = iface->addrs[--iface->addrs_num];
+	} else {
+		return;
+	}
+
+	if (tracked(iface)) {
+		inet_ntop(addr.family, addr.data, str, sizeof(str));
+		report("addr %s %s %s/%u\n", iface->name,
+		 hdr->nlmsg_type == RTM_NEWADDR ? "add" : "del", str,
+		 addr.prefix);
+	}
+}
+
+/* returns 1 when dump is done */
+static int handle_msgs(int fd)
+{
+	char buf[MAX_MSG] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *hdr;
+	ssize_t len;
+	int done = 0;
+
+	while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		for (hdr = (struct nlmsghdr *) buf; NLMSG_OK(hdr, len);
+		     hdr = NLMSG_NEXT(hdr, len)) {
+			switch (hdr->nlmsg_type) {
+			case NLMSG_DONE:
+				done = 1;
+				break;
+			case NLMSG_ERROR:
+				ww("netlink error\n");
+				done = 1;
+				break;
+			case RTM_NEWLINK: /* fall through */
+			case RTM_DELLINK:
+				handle_link(hdr);
+				break;
+			case RTM_NEWADDR: /* fall through */
+			case RTM_DELADDR:
+				handle_addr(hdr);
+				break;
+			}
+		}
+	}
+
+	if (len < 0 && errno == ENOBUFS) {
+		ww("link events were lost, receive buffer overrun\n");
+		overrun_ = 1;
+	}
+
+	return done;
+}
+
+static int dump(int fd, uint16_t type)
+{
+	struct {
+		struct nlmsghdr hdr;
+		struct rtgenmsg gen;
+	} req = {0};
+	struct pollfd fds = { .fd = fd, .events = POLLIN, };
+
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.gen));
+	req.hdr.nlmsg_type = type;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.hdr.nlmsg_seq = type;
+	req.gen.rtgen_family = AF_UNSPEC;
+
+	if (send(fd, &req, req.hdr.nlmsg_len, 0) < 0) {
+		ee("send(%u) failed, %s\n", type, strerror(errno));
+		return -1;
+	}
+
+	do {
+		if (poll(&fds, 1, -1) < 0 && errno != EINTR)
+			return -1;
+	} while (!handle_msgs(fd));
+
+	return 0;
+}
+
+static int follow(void)
+{
+	struct sockaddr_nl sa = {0};
+	int32_t size = RCVBUF_SIZE;
+	struct pollfd fds;
+
+	fds.fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+	if (fds.fd < 0) {
+		ee("socket() failed\n");
+		return 1;
+	}
+
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+	setsockopt(fds.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (bind(fds.fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		ee("bind() failed\n");
+		return 1;
+	}
+
+	fds.events = POLLIN;
+	overrun_ = 1; /* initial dump */
+
+	while (1) {
+		if (overrun_) { /* only deltas come, so start over */
+			overrun_ = 0;
+			report_ = 0;
+			ifaces_num_ = 0;
+
+			if (dump(fds.fd, RTM_GETLINK) < 0 ||
+			    dump(fds.fd, RTM_GETADDR) < 0)
+				return 1;
+
+			report_ = 1;
+			push_dock();
+			continue; /* overrun could happen during dump too */
+		}
+
+		if (poll(&fds, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			ee("poll() failed, %s\n", strerror(errno));
+			return 1;
+		}
+
+		handle_msgs(fds.fd);
+		push_dock();
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *home = getenv("FWM_HOME");
+	const char *disp = getenv("DISPLAY");
+	uint8_t stream = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (opt(argv[i], "-f", "--follow")) {
+			stream = 1;
+			continue;
+		} else if (i + 1 >= argc) {
+			help(argv[0]);
+			return !opt(argv[i], "-h", "--help");
+		} else if (opt(argv[i], "-k", "--kind")) {
+			i++;
+			kind_ = !strcmp(argv[i], "wired") ? KIND_WIRED :
+			 !strcmp(argv[i], "wireless") ? KIND_WIRELESS : KIND_ANY;
+		} else if (opt(argv[i], "-p", "--pid")) {
+			dock_.pid = argv[++i];
+		} else if (opt(argv[i], "-i", "--icon")) {
+			dock_.icon = argv[++i];
+		} else if (opt(argv[i], "-fg", "--fgcolor")) {
+			dock_.fg = argv[++i];
+		} else if (opt(argv[i], "-dim", "--dimcolor")) {
+			dock_.dimfg = argv[++i];
+		} else {
+			help(argv[0]);
+			return 1;
+		}
+	}
+
+	if (dock_.pid) {
+		if (!dock_.icon || !dock_.fg || !dock_.dimfg || !home || !disp) {
+			ee("dock needs icon, colors, FWM_HOME and DISPLAY\n");
+			return 1;
+		}
+
+		snprintf(dock_.ctl, sizeof(dock_.ctl), "%s/.control%s", home,
+		 disp);
+		stream = 1;
+	}
+
+	if (stream)
+		return follow();
+
+	return wait_link();
+}
@@ -8,6 +8,11 @@
 #include <freetype/tttables.h>
 #include <freetype/ftglyph.h>
 #include <xcb/xcb_image.h>
+#ifdef USE_SHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+#endif
 
 #ifndef MAX_PATH
 #define MAX_PATH 128U
@@ -121,6 +126,117 @@ struct font_buf {
 static FT_Library fontlib_;
 static struct font fontcache_[MAX_FONTS];
 
+#ifdef USE_SHM
+/* glyphs are rasterized straight into memory shared with X server and
+ * published with shm put image; segment is used as a ring of two halves,
+ * entering one sends a fence request for the other, and that fence is
+ * waited for only before the other half is reused; by then its reply has
+ * normally arrived, so drawing does not block on the server */
+
+#define SHM_SIZE (1024 * 1024)
+#define SHM_HALF (SHM_SIZE / 2)
+
+static struct {
+	xcb_connection_t *dpy; /* segment is attached to this connection */
+	xcb_shm_seg_t seg;
+	uint8_t *mem;
+	uint32_t off;
+	xcb_get_input_focus_cookie_t fence[2]; /* per half */
+	uint8_t fenced; /* bit per half with fence pending */
+	uint8_t half; /* off is in this one */
+	uint8_t failed:1;
+} shm_;
+
+static uint8_t init_shm(xcb_connection_t *dpy)
+{
+	const xcb_query_extension_reply_t *ext;
+	xcb_generic_error_t *err;
+	int id;
+
+	if (shm_.dpy == dpy)
+		return 1;
+	else if (shm_.failed)
+		return 0;
+
+	shm_.failed = 1; /* until proven otherwise */
+	ext = xcb_get_extension_data(dpy, &xcb_shm_id);
+
+	if (!ext || !ext->present) {
+		ii("MIT-SHM is not available, use socket\n");
+		return 0;
+	}
+
+	if ((id = shmget(IPC_PRIVATE, SHM_SIZE, IPC_CREAT | 0600)) < 0) {
+		ee("shmget(%u) failed\n", SHM_SIZE);
+		return 0;
+	}
+
+	if ((shm_.mem = shmat(id, NULL, 0)) == (void *) -1) {
+		ee("shmat(%d) failed\n", id);
+		shmctl(id, IPC_RMID, NULL);
+		shm_.mem = NULL;
+		return 0;
+	}
+
+	shm_.seg = xcb_generate_id(dpy);
+	err = xcb_request_check(dpy, xcb_shm_attach_checked(dpy, shm_.seg, id,
+	 1));
+	shmctl(id, IPC_RMID, NULL); /* goes away with last detach */
+
+	if (err) { /* e.g. remote display */
+		ii("MIT-SHM attach failed, use socket\n");
+		free(err);
+		shmdt(shm_.mem);
+		shm_.mem = NULL;
+		return 0;
+	}
+
+	shm_.dpy = dpy;
+	shm_.off = 0;
+	shm_.fenced = 0;
+	shm_.half = 0;
+	shm_.failed = 0;
+	return 1;
+}
+
+static void shm_enter(xcb_connection_t *dpy, uint8_t half)
+{
+	if (shm_.fenced & (1 << half)) { /* puts from last lap are done */
+		free(xcb_get_input_focus_reply(dpy, shm_.fence[half], NULL));
+		shm_.fenced &= ~(1 << half);
+	}
+
+	shm_.fence[!half] = xcb_get_input_focus(dpy);
+	shm_.fenced |= 1 << !half;
+}
+
+static uint8_t *shm_alloc(xcb_connection_t *dpy, uint32_t size)
+{
+	uint32_t end;
+	uint8_t *ptr;
+
+	if (size > SHM_HALF || !init_shm(dpy))
+		return NULL;
+
+	end = (shm_.half + 1) * SHM_HALF;
+
+	if (shm_.off + size > end) { /* next half, wraps after second one */
+		shm_.half = !shm_.half;
+		shm_.off = shm_.half * SHM_HALF;
+		shm_enter(dpy, shm_.half);
+	}
+
+	ptr = shm_.mem + shm_.off;
+	shm_.off += (size + 63) & ~63;
+	return ptr;
+}
+
+static inline uint8_t shm_owns(uint8_t *ptr)
+{
+	return shm_.mem && ptr >= shm_.mem && ptr < shm_.mem + SHM_SIZE;
+}
+#endif
+
 static inline uint32_t hash32(char const *s, size_t n)
 {
 	return n ? (hash32(s, n - 1) ^ s[n - 1]) * 16777619U : 2166136261U;
@@ -206,7 +322,7 @@ static uint8_t resize_glyphs_cache(struct font *font, float font_size)
 	}
 
 	cur_size = font->glyphs_num * sizeof(*font->glyphs_cache);
-	mem_size = ++font->glyphs_num + sizeof(struct glyphs_cache);
+	mem_size = ++font->glyphs_num * sizeof(struct glyphs_cache);
 	new_glyphs_cache = realloc(font->glyphs_cache, mem_size);
 	if (!new_glyphs_cache) {
 		ee("failed to allocate %zu bytes\n", mem_size);
@@ -335,11 +451,12 @@ static uint8_t cache_glyph(struct font *font, float font_size, uint32_t idx)
 	glyphs_cache = find_glyphs_cache(font, font_size);
 
 	/* ... if not found create new cache entry with given font size */
-	if (!glyphs_cache && !resize_glyphs_cache(font, font_size)) {
-		return 0;
-	}
+	if (!glyphs_cache) {
+		if (!resize_glyphs_cache(font, font_size))
+			return 0;
 
-	glyphs_cache = &font->glyphs_cache[font->glyphs_num - 1];
+		glyphs_cache = &font->glyphs_cache[font->glyphs_num - 1];
+	}
 	dd("cache glyph %u cache size %u font size %.02f\n", idx,
 	 glyphs_cache->glyphs_num, glyphs_cache->font_size);
 	if (glyphs_cache->glyphs_num <= idx) {
@@ -484,7 +601,17 @@ static inline void draw_pixel(struct draw *d)
 static inline void draw_bmp(struct draw *d, struct bmp *bmp, uint16_t y)
 {
 	xcb_image_t *img;
-	xcb_pixmap_t pix = xcb_generate_id(d->xcb->dpy);
+	xcb_pixmap_t pix;
+
+#ifdef USE_SHM
+	if (shm_owns(bmp->data)) {
+		xcb_shm_put_image(d->xcb->dpy, d->xcb->win, d->xcb->gc, bmp->w,
+		 bmp->h, 0, 0, bmp->w, bmp->h, d->x, y, d->depth,
+		 XCB_IMAGE_FORMAT_Z_PIXMAP, 0, shm_.seg, bmp->data - shm_.mem);
+		return;
+	}
+#endif
+	pix = xcb_generate_id(d->xcb->dpy);
 
 	if (!pix) {
 		ee("failed to create pixmap from bmp %p wh (%u %u)\n",
@@ -538,6 +665,13 @@ static inline void draw_glyph(struct draw *d)
 	uint8_t *rgba_ptr = d->font->bmp.data;
 	struct bmp buf;
 
+#ifdef USE_SHM
+	uint8_t *shm = shm_alloc(d->xcb->dpy, bmp->width * bmp->rows * 4);
+
+	if (shm)
+		rgba_ptr = shm;
+#endif
+
 	buf.w = bmp->width;
 	buf.h = bmp->rows;
 	buf.data = rgba_ptr;
@@ -633,7 +767,10 @@ static inline void draw_glyph(struct draw *d)
 #endif
 }
 
-void draw_text_xcb(struct xcb *xcb, struct text *text)
+/* walk glyphs up to @until drawing those from @from on when @xcb is given,
+ * returns pen position where walk stopped relative to text origin */
+static int16_t walk_text(struct xcb *xcb, struct text *text, uint16_t from,
+ uint16_t until)
 {
 	xcb_screen_t *scr;
 	uint32_t c;
@@ -641,34 +778,38 @@ void draw_text_xcb(struct xcb *xcb, struct text *text)
 	struct glyphs_cache *glyphs_cache;
 	struct draw draw;
 	uint32_t prev_idx = 0;
+	uint16_t i;
 
 	/* sanity checks */
 	if (!text || !text->str) {
-		return;
+		return 0;
 	} else if (invalid_font_id(text->font_id)) {
-		return;
+		return 0;
 	} else if (text->font_size > MAX_FONT_SIZE) {
-		return;
+		return 0;
 	} else if (!text->y_max) {
 		measure_text(text);
 	}
 
 	font = &fontcache_[text->font_id];
 	if (!(glyphs_cache = find_glyphs_cache(font, text->font_size)))
-		return;
+		return 0;
 
 	draw.x = text->x;
 	draw.text = text;
 	draw.xcb = xcb;
-	scr = xcb_setup_roots_iterator(xcb_get_setup(xcb->dpy)).data;
-	if (!scr) {
-		ee("failed to get screen\n");
-		return;
-	}
-	draw.depth = scr->root_depth;
 	draw.font = font;
 
-	for (uint16_t i = 0; (c = getc_utf8(text->str, text->len, i)); ++i) {
+	if (xcb) {
+		scr = xcb_setup_roots_iterator(xcb_get_setup(xcb->dpy)).data;
+		if (!scr) {
+			ee("failed to get screen\n");
+			return 0;
+		}
+		draw.depth = scr->root_depth;
+	}
+
+	for (i = 0; i < until && (c = getc_utf8(text->str, text->len, i)); ++i) {
 		int8_t kerning;
 		uint32_t idx = FT_Get_Char_Index(font->face, c);
 
@@ -694,15 +835,34 @@ void draw_text_xcb(struct xcb *xcb, struct text *text)
 		if (text->fade_idx && i > text->fade_idx)
 			text->fade += text->fade_step;
 
-		draw_glyph(&draw);
+		if (xcb && i >= from)
+			draw_glyph(&draw);
+
 		draw.x += draw.glyph->x_adv + kerning;
 		prev_idx = idx;
 	}
 
 	text->fade = 0;
+	return draw.x - text->x;
+}
+
+void draw_text_xcb(struct xcb *xcb, struct text *text)
+{
+	walk_text(xcb, text, 0, UINT16_MAX);
 	xcb_flush(xcb->dpy);
 }
 
+void draw_text_xcb_from(struct xcb *xcb, struct text *text, uint16_t glyph_idx)
+{
+	walk_text(xcb, text, glyph_idx, UINT16_MAX);
+	xcb_flush(xcb->dpy);
+}
+
+int16_t get_text_glyph_x(struct text *text, uint16_t glyph_idx)
+{
+	return walk_text(NULL, text, 0, glyph_idx);
+}
+
 void set_text_fade(struct text *text, uint16_t glyph_idx)
 {
 	text->fade_idx = glyph_idx;
@@ -814,10 +974,20 @@ void close_font(fontid_t font_id)
 
 	free(font->bmp.data);
 	font->bmp.data = NULL;
+	font->bmp.w = 0;
+	font->bmp.h = 0;
 	free(font->glyphs_cache);
 	font->glyphs_cache = NULL;
 	font->glyphs_num = 0;
 	font->font_hash = 0;
+
+	if (font->face) { /* release slot so font can be opened again */
+		FT_Done_Face(font->face);
+		font->face = NULL;
+	}
+
+	free((void *) font->font_data);
+	font->font_data = NULL;
 }
 
 fontid_t open_font(const char *path, uint16_t hdpi, uint16_t vdpi)
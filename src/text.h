@@ -38,3 +38,5 @@ void set_text_color(struct text *, uint32_t fg, uint32_t bg);
 void get_text_size(struct text *, uint16_t *w, uint16_t *h);
 void set_text_fade(struct text *, uint16_t glyph_idx);
 void draw_text_xcb(struct xcb *xcb, struct text *text);
+void draw_text_xcb_from(struct xcb *xcb, struct text *text, uint16_t glyph_idx);
+int16_t get_text_glyph_x(struct text *text, uint16_t glyph_idx);
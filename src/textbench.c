@@ -0,0 +1,309 @@
+/* textbench.c: text rendering library benchmark
+ *
+ * Measures open_font(), cold and warm glyph caching through
+ * get_text_size() and draw_text_xcb() for several fonts, resolutions and
+ * strings. X requests are counted by sequence numbers, so nothing has to
+ * be added to text.c for that.
+ *
+ * Copyright (c) 2017, Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * Released under the GNU General Public License, version 2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <xcb/xcb.h>
+
+#include "misc.h"
+#include "text.h"
+
+#define DEFAULT_FONT_SIZE 10.5f
+#define DEFAULT_ICONS "icons/fontawesome-webfont.ttf"
+#define MAX_ITEMS 8
+#define MAX_STR 1024
+#define WIN_W 1024
+#define WIN_H 128
+
+struct sample {
+	const char *name;
+	const char *unit; /* repeated to get wanted length */
+};
+
+static const struct sample samples_[] = {
+	{ "ascii", "The quick brown fox jumps over the lazy dog. ", },
+	{ "cjk", "窓管理者は文字列を描画します。", },
+	{ "icons", "\uf015\uf013\uf0e0\uf1eb\uf240\uf028\uf011 ", },
+};
+
+static const uint16_t lengths_[] = { 8, 32, 128, }; /* in glyphs */
+
+struct ctx {
+	xcb_connection_t *dpy;
+	struct xcb xcb;
+	const char *fonts[MAX_ITEMS];
+	uint8_t fonts_num;
+	uint16_t dpis[MAX_ITEMS];
+	uint8_t dpis_num;
+	float size;
+	uint32_t n; /* warm iterations */
+};
+
+static int opt(const char *arg, const char *args, const char *argl)
+{
+	return (strcmp(arg, args) == 0 || strcmp(arg, argl) == 0);
+}
+
+static void help(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	 "\nOptions:\n"
+	 "  -f, --font <path>    font to measure, up to %u (default FWM_FONT\n"
+	 "                       and FWM_ICONS or " DEFAULT_ICONS ")\n"
+	 "  -d, --dpi <n>        resolution, up to %u (default 96 and 192)\n"
+	 "  -s, --size <pt>      font size (default %.1f)\n"
+	 "  -n, --count <n>      warm iterations (default 100)\n"
+	 "  -h, --help           print this message\n"
+	 "\nEach font, dpi and string prints one line of key=value pairs.\n\n",
+	 prog, MAX_ITEMS, MAX_ITEMS, DEFAULT_FONT_SIZE);
+}
+
+static uint64_t time_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static size_t heap_used(void)
+{
+	return mallinfo2().uordblks;
+}
+
+/* repeat @unit until @glyphs utf8 characters are collected */
+
+static uint16_t make_str(char *buf, const char *unit, uint16_t glyphs)
+{
+	uint16_t len = 0;
+	const char *ptr = unit;
+
+	while (glyphs && len < MAX_STR - 4) {
+		if (!*ptr)
+			ptr = unit;
+
+		do {
+			buf[len++] = *ptr++;
+		} while ((*ptr & 0xc0) == 0x80); /* continuation bytes */
+
+		glyphs--;
+	}
+
+	buf[len] = '\0';
+	return len;
+}
+
+/* sequence of no-op request tells how many requests were sent before it */
+
+static uint32_t sequence(xcb_connection_t *dpy)
+{
+	return xcb_no_operation(dpy).sequence;
+}
+
+static void sync_server(xcb_connection_t *dpy)
+{
+	free(xcb_get_input_focus_reply(dpy, xcb_get_input_focus(dpy), NULL));
+}
+
+static int run(struct ctx *ctx, const char *path, uint16_t dpi,
+	       const struct sample *sample, uint16_t glyphs)
+{
+	char str[MAX_STR];
+	uint64_t t0, open_ns, cold_ns, warm_ns, draw_ns;
+	uint32_t seq, reqs, i;
+	size_t heap;
+	uint16_t len, w, h;
+	struct text *text;
+	fontid_t font_id;
+	const char *name;
+
+	if (!(text = create_text()))
+		return -1;
+
+	len = make_str(str, sample->unit, glyphs);
+	heap = heap_used();
+
+	t0 = time_ns();
+	font_id = open_font(path, dpi, dpi);
+	open_ns = time_ns() - t0;
+
+	if (font_id == INVALID_FONT_ID) {
+		destroy_text(&text);
+		return -1;
+	}
+
+	set_text_font(text, font_id, ctx->size);
+	set_text_str(text, str, len);
+	set_text_color(text, 0xc0c0c0, 0x202020);
+	set_text_pos(text, 0, 0);
+
+	t0 = time_ns();
+	get_text_size(text, &w, &h); /* rasterizes every glyph */
+	cold_ns = time_ns() - t0;
+
+	t0 = time_ns();
+
+	for (i = 0; i < ctx->n; i++) {
+		set_text_str(text, str, len); /* drop previous measurements */
+		get_text_size(text, &w, &h);
+	}
+
+	warm_ns = time_ns() - t0;
+	set_text_pos(text, 0, h);
+	sync_server(ctx->dpy);
+	seq = sequence(ctx->dpy);
+	t0 = time_ns();
+
+	for (i = 0; i < ctx->n; i++)
+		draw_text_xcb(&ctx->xcb, text);
+
+	reqs = sequence(ctx->dpy) - seq - 1;
+	sync_server(ctx->dpy);
+	draw_ns = time_ns() - t0;
+	heap = heap_used() - heap;
+
+	if (!(name = strrchr(path, '/')))
+		name = path;
+	else
+		name++;
+
+	printf("font=%s dpi=%u size=%.1f str=%s glyphs=%u w=%u h=%u "
+	       "open_us=%.1f cold_ns_glyph=%.0f warm_ns_glyph=%.1f "
+	       "draw_ns_glyph=%.1f req_glyph=%.2f heap_kb=%zu\n", name, dpi,
+	       ctx->size, sample->name, glyphs, w, h, open_ns / 1e3,
+	       (double) cold_ns / glyphs,
+	       (double) warm_ns / glyphs / ctx->n,
+	       (double) draw_ns / glyphs / ctx->n,
+	       (double) reqs / glyphs / ctx->n, heap / 1024);
+	fflush(stdout);
+
+	close_font(font_id); /* next run starts with cold cache again */
+	destroy_text(&text);
+	return 0;
+}
+
+static int init_window(struct ctx *ctx)
+{
+	xcb_screen_t *scr;
+	uint32_t val[2];
+
+	ctx->dpy = xcb_connect(NULL, NULL);
+
+	if (xcb_connection_has_error(ctx->dpy)) {
+		ee("xcb_connect() failed\n");
+		return -1;
+	}
+
+	scr = xcb_setup_roots_iterator(xcb_get_setup(ctx->dpy)).data;
+	ctx->xcb.dpy = ctx->dpy;
+	ctx->xcb.win = xcb_generate_id(ctx->dpy);
+	ctx->xcb.gc = xcb_generate_id(ctx->dpy);
+
+	val[0] = 0x202020;
+	val[1] = 1; /* override redirect, no window manager is expected */
+	xcb_create_window(ctx->dpy, XCB_COPY_FROM_PARENT, ctx->xcb.win,
+			  scr->root, 0, 0, WIN_W, WIN_H, 0,
+			  XCB_WINDOW_CLASS_INPUT_OUTPUT, scr->root_visual,
+			  XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT, val);
+
+	val[0] = 0xc0c0c0;
+	val[1] = 0;
+	xcb_create_gc(ctx->dpy, ctx->xcb.gc, ctx->xcb.win,
+		      XCB_GC_FOREGROUND | XCB_GC_GRAPHICS_EXPOSURES, val);
+	xcb_map_window(ctx->dpy, ctx->xcb.win);
+	sync_server(ctx->dpy);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ctx ctx = { .size = DEFAULT_FONT_SIZE, .n = 100, };
+	struct rusage usage;
+	const char *str;
+	uint8_t i, j, k, l;
+	int ret = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (opt(argv[i], "-h", "--help")) {
+			help(argv[0]);
+			return 0;
+		} else if (i + 1 >= argc) {
+			help(argv[0]);
+			return 1;
+		} else if (opt(argv[i], "-f", "--font")) {
+			if (ctx.fonts_num < MAX_ITEMS)
+				ctx.fonts[ctx.fonts_num++] = argv[i + 1];
+		} else if (opt(argv[i], "-d", "--dpi")) {
+			if (ctx.dpis_num < MAX_ITEMS)
+				ctx.dpis[ctx.dpis_num++] = atoi(argv[i + 1]);
+		} else if (opt(argv[i], "-s", "--size")) {
+			ctx.size = atof(argv[i + 1]);
+		} else if (opt(argv[i], "-n", "--count")) {
+			ctx.n = atoi(argv[i + 1]);
+		} else {
+			help(argv[0]);
+			return 1;
+		}
+
+		i++;
+	}
+
+	if (!ctx.fonts_num) {
+		if ((str = getenv("FWM_FONT")))
+			ctx.fonts[ctx.fonts_num++] = str;
+
+		if (!(str = getenv("FWM_ICONS")))
+			str = DEFAULT_ICONS;
+
+		ctx.fonts[ctx.fonts_num++] = str;
+	}
+
+	if (!ctx.dpis_num) {
+		ctx.dpis[ctx.dpis_num++] = 96;
+		ctx.dpis[ctx.dpis_num++] = 192;
+	}
+
+	if (!ctx.n || ctx.size <= 0) {
+		help(argv[0]);
+		return 1;
+	}
+
+	if (init_window(&ctx) < 0)
+		goto out;
+
+	for (i = 0; i < ctx.fonts_num; i++) {
+		for (j = 0; j < ctx.dpis_num; j++) {
+			for (k = 0; k < ARRAY_SIZE(samples_); k++) {
+				for (l = 0; l < ARRAY_SIZE(lengths_); l++) {
+					if (run(&ctx, ctx.fonts[i], ctx.dpis[j],
+						&samples_[k], lengths_[l]) < 0)
+						goto out;
+				}
+			}
+		}
+	}
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("peak_rss_kb=%ld\n", usage.ru_maxrss);
+	ret = 0;
+out:
+	if (ctx.dpy)
+		xcb_disconnect(ctx.dpy);
+
+	return ret;
+}
@@ -0,0 +1,53 @@
+/* trace.h: event trace written by fwm and replayed by fwm-loadgen
+ *
+ * Copyright (c) 2017, Aliaksei Katovich <aliaksei.katovich at gmail.com>
+ *
+ * Released under the GNU General Public License, version 2
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Trace starts with header followed by records. Each record is header
+ * with time passed since previous record and payload of given length:
+ *
+ *   TRACE_REC_EVENT    32 bytes of X event as received by fwm
+ *   TRACE_REC_CONTROL  control request string, not terminated
+ *   TRACE_REC_ATOM     32-bit atom followed by its name, recorded once
+ *                      before first event referring to atom which is not
+ *                      predefined
+ *
+ * Windows created by fwm itself match resource base and mask stored in
+ * header, replay skips them.
+ */
+
+#define TRACE_MAGIC 0x63727466U /* "ftrc" */
+#define TRACE_VERSION 1
+#define TRACE_EVENT_LEN 32
+
+enum trace_type {
+	TRACE_REC_EVENT,
+	TRACE_REC_CONTROL,
+	TRACE_REC_ATOM,
+};
+
+struct trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t root_w;
+	uint16_t root_h;
+	uint8_t randrbase;
+	uint8_t pad;
+	uint32_t resource_base;
+	uint32_t resource_mask;
+} __attribute__((packed));
+
+struct trace_record {
+	uint32_t delta_us;
+	uint8_t type; /* enum trace_type */
+	uint8_t len;
+} __attribute__((packed));
+
+#endif /* TRACE_H */